@@ -13,7 +13,27 @@ declare -a SRC
 SRC=( errors
       buf
       process
-      net )
+      net
+      frag
+      pace
+      timer
+      pcap
+      pack
+      crc
+      ring
+      rpc
+      flow
+      shed
+      filter
+      handover
+      sim )
+
+declare -a BIN
+BIN=( loadgen
+      rpcload
+      shedbench
+      unixbench
+      crcbench )
 
 declare -a TEST
 TEST=(  )
@@ -53,6 +73,10 @@ for src in "${SRC[@]}"; do
 done
 "$AR" rcs "$LIB" $OBJ
 
+for bin in "${BIN[@]}"; do
+    "$CC" -o "$bin" "${PREFIX}/tools/$bin.c" "$LIB" $DEPS -lm $CFLAGS
+done
+
 # "$CC" -c -o test.o "${PREFIX}/test/test.c" $CFLAGS
 # TEST_DEPS="test.o $LIB $DEPS -lcmocka"
 
@@ -7,6 +7,7 @@
 #include "bits.h"
 #include "math.h"
 #include "errors.h"
+#include "probe.h"
 
 #include <string.h>
 
@@ -54,7 +55,7 @@ size_t pond_bin_append(struct pond_bin *bin, const uint8_t *src, size_t len)
     size_t rem = bin->cap - bin->len;
     len = pond_min(len, rem);
 
-    memcpy(bin->d, src, bin->len);
+    memcpy(bin->d + bin->len, src, len);
     bin->len += len;
 
     return len;
@@ -76,6 +77,7 @@ void pond_buf_reserve(struct pond_buf *buf, size_t cap)
 {
     if (buf->cap >= cap) return;
     cap = pond_ceil_pow2(cap);
+    pond_probe2(buf_reserve, buf->cap, cap);
 
     if (!buf->cap) {
         buf->d = calloc(1, cap);
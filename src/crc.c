@@ -0,0 +1,385 @@
+/* crc.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   The hardware path follows Mark Adler's approach of running three
+   independent crc32 streams to hide the latency of the instruction and
+   then combining them using precomputed zero-shift tables.
+*/
+
+#include "crc.h"
+#include "net.h"
+#include "buf.h"
+#include "bits.h"
+#include "math.h"
+#include "errors.h"
+
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+# include <nmmintrin.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+// tables
+// -----------------------------------------------------------------------------
+
+enum
+{
+    crc_poly = 0x82f63b78,
+    crc_long = 8192,
+    crc_short = 256,
+};
+
+static uint32_t crc_table[8][256];
+static uint32_t crc_zeros_long[4][256];
+static uint32_t crc_zeros_short[4][256];
+
+static uint32_t crc_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++) {
+        if (vec & 1) sum ^= *mat;
+    }
+    return sum;
+}
+
+static void crc_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+    for (size_t i = 0; i < 32; ++i)
+        square[i] = crc_gf2_times(mat, mat[i]);
+}
+
+// Operator which applies len zero bytes to a crc where len is a power of 2.
+static void crc_zeros_op(uint32_t *even, size_t len)
+{
+    uint32_t odd[32];
+
+    odd[0] = crc_poly;
+    for (size_t i = 1; i < 32; ++i) odd[i] = 1U << (i - 1);
+
+    crc_gf2_square(even, odd); // 2 bits
+    crc_gf2_square(odd, even); // 4 bits
+
+    while (true) {
+        crc_gf2_square(even, odd);
+        len >>= 1;
+        if (!len) return;
+
+        crc_gf2_square(odd, even);
+        len >>= 1;
+        if (!len) break;
+    }
+
+    memcpy(even, odd, sizeof(odd));
+}
+
+static void crc_zeros(uint32_t zeros[4][256], size_t len)
+{
+    uint32_t op[32];
+    crc_zeros_op(op, len);
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        zeros[0][i] = crc_gf2_times(op, i);
+        zeros[1][i] = crc_gf2_times(op, i << 8);
+        zeros[2][i] = crc_gf2_times(op, i << 16);
+        zeros[3][i] = crc_gf2_times(op, i << 24);
+    }
+}
+
+static uint32_t crc_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^
+        zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+
+// -----------------------------------------------------------------------------
+// sw
+// -----------------------------------------------------------------------------
+
+static uint32_t crc_sw(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *it = data;
+    uint64_t crc0 = crc ^ 0xFFFFFFFF;
+
+    for (; len && ((uintptr_t) it & 7); --len, ++it)
+        crc0 = crc_table[0][(crc0 ^ *it) & 0xFF] ^ (crc0 >> 8);
+
+    for (; len >= 8; len -= 8, it += 8) {
+        uint64_t word;
+        memcpy(&word, it, sizeof(word));
+        crc0 ^= le64toh(word);
+
+        crc0 =
+            crc_table[7][crc0 & 0xFF] ^
+            crc_table[6][(crc0 >> 8) & 0xFF] ^
+            crc_table[5][(crc0 >> 16) & 0xFF] ^
+            crc_table[4][(crc0 >> 24) & 0xFF] ^
+            crc_table[3][(crc0 >> 32) & 0xFF] ^
+            crc_table[2][(crc0 >> 40) & 0xFF] ^
+            crc_table[1][(crc0 >> 48) & 0xFF] ^
+            crc_table[0][crc0 >> 56];
+    }
+
+    for (; len; --len, ++it)
+        crc0 = crc_table[0][(crc0 ^ *it) & 0xFF] ^ (crc0 >> 8);
+
+    return crc0 ^ 0xFFFFFFFF;
+}
+
+
+// -----------------------------------------------------------------------------
+// hw
+// -----------------------------------------------------------------------------
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *it = data;
+    uint64_t crc0 = crc ^ 0xFFFFFFFF;
+
+    for (; len && ((uintptr_t) it & 7); --len, ++it)
+        crc0 = _mm_crc32_u8(crc0, *it);
+
+    // The three streams run over adjacent blocks and are then merged by
+    // shifting the running crc over the length of the next block.
+    for (; len >= crc_long * 3; len -= crc_long * 3) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const uint8_t *end = it + crc_long;
+
+        for (; it < end; it += 8) {
+            crc0 = _mm_crc32_u64(crc0, *(const uint64_t *) it);
+            crc1 = _mm_crc32_u64(crc1, *(const uint64_t *) (it + crc_long));
+            crc2 = _mm_crc32_u64(crc2, *(const uint64_t *) (it + crc_long * 2));
+        }
+
+        crc0 = crc_shift(crc_zeros_long, crc0) ^ crc1;
+        crc0 = crc_shift(crc_zeros_long, crc0) ^ crc2;
+        it += crc_long * 2;
+    }
+
+    for (; len >= crc_short * 3; len -= crc_short * 3) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const uint8_t *end = it + crc_short;
+
+        for (; it < end; it += 8) {
+            crc0 = _mm_crc32_u64(crc0, *(const uint64_t *) it);
+            crc1 = _mm_crc32_u64(crc1, *(const uint64_t *) (it + crc_short));
+            crc2 = _mm_crc32_u64(crc2, *(const uint64_t *) (it + crc_short * 2));
+        }
+
+        crc0 = crc_shift(crc_zeros_short, crc0) ^ crc1;
+        crc0 = crc_shift(crc_zeros_short, crc0) ^ crc2;
+        it += crc_short * 2;
+    }
+
+    for (; len >= 8; len -= 8, it += 8)
+        crc0 = _mm_crc32_u64(crc0, *(const uint64_t *) it);
+
+    for (; len; --len, ++it)
+        crc0 = _mm_crc32_u8(crc0, *it);
+
+    return crc0 ^ 0xFFFFFFFF;
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// crc
+// -----------------------------------------------------------------------------
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc_impl) (uint32_t, const void *, size_t) = crc_sw;
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (size_t j = 0; j < 8; ++j)
+            crc = crc & 1 ? (crc >> 1) ^ crc_poly : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = crc_table[0][i];
+        for (size_t j = 1; j < 8; ++j) {
+            crc = crc_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc_table[j][i] = crc;
+        }
+    }
+
+    crc_zeros(crc_zeros_long, crc_long);
+    crc_zeros(crc_zeros_short, crc_short);
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc_impl = crc_hw;
+#endif
+}
+
+uint32_t pond_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc_init);
+    return crc_impl(crc, data, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// stamp
+// -----------------------------------------------------------------------------
+
+static void crc_write(uint8_t *dst, uint32_t crc)
+{
+    crc = htole32(crc);
+    memcpy(dst, &crc, sizeof(crc));
+}
+
+static uint32_t crc_read(const uint8_t *src)
+{
+    uint32_t crc;
+    memcpy(&crc, src, sizeof(crc));
+    return le32toh(crc);
+}
+
+bool pond_crc_bin_stamp(struct pond_bin *bin)
+{
+    if (bin->cap - bin->len < pond_crc_len) {
+        pond_fail("no room for crc: %zu + %d > %zu", bin->len, pond_crc_len, bin->cap);
+        return false;
+    }
+
+    crc_write(bin->d + bin->len, pond_crc32c(0, bin->d, bin->len));
+    bin->len += pond_crc_len;
+    return true;
+}
+
+bool pond_crc_bin_check(struct pond_bin *bin)
+{
+    if (bin->len < pond_crc_len) return false;
+
+    size_t len = bin->len - pond_crc_len;
+    if (pond_crc32c(0, bin->d, len) != crc_read(bin->d + len)) return false;
+
+    bin->len = len;
+    return true;
+}
+
+bool pond_crc_iov_stamp(struct pond_iov *iov)
+{
+    if (iov->cap - iov->len < pond_crc_len) {
+        pond_fail("no room for crc: %zu + %d > %zu", iov->len, pond_crc_len, iov->cap);
+        return false;
+    }
+
+    crc_write(iov->bin + iov->len, pond_crc32c(0, iov->bin, iov->len));
+    iov->len += pond_crc_len;
+    return true;
+}
+
+bool pond_crc_iov_check(struct pond_iov *iov)
+{
+    if (iov->len < pond_crc_len) return false;
+
+    size_t len = iov->len - pond_crc_len;
+    if (pond_crc32c(0, iov->bin, len) != crc_read(iov->bin + len)) return false;
+
+    iov->len = len;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// mmsg
+// -----------------------------------------------------------------------------
+
+static bool crc_iovec_stamp(struct pond_iovec *iovec)
+{
+    uint32_t crc = 0;
+    for (size_t j = 0; j < iovec->len; ++j)
+        crc = pond_crc32c(crc, iovec->vec[j].bin, iovec->vec[j].len);
+
+    uint8_t trailer[pond_crc_len];
+    crc_write(trailer, crc);
+
+    // The trailer can straddle the last used iov and the following ones.
+    size_t j = iovec->len ? iovec->len - 1 : 0;
+    size_t written = 0;
+    for (; j < iovec->cap && written < pond_crc_len; ++j) {
+        if (j >= iovec->len) iovec->vec[j].len = 0;
+        written += pond_iov_append(&iovec->vec[j], trailer + written, pond_crc_len - written);
+        if (iovec->vec[j].len) iovec->len = j + 1;
+    }
+
+    if (written == pond_crc_len) return true;
+
+    pond_fail("no room for crc in iovec");
+    return false;
+}
+
+bool pond_crc_mmsg_stamp(struct pond_mmsg *mmsg, size_t len)
+{
+    len = pond_min(len, pond_mmsg_cap(mmsg));
+
+    for (size_t i = 0; i < len; ++i) {
+        if (!crc_iovec_stamp(pond_mmsg_iovec(mmsg, i))) return false;
+    }
+
+    return true;
+}
+
+static bool crc_iovec_check(struct pond_iovec *iovec)
+{
+    size_t total = 0;
+    for (size_t j = 0; j < iovec->len; ++j) total += iovec->vec[j].len;
+    if (total < pond_crc_len) return false;
+
+    uint32_t crc = 0;
+    size_t left = total - pond_crc_len;
+    uint8_t trailer[pond_crc_len];
+    size_t trailer_len = 0;
+
+    for (size_t j = 0; j < iovec->len; ++j) {
+        struct pond_iov *iov = &iovec->vec[j];
+        size_t n = pond_min(left, iov->len);
+        crc = pond_crc32c(crc, iov->bin, n);
+        left -= n;
+
+        memcpy(trailer + trailer_len, iov->bin + n, iov->len - n);
+        trailer_len += iov->len - n;
+    }
+
+    if (crc != crc_read(trailer)) return false;
+
+    // Strips the trailer which may span multiple iovs.
+    for (size_t strip = pond_crc_len; strip;) {
+        struct pond_iov *iov = &iovec->vec[iovec->len - 1];
+        size_t n = pond_min(strip, iov->len);
+        iov->len -= n;
+        strip -= n;
+        if (!iov->len) iovec->len--;
+    }
+
+    return true;
+}
+
+size_t pond_crc_mmsg_check(struct pond_mmsg *mmsg, uint64_t *failed)
+{
+    size_t len = pond_mmsg_len(mmsg);
+    memset(failed, 0, pond_ceil_div(pond_mmsg_cap(mmsg), 64) * sizeof(*failed));
+
+    size_t count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (crc_iovec_check(pond_mmsg_iovec(mmsg, i))) continue;
+
+        failed[i / 64] |= 1ULL << (i % 64);
+        count++;
+    }
+
+    return count;
+}
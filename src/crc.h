@@ -0,0 +1,53 @@
+/* crc.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   CRC32C payload integrity checks.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_bin;
+struct pond_iov;
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// crc
+// -----------------------------------------------------------------------------
+
+enum { pond_crc_len = 4 };
+
+// Uses the SSE4.2 crc32 instruction when available and falls back to a
+// slicing-by-8 table otherwise. Can be chained by passing in the previous crc
+// and starts from 0.
+uint32_t pond_crc32c(uint32_t crc, const void *data, size_t len);
+
+
+// Stamping appends the crc of the payload as a little-endian trailer which is
+// removed from the length when the check succeeds.
+
+bool pond_crc_bin_stamp(struct pond_bin *);
+bool pond_crc_bin_check(struct pond_bin *);
+
+bool pond_crc_iov_stamp(struct pond_iov *);
+bool pond_crc_iov_check(struct pond_iov *);
+
+// Stamps the first len messages of the batch before they're sent.
+bool pond_crc_mmsg_stamp(struct pond_mmsg *, size_t len);
+
+// Checks every received message of the batch and sets the bit of each failing
+// message in the failed bitfield which must hold at least pond_mmsg_cap bits.
+// Returns the number of failed messages.
+size_t pond_crc_mmsg_check(struct pond_mmsg *, uint64_t *failed);
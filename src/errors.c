@@ -5,6 +5,7 @@
 
 #include "errors.h"
 #include "process.h"
+#include "probe.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -107,6 +108,8 @@ void pond_vfail(const char *file, int line, const char *fmt, ...)
     (void) vsnprintf(pond_errno.msg, pond_err_msg_cap, fmt, args);
     va_end(args);
 
+    pond_probe4(fail, file, line, pond_errno.errno_, pond_errno.msg);
+
     pond_backtrace(&pond_errno);
     if (abort_on_fail) pond_abort();
 }
@@ -121,6 +124,8 @@ void pond_vfail_errno(const char *file, int line, const char *fmt, ...)
     (void) vsnprintf(pond_errno.msg, pond_err_msg_cap, fmt, args);
     va_end(args);
 
+    pond_probe4(fail, file, line, pond_errno.errno_, pond_errno.msg);
+
     pond_backtrace(&pond_errno);
     if (abort_on_fail) pond_abort();
 }
@@ -0,0 +1,420 @@
+/* filter.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "filter.h"
+#include "net.h"
+#include "errors.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// filter
+// -----------------------------------------------------------------------------
+
+enum filter_kind
+{
+    filter_bytes,
+    filter_prefix,
+    filter_len,
+};
+
+struct filter_cond
+{
+    enum filter_kind kind;
+
+    size_t off, len;  // bytes
+    uint8_t value[pond_filter_bytes_cap];
+    uint8_t mask[pond_filter_bytes_cap];
+
+    int family;       // prefix over value with len as the number of bits.
+    size_t min, max;  // len
+};
+
+struct filter_rule
+{
+    enum pond_filter_verdict verdict;
+
+    size_t len;
+    struct filter_cond conds[pond_filter_cond_cap];
+};
+
+struct pond_filter
+{
+    enum pond_filter_verdict fallback;
+
+    size_t rules_len, rules_cap;
+    struct filter_rule *rules;
+
+    size_t insns_len, insns_cap;
+    struct sock_filter *insns;
+};
+
+struct pond_filter *pond_filter_alloc(enum pond_filter_verdict fallback)
+{
+    struct pond_filter *filter = calloc(1, sizeof(*filter));
+    pond_assert_alloc(filter);
+
+    filter->fallback = fallback;
+    return filter;
+}
+
+void pond_filter_free(struct pond_filter *filter)
+{
+    if (!filter) return;
+
+    free(filter->rules);
+    free(filter->insns);
+    free(filter);
+}
+
+void pond_filter_rule(struct pond_filter *filter, enum pond_filter_verdict verdict)
+{
+    if (filter->rules_len == filter->rules_cap) {
+        filter->rules_cap = filter->rules_cap ? filter->rules_cap * 2 : 8;
+        filter->rules = realloc(filter->rules, filter->rules_cap * sizeof(*filter->rules));
+        pond_assert_alloc(filter->rules);
+    }
+
+    filter->rules[filter->rules_len++] = (struct filter_rule) { .verdict = verdict };
+}
+
+static struct filter_cond *filter_cond(struct pond_filter *filter, enum filter_kind kind)
+{
+    if (!filter->rules_len) {
+        pond_fail("filter condition without a rule");
+        return NULL;
+    }
+
+    struct filter_rule *rule = &filter->rules[filter->rules_len - 1];
+    if (rule->len == pond_filter_cond_cap) {
+        pond_fail("too many conditions in filter rule: %d", pond_filter_cond_cap);
+        return NULL;
+    }
+
+    struct filter_cond *cond = &rule->conds[rule->len++];
+    *cond = (struct filter_cond) { .kind = kind };
+    return cond;
+}
+
+bool pond_filter_bytes(
+        struct pond_filter *filter, size_t off,
+        const uint8_t *value, const uint8_t *mask, size_t len)
+{
+    if (len > pond_filter_bytes_cap) {
+        pond_fail("filter bytes too long: %zu > %d", len, pond_filter_bytes_cap);
+        return false;
+    }
+
+    if (off > UINT16_MAX) {
+        pond_fail("filter bytes offset too large: %zu", off);
+        return false;
+    }
+
+    struct filter_cond *cond = filter_cond(filter, filter_bytes);
+    if (!cond) return false;
+
+    cond->off = off;
+    cond->len = len;
+    memcpy(cond->value, value, len);
+    if (mask) memcpy(cond->mask, mask, len);
+    else memset(cond->mask, 0xFF, len);
+
+    return true;
+}
+
+bool pond_filter_prefix(struct pond_filter *filter, const char *prefix)
+{
+    char addr[INET6_ADDRSTRLEN] = {0};
+
+    const char *sep = strchr(prefix, '/');
+    size_t addr_len = sep ? (size_t) (sep - prefix) : strlen(prefix);
+    if (addr_len >= sizeof(addr)) goto invalid;
+    memcpy(addr, prefix, addr_len);
+
+    uint8_t value[16] = {0};
+    int family = strchr(addr, ':') ? AF_INET6 : AF_INET;
+    if (inet_pton(family, addr, value) != 1) goto invalid;
+
+    size_t max = family == AF_INET ? 32 : 128;
+    size_t bits = max;
+
+    if (sep) {
+        char *end = NULL;
+        bits = strtoul(sep + 1, &end, 10);
+        if (end == sep + 1 || *end || bits > max) goto invalid;
+    }
+
+    // v4-mapped prefixes are matched against the IPv4 header of the datagrams
+    // that an IPv6 socket receives from IPv4 peers.
+    if (family == AF_INET6 && bits >= 96 && IN6_IS_ADDR_V4MAPPED((struct in6_addr *) value)) {
+        family = AF_INET;
+        bits -= 96;
+        memmove(value, value + 12, 4);
+    }
+
+    struct filter_cond *cond = filter_cond(filter, filter_prefix);
+    if (!cond) return false;
+
+    cond->family = family;
+    cond->len = bits;
+    memcpy(cond->value, value, sizeof(value));
+    return true;
+
+  invalid:
+    pond_fail("invalid filter prefix: %s", prefix);
+    return false;
+}
+
+bool pond_filter_len(struct pond_filter *filter, size_t min, size_t max)
+{
+    if (min > max) {
+        pond_fail("invalid filter length bounds: %zu > %zu", min, max);
+        return false;
+    }
+
+    struct filter_cond *cond = filter_cond(filter, filter_len);
+    if (!cond) return false;
+
+    cond->min = min;
+    cond->max = max;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// compile
+// -----------------------------------------------------------------------------
+
+// The filter of a UDP socket runs with the packet data starting at the UDP
+// header while the IP header is reachable through the SKF_NET_OFF offsets. An
+// absolute load past the end of the packet aborts the program and drops the
+// packet so payload loads are always guarded by a length check.
+enum
+{
+    filter_udp_header = 8,
+
+    filter_ip_version = 0,
+    filter_ip4_src = 12,
+    filter_ip6_src = 8,
+
+    // Every condition jumps to the next rule on failure which is never further
+    // than a rule's length and must fit in the 8-bit jump offsets. The longest
+    // condition is an IPv6 prefix with its version check and 4 masked words.
+    filter_cond_insns = 15,
+    filter_fails_cap = pond_filter_cond_cap * 5,
+};
+
+pond_static_assert(pond_filter_cond_cap * filter_cond_insns < UINT8_MAX);
+
+static const uint32_t filter_ret_accept = UINT32_MAX;
+static const uint32_t filter_ret_drop = 0;
+
+struct filter_fail
+{
+    size_t insn;
+    bool jt;
+};
+
+struct filter_ctx
+{
+    struct pond_filter *filter;
+
+    size_t fails_len;
+    struct filter_fail fails[filter_fails_cap];
+};
+
+static void filter_emit(struct filter_ctx *ctx, uint16_t code, uint32_t k)
+{
+    struct pond_filter *filter = ctx->filter;
+
+    if (filter->insns_len == filter->insns_cap) {
+        filter->insns_cap = filter->insns_cap ? filter->insns_cap * 2 : 64;
+        filter->insns = realloc(filter->insns, filter->insns_cap * sizeof(*filter->insns));
+        pond_assert_alloc(filter->insns);
+    }
+
+    filter->insns[filter->insns_len++] = (struct sock_filter) { .code = code, .k = k };
+}
+
+// Conditional jump which falls through on success and jumps to the next rule
+// when the comparison is (jt) or isn't (!jt) true.
+static void filter_emit_fail(struct filter_ctx *ctx, uint16_t op, uint32_t k, bool jt)
+{
+    ctx->fails[ctx->fails_len++] = (struct filter_fail) {
+        .insn = ctx->filter->insns_len,
+        .jt = jt,
+    };
+    filter_emit(ctx, BPF_JMP | op | BPF_K, k);
+}
+
+static void filter_emit_ret(struct filter_ctx *ctx, enum pond_filter_verdict verdict)
+{
+    switch (verdict) {
+    case pond_filter_accept: filter_emit(ctx, BPF_RET | BPF_K, filter_ret_accept); break;
+    case pond_filter_drop: filter_emit(ctx, BPF_RET | BPF_K, filter_ret_drop); break;
+    default: pond_unreachable();
+    }
+}
+
+static uint32_t filter_clamp(size_t value)
+{
+    return value < UINT32_MAX ? value : UINT32_MAX;
+}
+
+static void filter_compile_len(struct filter_ctx *ctx, const struct filter_cond *cond)
+{
+    filter_emit(ctx, BPF_LD | BPF_W | BPF_LEN, 0);
+    if (cond->min) filter_emit_fail(ctx, BPF_JGE, filter_clamp(filter_udp_header + cond->min), false);
+    if (cond->max < UINT32_MAX - filter_udp_header)
+        filter_emit_fail(ctx, BPF_JGT, filter_udp_header + cond->max, true);
+}
+
+// Loads are in network byte order so the bytes are compared as big-endian
+// words of up to 4 bytes.
+static void filter_compile_bytes(struct filter_ctx *ctx, const struct filter_cond *cond)
+{
+    uint32_t base = filter_udp_header + cond->off;
+
+    filter_emit(ctx, BPF_LD | BPF_W | BPF_LEN, 0);
+    filter_emit_fail(ctx, BPF_JGE, base + cond->len, false);
+
+    for (size_t pos = 0; pos < cond->len;) {
+        size_t left = cond->len - pos;
+        size_t width = left >= 4 ? 4 : left >= 2 ? 2 : 1;
+
+        uint32_t value = 0, mask = 0;
+        for (size_t i = 0; i < width; ++i) {
+            value = (value << 8) | (cond->value[pos + i] & cond->mask[pos + i]);
+            mask = (mask << 8) | cond->mask[pos + i];
+        }
+
+        uint16_t size = width == 4 ? BPF_W : width == 2 ? BPF_H : BPF_B;
+        uint32_t full = width == 4 ? UINT32_MAX : (1U << (width * 8)) - 1;
+
+        if (mask) {
+            filter_emit(ctx, BPF_LD | size | BPF_ABS, base + pos);
+            if (mask != full) filter_emit(ctx, BPF_ALU | BPF_AND | BPF_K, mask);
+            filter_emit_fail(ctx, BPF_JEQ, value, false);
+        }
+
+        pos += width;
+    }
+}
+
+static void filter_compile_prefix(struct filter_ctx *ctx, const struct filter_cond *cond)
+{
+    bool ip4 = cond->family == AF_INET;
+
+    filter_emit(ctx, BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + filter_ip_version);
+    filter_emit(ctx, BPF_ALU | BPF_AND | BPF_K, 0xF0);
+    filter_emit_fail(ctx, BPF_JEQ, ip4 ? 0x40 : 0x60, false);
+
+    uint32_t src = SKF_NET_OFF + (ip4 ? filter_ip4_src : filter_ip6_src);
+
+    for (size_t word = 0; word * 32 < cond->len; ++word) {
+        size_t bits = cond->len - word * 32;
+        uint32_t mask = bits >= 32 ? UINT32_MAX : ~(UINT32_MAX >> bits);
+
+        uint32_t value;
+        memcpy(&value, cond->value + word * 4, sizeof(value));
+        value = ntohl(value) & mask;
+
+        filter_emit(ctx, BPF_LD | BPF_W | BPF_ABS, src + word * 4);
+        if (mask != UINT32_MAX) filter_emit(ctx, BPF_ALU | BPF_AND | BPF_K, mask);
+        filter_emit_fail(ctx, BPF_JEQ, value, false);
+    }
+}
+
+static void filter_compile_rule(struct filter_ctx *ctx, const struct filter_rule *rule)
+{
+    ctx->fails_len = 0;
+
+    for (size_t i = 0; i < rule->len; ++i) {
+        const struct filter_cond *cond = &rule->conds[i];
+
+        switch (cond->kind) {
+        case filter_bytes: filter_compile_bytes(ctx, cond); break;
+        case filter_prefix: filter_compile_prefix(ctx, cond); break;
+        case filter_len: filter_compile_len(ctx, cond); break;
+        default: pond_unreachable();
+        }
+    }
+
+    filter_emit_ret(ctx, rule->verdict);
+
+    struct sock_filter *insns = ctx->filter->insns;
+    size_t next = ctx->filter->insns_len;
+
+    for (size_t i = 0; i < ctx->fails_len; ++i) {
+        struct filter_fail *fail = &ctx->fails[i];
+        uint8_t off = next - (fail->insn + 1);
+        if (fail->jt) insns[fail->insn].jt = off;
+        else insns[fail->insn].jf = off;
+    }
+}
+
+static void filter_compile(struct pond_filter *filter)
+{
+    struct filter_ctx ctx = { .filter = filter };
+    filter->insns_len = 0;
+
+    for (size_t i = 0; i < filter->rules_len; ++i)
+        filter_compile_rule(&ctx, &filter->rules[i]);
+
+    filter_emit_ret(&ctx, filter->fallback);
+}
+
+size_t pond_filter_insns(struct pond_filter *filter)
+{
+    filter_compile(filter);
+    return filter->insns_len;
+}
+
+
+// -----------------------------------------------------------------------------
+// attach
+// -----------------------------------------------------------------------------
+
+bool pond_filter_attach(struct pond_filter *filter, struct pond_udp *udp)
+{
+    filter_compile(filter);
+
+    if (filter->insns_len > BPF_MAXINSNS) {
+        pond_fail("filter too long: %zu > %d", filter->insns_len, BPF_MAXINSNS);
+        return false;
+    }
+
+    struct sock_fprog prog = {
+        .len = filter->insns_len,
+        .filter = filter->insns,
+    };
+
+    int ret = setsockopt(pond_udp_fd(udp), SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    if (ret == -1) {
+        pond_fail_errno("unable to attach socket filter");
+        return false;
+    }
+
+    return true;
+}
+
+bool pond_filter_detach(struct pond_udp *udp)
+{
+    int value = 0;
+    int ret = setsockopt(pond_udp_fd(udp), SOL_SOCKET, SO_DETACH_FILTER, &value, sizeof(value));
+    if (ret == -1 && errno != ENOENT) {
+        pond_fail_errno("unable to detach socket filter");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+/* filter.h
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Kernel-side datagram filtering for pond_udp sockets.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+
+
+// -----------------------------------------------------------------------------
+// filter
+// -----------------------------------------------------------------------------
+
+// Rules are compiled into a classic BPF program which the kernel runs on every
+// datagram before it's queued on the socket so rejected datagrams are never
+// copied to userspace. Rules are evaluated in the order they were added and
+// the first rule whose conditions all match picks the verdict. Datagrams that
+// match no rule get the fallback verdict.
+//
+// Conditions apply to the rule last started with pond_filter_rule and a rule
+// without conditions matches every datagram. Offsets and lengths are relative
+// to the UDP payload.
+//
+// Attaching a filter to a socket that already has one swaps them atomically in
+// the kernel so the filter can be replaced at runtime without a window where
+// datagrams are either unfiltered or lost. Datagrams rejected by the filter
+// are counted in pond_udp_drops.
+
+enum pond_filter_verdict
+{
+    pond_filter_accept = 0,
+    pond_filter_drop,
+};
+
+enum
+{
+    pond_filter_bytes_cap = 16,
+    pond_filter_cond_cap = 16,
+};
+
+struct pond_filter;
+
+struct pond_filter *pond_filter_alloc(enum pond_filter_verdict fallback) pond_malloc;
+void pond_filter_free(struct pond_filter *);
+
+void pond_filter_rule(struct pond_filter *, enum pond_filter_verdict);
+
+// Matches if the payload is long enough and (payload[off + i] & mask[i]) ==
+// value[i] for every i in [0, len). A NULL mask compares every bit.
+bool pond_filter_bytes(
+        struct pond_filter *, size_t off,
+        const uint8_t *value, const uint8_t *mask, size_t len);
+
+// Matches if the source address lies within the prefix written as an address
+// optionally followed by /bits (e.g. "10.0.0.0/8" or "2001:db8::/32"). An IPv4
+// prefix also matches IPv4 datagrams received on an IPv6 socket.
+bool pond_filter_prefix(struct pond_filter *, const char *prefix);
+
+// Matches if the payload length lies within [min, max].
+bool pond_filter_len(struct pond_filter *, size_t min, size_t max);
+
+// Number of BPF instructions of the compiled program.
+size_t pond_filter_insns(struct pond_filter *);
+
+bool pond_filter_attach(struct pond_filter *, struct pond_udp *);
+bool pond_filter_detach(struct pond_udp *);
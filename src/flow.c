@@ -0,0 +1,842 @@
+/* flow.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "flow.h"
+#include "net.h"
+#include "bits.h"
+#include "errors.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+// key
+// -----------------------------------------------------------------------------
+
+struct flow_key
+{
+    uint8_t addr[16];
+    uint16_t port;
+};
+
+pond_static_assert(sizeof(struct flow_key) == 18);
+
+static bool flow_key(struct flow_key *key, const struct sockaddr *addr, socklen_t len)
+{
+    switch (addr->sa_family) {
+
+    case AF_INET: {
+        if (len < sizeof(struct sockaddr_in)) return false;
+        const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+
+        memset(key->addr, 0, 10);
+        key->addr[10] = key->addr[11] = 0xFF;
+        memcpy(key->addr + 12, &in->sin_addr, 4);
+        key->port = in->sin_port;
+        return true;
+    }
+
+    case AF_INET6: {
+        if (len < sizeof(struct sockaddr_in6)) return false;
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+
+        memcpy(key->addr, &in6->sin6_addr, 16);
+        key->port = in6->sin6_port;
+        return true;
+    }
+
+    default: return false;
+    }
+}
+
+static bool flow_key_eq(const struct flow_key *lhs, const struct flow_key *rhs)
+{
+    return !memcmp(lhs, rhs, sizeof(*lhs));
+}
+
+static uint64_t flow_hash(const struct flow_key *key)
+{
+    uint64_t a, b;
+    memcpy(&a, key->addr, sizeof(a));
+    memcpy(&b, key->addr + 8, sizeof(b));
+
+    uint64_t h = a * 0x9E3779B97F4A7C15ULL;
+    h ^= (b + key->port) * 0xC2B2AE3D27D4EB4FULL;
+
+    // murmur3 finalizer so that both the low bits used for the group and the
+    // high bits used for the tag depend on the whole key.
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+// -----------------------------------------------------------------------------
+// entry
+// -----------------------------------------------------------------------------
+
+struct pond_flow_entry
+{
+    struct flow_key key;
+    uint64_t hash;
+    atomic_uint_fast64_t last;
+
+    pond_align(16) uint8_t value[];
+};
+
+void *pond_flow_value(struct pond_flow_entry *entry)
+{
+    return entry->value;
+}
+
+uint64_t pond_flow_last(struct pond_flow_entry *entry)
+{
+    return atomic_load_explicit(&entry->last, memory_order_relaxed);
+}
+
+const struct sockaddr *pond_flow_addr(
+        struct pond_flow_entry *entry, struct sockaddr_storage *dst, socklen_t *len)
+{
+    memset(dst, 0, sizeof(*dst));
+
+    struct in6_addr addr;
+    memcpy(&addr, entry->key.addr, sizeof(addr));
+
+    if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+        struct sockaddr_in *in = (struct sockaddr_in *) dst;
+        in->sin_family = AF_INET;
+        in->sin_port = entry->key.port;
+        memcpy(&in->sin_addr, entry->key.addr + 12, 4);
+        *len = sizeof(*in);
+    }
+    else {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) dst;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = entry->key.port;
+        in6->sin6_addr = addr;
+        *len = sizeof(*in6);
+    }
+
+    return (const struct sockaddr *) dst;
+}
+
+enum { flow_touch_ns = 1000 * 1000 };
+
+// Refreshing at a coarser resolution than the idle timeout keeps readers of a
+// busy flow from bouncing its cache line on every datagram.
+static void flow_touch(struct pond_flow_entry *entry, uint64_t now)
+{
+    uint64_t last = atomic_load_explicit(&entry->last, memory_order_relaxed);
+    if (now > last + flow_touch_ns)
+        atomic_store_explicit(&entry->last, now, memory_order_relaxed);
+}
+
+
+// -----------------------------------------------------------------------------
+// group
+// -----------------------------------------------------------------------------
+
+// A full slot holds the top 7 bits of its hash as its tag which leaves the
+// high bit to mark empty and deleted slots. Deleted slots are reused on insert
+// but keep probes going until the table is rebuilt.
+enum
+{
+    flow_group_len = 16,
+    flow_tag_empty = 0x80,
+    flow_tag_deleted = 0xFE,
+};
+
+static uint8_t flow_tag(uint64_t hash)
+{
+    return hash >> 57;
+}
+
+// Tags are only a filter where a match is confirmed by loading the entry
+// pointer with acquire semantics and comparing its key so a torn or stale
+// group load can at worst cost a probe or report a transient miss.
+static void flow_match(const uint8_t *tags, uint8_t tag, uint32_t *match, uint32_t *empty)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *) tags);
+    *match = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+    *empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) flow_tag_empty)));
+    atomic_thread_fence(memory_order_acquire);
+#else
+    *match = *empty = 0;
+    for (size_t i = 0; i < flow_group_len; ++i) {
+        uint8_t value = __atomic_load_n(&tags[i], __ATOMIC_ACQUIRE);
+        if (value == tag) *match |= 1U << i;
+        if (value == flow_tag_empty) *empty |= 1U << i;
+    }
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// table
+// -----------------------------------------------------------------------------
+
+// len counts the live entries while used also counts the deleted slots which
+// is what bounds the probe lengths.
+struct flow_table
+{
+    size_t groups;
+    size_t len;
+    size_t used;
+
+    uint8_t *tags;
+    _Atomic(struct pond_flow_entry *) *slots;
+};
+
+static struct flow_table *table_alloc(size_t groups)
+{
+    struct flow_table *table = calloc(1, sizeof(*table));
+    pond_assert_alloc(table);
+
+    table->groups = groups;
+
+    size_t cap = groups * flow_group_len;
+    table->tags = aligned_alloc(flow_group_len, cap);
+    table->slots = calloc(cap, sizeof(*table->slots));
+    pond_assert_alloc(table->tags);
+    pond_assert_alloc(table->slots);
+
+    memset(table->tags, flow_tag_empty, cap);
+    return table;
+}
+
+static void table_free(struct flow_table *table)
+{
+    free(table->tags);
+    free(table->slots);
+    free(table);
+}
+
+static size_t table_cap(const struct flow_table *table)
+{
+    return table->groups * flow_group_len;
+}
+
+// Triangular probing over a power of two number of groups visits every group
+// once and always terminates as the load factor keeps empty slots around.
+static size_t table_index(
+        struct flow_table *table, const struct flow_key *key, uint64_t hash,
+        struct pond_flow_entry **dst)
+{
+    size_t mask = table->groups - 1;
+    uint8_t tag = flow_tag(hash);
+
+    for (size_t group = hash & mask, step = 0;; group = (group + ++step) & mask) {
+        uint32_t match, empty;
+        flow_match(table->tags + group * flow_group_len, tag, &match, &empty);
+
+        for (; match; match &= match - 1) {
+            size_t i = group * flow_group_len + pond_ctz(match);
+            struct pond_flow_entry *entry =
+                atomic_load_explicit(&table->slots[i], memory_order_acquire);
+
+            if (entry && entry->hash == hash && flow_key_eq(&entry->key, key)) {
+                *dst = entry;
+                return i;
+            }
+        }
+
+        if (empty) { *dst = NULL; return SIZE_MAX; }
+    }
+}
+
+static struct pond_flow_entry *table_find(
+        struct flow_table *table, const struct flow_key *key, uint64_t hash)
+{
+    struct pond_flow_entry *entry;
+    (void) table_index(table, key, hash, &entry);
+    return entry;
+}
+
+// The entry pointer is published before its tag so that a reader matching the
+// tag always finds the entry.
+static void table_put(struct flow_table *table, struct pond_flow_entry *entry)
+{
+    size_t mask = table->groups - 1;
+
+    for (size_t group = entry->hash & mask, step = 0;; group = (group + ++step) & mask) {
+        uint8_t *tags = table->tags + group * flow_group_len;
+
+        uint32_t deleted, empty;
+        flow_match(tags, flow_tag_deleted, &deleted, &empty);
+        if (!(deleted | empty)) continue;
+
+        size_t bit = pond_ctz(deleted | empty);
+        if (empty & (1U << bit)) table->used++;
+        table->len++;
+
+        size_t i = group * flow_group_len + bit;
+        atomic_store_explicit(&table->slots[i], entry, memory_order_release);
+        __atomic_store_n(&tags[bit], flow_tag(entry->hash), __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+static void table_del(struct flow_table *table, size_t i)
+{
+    __atomic_store_n(&table->tags[i], flow_tag_deleted, __ATOMIC_RELEASE);
+    atomic_store_explicit(&table->slots[i], NULL, memory_order_release);
+    table->len--;
+}
+
+
+// -----------------------------------------------------------------------------
+// flow
+// -----------------------------------------------------------------------------
+
+enum
+{
+    flow_cap = 1024,
+    flow_thread_cap = 256,
+    flow_migrate_budget = 8,
+    flow_reclaim_len = 64,
+    flow_batch_len = 64,
+};
+
+static const uint64_t flow_idle = 60ULL * 1000 * 1000 * 1000;
+
+// epoch is 0 when the thread isn't reading and depth is only ever touched by
+// its own thread.
+struct flow_reader
+{
+    pond_align(pond_mmsg_line_len) atomic_uint_fast64_t epoch;
+    size_t depth;
+};
+
+struct flow_retired
+{
+    void *ptr;
+    bool table;
+    uint64_t epoch;
+};
+
+// old is the table being migrated into table and remains readable until every
+// one of its groups has been migrated. Everything but the table pointers and
+// the epochs is owned by the writer lock.
+struct pond_flow
+{
+    struct pond_flow_opt opt;
+    struct pond_flow_stats stats;
+
+    _Atomic(struct flow_table *) table;
+    _Atomic(struct flow_table *) old;
+
+    pthread_mutex_t lock;
+    size_t migrate;
+    size_t expire;
+
+    size_t retired_len;
+    size_t retired_cap;
+    struct flow_retired *retired;
+
+    pond_align(pond_mmsg_line_len) atomic_uint_fast64_t epoch;
+    struct flow_reader *readers;
+};
+
+struct pond_flow *pond_flow_alloc(const struct pond_flow_opt *opt)
+{
+    // The epoch is aligned on its own cache line which calloc doesn't honour.
+    struct pond_flow *flow = aligned_alloc(pond_mmsg_line_len, sizeof(*flow));
+    pond_assert_alloc(flow);
+    memset(flow, 0, sizeof(*flow));
+
+    if (opt) flow->opt = *opt;
+    if (!flow->opt.cap) flow->opt.cap = flow_cap;
+    if (!flow->opt.idle) flow->opt.idle = flow_idle;
+    if (!flow->opt.thread_cap) flow->opt.thread_cap = flow_thread_cap;
+
+    // Sized so that cap entries fit under the 7/8 load factor.
+    size_t groups = pond_ceil_div(flow->opt.cap * 8 / 7 + 1, flow_group_len);
+    atomic_init(&flow->table, table_alloc(pond_ceil_pow2(groups)));
+    atomic_init(&flow->old, NULL);
+
+    int err = pthread_mutex_init(&flow->lock, NULL);
+    pond_assert(!err, "unable to init flow lock: %d", err);
+
+    atomic_init(&flow->epoch, 1);
+    flow->readers = aligned_alloc(pond_mmsg_line_len,
+            (flow->opt.thread_cap + 1) * sizeof(*flow->readers));
+    pond_assert_alloc(flow->readers);
+
+    for (size_t i = 0; i <= flow->opt.thread_cap; ++i) {
+        atomic_init(&flow->readers[i].epoch, 0);
+        flow->readers[i].depth = 0;
+    }
+
+    return flow;
+}
+
+static void flow_migrate(struct pond_flow *, size_t budget);
+static void flow_retired_free(struct flow_retired *);
+
+void pond_flow_free(struct pond_flow *flow)
+{
+    if (!flow) return;
+
+    flow_migrate(flow, SIZE_MAX);
+
+    for (size_t i = 0; i < flow->retired_len; ++i)
+        flow_retired_free(&flow->retired[i]);
+    free(flow->retired);
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    for (size_t i = 0; i < table_cap(table); ++i)
+        free(atomic_load_explicit(&table->slots[i], memory_order_relaxed));
+    table_free(table);
+
+    pthread_mutex_destroy(&flow->lock);
+    free(flow->readers);
+    free(flow);
+}
+
+void pond_flow_stats(struct pond_flow *flow, struct pond_flow_stats *dst)
+{
+    pthread_mutex_lock(&flow->lock);
+
+    *dst = flow->stats;
+    dst->len = flow->stats.inserts - flow->stats.removes - flow->stats.expired;
+    dst->cap = table_cap(atomic_load_explicit(&flow->table, memory_order_relaxed));
+    dst->migrating = atomic_load_explicit(&flow->old, memory_order_relaxed) != NULL;
+    dst->retired = flow->retired_len;
+
+    pthread_mutex_unlock(&flow->lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+// An object retired at epoch e was unlinked before the global epoch moved past
+// e so it can only be referenced by readers that announced an epoch of e or
+// less. Readers announce before loading any table pointer and writers unlink
+// before scanning the readers which the seq_cst fences order.
+
+// Readers are indexed by a slot that is claimed by a thread on its first read
+// and released when it exits so that the indexes stay bounded by the number of
+// live threads rather than by every thread ever created. Slots start at 1 to
+// leave 0 for unclaimed. A thread only exits outside of its reads which leaves
+// its reader with a depth and epoch of 0 for the next owner of the slot.
+
+static pthread_once_t flow_slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t flow_slot_key;
+static pthread_mutex_t flow_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t flow_slot_next = 1;
+static size_t flow_slot_len = 0;
+static size_t flow_slot_cap = 0;
+static size_t *flow_slot_free = NULL;
+
+static __thread size_t flow_slot_store = 0;
+
+static void flow_slot_release(void *data)
+{
+    pthread_mutex_lock(&flow_slot_lock);
+
+    if (flow_slot_len == flow_slot_cap) {
+        flow_slot_cap = flow_slot_cap ? flow_slot_cap * 2 : flow_thread_cap;
+        flow_slot_free = realloc(flow_slot_free, flow_slot_cap * sizeof(*flow_slot_free));
+        pond_assert_alloc(flow_slot_free);
+    }
+    flow_slot_free[flow_slot_len++] = (uintptr_t) data;
+
+    pthread_mutex_unlock(&flow_slot_lock);
+}
+
+static void flow_slot_init(void)
+{
+    int err = pthread_key_create(&flow_slot_key, flow_slot_release);
+    pond_assert(!err, "unable to create flow slot key: %d", err);
+}
+
+static size_t flow_slot(void)
+{
+    if (pond_likely(flow_slot_store)) return flow_slot_store;
+
+    pthread_once(&flow_slot_once, flow_slot_init);
+
+    pthread_mutex_lock(&flow_slot_lock);
+    size_t slot = flow_slot_len ? flow_slot_free[--flow_slot_len] : flow_slot_next++;
+    pthread_mutex_unlock(&flow_slot_lock);
+
+    int err = pthread_setspecific(flow_slot_key, (void *) (uintptr_t) slot);
+    pond_assert(!err, "unable to set flow slot: %d", err);
+
+    return flow_slot_store = slot;
+}
+
+static struct flow_reader *flow_reader(struct pond_flow *flow)
+{
+    size_t slot = flow_slot();
+    pond_assert(slot <= flow->opt.thread_cap,
+            "live reader threads above flow thread cap: %zu > %zu", slot, flow->opt.thread_cap);
+    return &flow->readers[slot];
+}
+
+void pond_flow_enter(struct pond_flow *flow)
+{
+    struct flow_reader *reader = flow_reader(flow);
+    if (reader->depth++) return;
+
+    uint64_t epoch = atomic_load_explicit(&flow->epoch, memory_order_relaxed);
+    atomic_store_explicit(&reader->epoch, epoch, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void pond_flow_leave(struct pond_flow *flow)
+{
+    struct flow_reader *reader = flow_reader(flow);
+    pond_assert(reader->depth, "flow leave without enter");
+    if (--reader->depth) return;
+
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+static void flow_retired_free(struct flow_retired *retired)
+{
+    if (retired->table) table_free(retired->ptr);
+    else free(retired->ptr);
+}
+
+static void flow_retire(struct pond_flow *flow, void *ptr, bool table)
+{
+    if (flow->retired_len == flow->retired_cap) {
+        flow->retired_cap = flow->retired_cap ? flow->retired_cap * 2 : flow_reclaim_len;
+        flow->retired = realloc(flow->retired, flow->retired_cap * sizeof(*flow->retired));
+        pond_assert_alloc(flow->retired);
+    }
+
+    flow->retired[flow->retired_len++] = (struct flow_retired) {
+        .ptr = ptr,
+        .table = table,
+        .epoch = atomic_fetch_add_explicit(&flow->epoch, 1, memory_order_seq_cst),
+    };
+}
+
+static void flow_reclaim(struct pond_flow *flow)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t min = UINT64_MAX;
+    for (size_t i = 0; i <= flow->opt.thread_cap; ++i) {
+        uint64_t epoch = atomic_load_explicit(&flow->readers[i].epoch, memory_order_acquire);
+        if (epoch && epoch < min) min = epoch;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < flow->retired_len; ++i) {
+        if (flow->retired[i].epoch < min) flow_retired_free(&flow->retired[i]);
+        else flow->retired[len++] = flow->retired[i];
+    }
+    flow->retired_len = len;
+}
+
+
+// -----------------------------------------------------------------------------
+// write
+// -----------------------------------------------------------------------------
+
+static void flow_lock(struct pond_flow *flow)
+{
+    pthread_mutex_lock(&flow->lock);
+}
+
+static void flow_unlock(struct pond_flow *flow)
+{
+    if (flow->retired_len >= flow_reclaim_len) flow_reclaim(flow);
+    pthread_mutex_unlock(&flow->lock);
+}
+
+// Entries are copied into the new table but left in the old one so that a
+// reader going through both never misses an entry that's being moved. Removals
+// clear both tables which keeps a removed entry from being migrated back.
+static void flow_migrate(struct pond_flow *flow, size_t budget)
+{
+    struct flow_table *old = atomic_load_explicit(&flow->old, memory_order_relaxed);
+    if (!old) return;
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+
+    for (; budget && flow->migrate < old->groups; budget--, flow->migrate++) {
+        for (size_t i = 0; i < flow_group_len; ++i) {
+            size_t slot = flow->migrate * flow_group_len + i;
+            struct pond_flow_entry *entry =
+                atomic_load_explicit(&old->slots[slot], memory_order_relaxed);
+
+            if (!entry || table_find(table, &entry->key, entry->hash)) continue;
+            table_put(table, entry);
+        }
+    }
+
+    if (flow->migrate < old->groups) return;
+
+    atomic_store_explicit(&flow->old, NULL, memory_order_release);
+    flow->migrate = 0;
+    flow_retire(flow, old, true);
+}
+
+// Doubles the table if more than half of it is live or otherwise rebuilds it at
+// the same size to purge the deleted slots. Every write migrates a few groups
+// so the migration completes well before the new table fills up.
+static void flow_grow(struct pond_flow *flow)
+{
+    flow_migrate(flow, SIZE_MAX);
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    size_t groups = table->groups;
+    if (table->len * 2 >= table_cap(table)) groups *= 2;
+
+    atomic_store_explicit(&flow->old, table, memory_order_release);
+    atomic_store_explicit(&flow->table, table_alloc(groups), memory_order_release);
+
+    flow->migrate = 0;
+    flow->expire = 0;
+    flow->stats.resizes++;
+}
+
+static struct pond_flow_entry *flow_insert(
+        struct pond_flow *flow, uint64_t now, const struct flow_key *key, uint64_t hash)
+{
+    flow_migrate(flow, flow_migrate_budget);
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    struct pond_flow_entry *entry = table_find(table, key, hash);
+    if (entry) return entry;
+
+    struct flow_table *old = atomic_load_explicit(&flow->old, memory_order_relaxed);
+    if (old) entry = table_find(old, key, hash);
+
+    if ((table->used + 1) * 8 > table_cap(table) * 7) {
+        flow_grow(flow);
+        table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    }
+
+    if (!entry) {
+        entry = calloc(1, sizeof(*entry) + flow->opt.value_len);
+        pond_assert_alloc(entry);
+
+        entry->key = *key;
+        entry->hash = hash;
+        atomic_init(&entry->last, now);
+        flow->stats.inserts++;
+    }
+
+    table_put(table, entry);
+    return entry;
+}
+
+static bool flow_remove(struct pond_flow *flow, const struct flow_key *key, uint64_t hash)
+{
+    flow_migrate(flow, flow_migrate_budget);
+
+    struct pond_flow_entry *entry = NULL, *other = NULL;
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    size_t i = table_index(table, key, hash, &entry);
+    if (entry) table_del(table, i);
+
+    struct flow_table *old = atomic_load_explicit(&flow->old, memory_order_relaxed);
+    if (old && (i = table_index(old, key, hash, &other)) != SIZE_MAX) {
+        table_del(old, i);
+        if (!entry) entry = other;
+    }
+
+    if (!entry) return false;
+
+    flow_retire(flow, entry, false);
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// read
+// -----------------------------------------------------------------------------
+
+// A resize can publish a new table after the caller loaded its table and the
+// entries inserted since then only live in the new one. Misses are therefore
+// only trusted if neither pointer moved while probing.
+static struct pond_flow_entry *flow_lookup(
+        struct pond_flow *flow, struct flow_table *table,
+        const struct flow_key *key, uint64_t hash)
+{
+    struct flow_table *old = atomic_load_explicit(&flow->old, memory_order_acquire);
+
+    while (true) {
+        struct pond_flow_entry *entry = table_find(table, key, hash);
+        if (entry) return entry;
+
+        if (old && (entry = table_find(old, key, hash))) return entry;
+
+        struct flow_table *next = atomic_load_explicit(&flow->table, memory_order_acquire);
+        struct flow_table *next_old = atomic_load_explicit(&flow->old, memory_order_acquire);
+        if (next == table && next_old == old) return NULL;
+
+        table = next;
+        old = next_old;
+    }
+}
+
+struct pond_flow_entry *pond_flow_find(
+        struct pond_flow *flow, uint64_t now, const struct sockaddr *addr, socklen_t len)
+{
+    struct flow_key key;
+    if (!flow_key(&key, addr, len)) return NULL;
+    uint64_t hash = flow_hash(&key);
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_acquire);
+    struct pond_flow_entry *entry = flow_lookup(flow, table, &key, hash);
+    if (entry) flow_touch(entry, now);
+    return entry;
+}
+
+struct pond_flow_entry *pond_flow_get(
+        struct pond_flow *flow, uint64_t now, const struct sockaddr *addr, socklen_t len)
+{
+    struct flow_key key;
+    if (!flow_key(&key, addr, len)) return NULL;
+    uint64_t hash = flow_hash(&key);
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_acquire);
+    struct pond_flow_entry *entry = flow_lookup(flow, table, &key, hash);
+
+    if (entry) flow_touch(entry, now);
+    else {
+        flow_lock(flow);
+        entry = flow_insert(flow, now, &key, hash);
+        flow_unlock(flow);
+    }
+
+    return entry;
+}
+
+bool pond_flow_del(struct pond_flow *flow, const struct sockaddr *addr, socklen_t len)
+{
+    struct flow_key key;
+    if (!flow_key(&key, addr, len)) return false;
+
+    flow_lock(flow);
+    bool ret = flow_remove(flow, &key, flow_hash(&key));
+    if (ret) flow->stats.removes++;
+    flow_unlock(flow);
+
+    return ret;
+}
+
+// The first pass hashes the whole batch and prefetches the tags and slots of
+// each home group so that the probes of the second pass overlap their misses.
+size_t pond_flow_mget(
+        struct pond_flow *flow, uint64_t now,
+        struct pond_mmsg *mmsg, struct pond_flow_entry **dst)
+{
+    size_t found = 0;
+    size_t len = pond_mmsg_len(mmsg);
+
+    for (size_t base = 0; base < len; base += flow_batch_len) {
+        size_t n = len - base < flow_batch_len ? len - base : flow_batch_len;
+
+        bool valid[flow_batch_len];
+        uint64_t hashes[flow_batch_len];
+        struct flow_key keys[flow_batch_len];
+
+        struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_acquire);
+        size_t mask = table->groups - 1;
+
+        for (size_t i = 0; i < n; ++i) {
+            socklen_t addr_len = 0;
+            const struct sockaddr *addr = pond_mmsg_addr(mmsg, base + i, &addr_len);
+
+            valid[i] = addr_len && flow_key(&keys[i], addr, addr_len);
+            if (!valid[i]) continue;
+            hashes[i] = flow_hash(&keys[i]);
+
+            size_t slot = (hashes[i] & mask) * flow_group_len;
+            __builtin_prefetch(table->tags + slot);
+            __builtin_prefetch(&table->slots[slot]);
+            __builtin_prefetch(&table->slots[slot + flow_group_len / 2]);
+        }
+
+        size_t misses = 0;
+        for (size_t i = 0; i < n; ++i) {
+            struct pond_flow_entry *entry = NULL;
+            if (valid[i]) entry = flow_lookup(flow, table, &keys[i], hashes[i]);
+
+            if (entry) { flow_touch(entry, now); found++; }
+            else if (valid[i]) misses++;
+
+            dst[base + i] = entry;
+        }
+
+        if (!misses) continue;
+
+        flow_lock(flow);
+        for (size_t i = 0; i < n; ++i) {
+            if (!valid[i] || dst[base + i]) continue;
+            dst[base + i] = flow_insert(flow, now, &keys[i], hashes[i]);
+            found++;
+        }
+        flow_unlock(flow);
+    }
+
+    return found;
+}
+
+
+// -----------------------------------------------------------------------------
+// expire
+// -----------------------------------------------------------------------------
+
+// Entries still waiting to be migrated are only considered once the migration
+// completes which the budget also contributes to.
+size_t pond_flow_expire(struct pond_flow *flow, uint64_t now, size_t budget)
+{
+    size_t expired = 0;
+    flow_lock(flow);
+
+    flow_migrate(flow, budget);
+    if (atomic_load_explicit(&flow->old, memory_order_relaxed)) goto done;
+
+    struct flow_table *table = atomic_load_explicit(&flow->table, memory_order_relaxed);
+    if (budget > table->groups) budget = table->groups;
+
+    for (; budget; budget--) {
+        size_t group = flow->expire;
+        flow->expire = (flow->expire + 1) & (table->groups - 1);
+
+        for (size_t i = 0; i < flow_group_len; ++i) {
+            size_t slot = group * flow_group_len + i;
+            struct pond_flow_entry *entry =
+                atomic_load_explicit(&table->slots[slot], memory_order_relaxed);
+            if (!entry) continue;
+
+            uint64_t last = atomic_load_explicit(&entry->last, memory_order_relaxed);
+            if (now < last || now - last <= flow->opt.idle) continue;
+
+            table_del(table, slot);
+            flow_retire(flow, entry, false);
+            expired++;
+        }
+    }
+
+    flow->stats.expired += expired;
+
+  done:
+    flow_unlock(flow);
+    return expired;
+}
@@ -0,0 +1,97 @@
+/* flow.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Concurrent hash table of per-peer state keyed by socket address.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// flow
+// -----------------------------------------------------------------------------
+
+// Open addressing over groups of 16 slots where each slot has a one byte tag
+// derived from its hash so that a single SIMD compare filters a whole group.
+// Reads are lock-free while writes are serialized by a lock. Removed entries
+// and replaced tables are reclaimed once every reader that could still see
+// them has left its epoch. Growing the table is incremental where each write
+// migrates a few groups from the previous table which remains readable until
+// the migration completes.
+//
+// Only AF_INET and AF_INET6 addresses are supported with IPv4 addresses keyed
+// as their v4-mapped IPv6 equivalent.
+//
+// Entries and their values are only valid between pond_flow_enter and
+// pond_flow_leave on the calling thread. The value is zeroed on insert and its
+// synchronization is left to the caller.
+
+struct pond_flow_opt
+{
+    size_t cap;        // initial capacity; defaults to 1024.
+    size_t value_len;  // bytes of user state per entry.
+    uint64_t idle;     // nanoseconds before an untouched entry expires; defaults to 60s.
+    size_t thread_cap; // bound on the live threads that read; defaults to 256.
+};
+
+struct pond_flow_stats
+{
+    size_t len;
+    size_t cap;
+    bool migrating;
+
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t expired;
+    uint64_t resizes;
+    size_t retired;   // objects waiting for readers to leave their epoch.
+};
+
+struct pond_flow;
+struct pond_flow_entry;
+
+struct pond_flow *pond_flow_alloc(const struct pond_flow_opt *) pond_malloc;
+void pond_flow_free(struct pond_flow *);
+
+void pond_flow_stats(struct pond_flow *, struct pond_flow_stats *dst);
+
+void pond_flow_enter(struct pond_flow *);
+void pond_flow_leave(struct pond_flow *);
+
+void *pond_flow_value(struct pond_flow_entry *);
+uint64_t pond_flow_last(struct pond_flow_entry *);
+const struct sockaddr *pond_flow_addr(
+        struct pond_flow_entry *, struct sockaddr_storage *dst, socklen_t *len);
+
+// Lookups refresh the idle timer of the entries they find.
+struct pond_flow_entry *pond_flow_find(
+        struct pond_flow *, uint64_t now, const struct sockaddr *, socklen_t len);
+struct pond_flow_entry *pond_flow_get(
+        struct pond_flow *, uint64_t now, const struct sockaddr *, socklen_t len);
+bool pond_flow_del(struct pond_flow *, const struct sockaddr *, socklen_t len);
+
+// Sets dst[i] to the entry of the source of message i, creating it if needed,
+// or NULL if the address isn't supported. Lookups for the whole batch are
+// prefetched before probing and misses are inserted under a single lock.
+size_t pond_flow_mget(
+        struct pond_flow *, uint64_t now, struct pond_mmsg *, struct pond_flow_entry **dst);
+
+// Scans at most budget groups from where the last call left off and removes
+// the entries that have been idle for longer than opt.idle.
+size_t pond_flow_expire(struct pond_flow *, uint64_t now, size_t budget);
@@ -0,0 +1,413 @@
+/* frag.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "frag.h"
+#include "net.h"
+#include "buf.h"
+#include "bits.h"
+#include "math.h"
+#include "errors.h"
+
+#include <string.h>
+#include <endian.h>
+
+
+// -----------------------------------------------------------------------------
+// header
+// -----------------------------------------------------------------------------
+
+// Wire format is little-endian. The payload offset of a fragment is derived
+// from its index and the payload length of the fragments which is constant
+// for all but the last fragment.
+struct pond_packed frag_header
+{
+    uint32_t id;
+    uint16_t index;
+    uint16_t count;
+    uint32_t len;
+};
+
+pond_static_assert(sizeof(struct frag_header) == pond_frag_header_len);
+
+
+// -----------------------------------------------------------------------------
+// frag
+// -----------------------------------------------------------------------------
+
+enum
+{
+    frag_mtu = 1472,
+    frag_timeout = 1000UL * 1000 * 1000,
+    frag_mem_cap = 64UL * 1024 * 1024,
+    frag_pending_cap = 1024,
+    frag_pool_cap = 64,
+};
+
+struct frag_msg
+{
+    uint64_t hash; // 0 indicates an empty slot.
+
+    uint32_t id;
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    uint16_t count, received;
+    uint32_t chunk;
+    uint64_t deadline;
+
+    struct pond_buf *buf;
+    uint64_t bitmap[pond_frag_count_cap / 64];
+};
+
+struct pond_frag
+{
+    struct pond_frag_opt opt;
+    struct pond_frag_stats stats;
+
+    uint32_t id;
+
+    size_t mem;
+    size_t pending;
+
+    size_t pool_len;
+    struct pond_buf **pool;
+
+    size_t slots_cap;
+    struct frag_msg *slots;
+};
+
+
+struct pond_frag *pond_frag_alloc(const struct pond_frag_opt *opt)
+{
+    struct pond_frag *frag = calloc(1, sizeof(*frag));
+    pond_assert_alloc(frag);
+
+    if (opt) frag->opt = *opt;
+    if (!frag->opt.mtu) frag->opt.mtu = frag_mtu;
+    if (!frag->opt.timeout) frag->opt.timeout = frag_timeout;
+    if (!frag->opt.mem_cap) frag->opt.mem_cap = frag_mem_cap;
+    if (!frag->opt.pending_cap) frag->opt.pending_cap = frag_pending_cap;
+    if (!frag->opt.pool_cap) frag->opt.pool_cap = frag_pool_cap;
+
+    pond_assert(frag->opt.mtu > pond_frag_header_len, "mtu too small: %zu", frag->opt.mtu);
+
+    frag->pool = calloc(frag->opt.pool_cap, sizeof(*frag->pool));
+    pond_assert_alloc(frag->pool);
+
+    // Keeps the load factor under 50% to bound the probe sequences.
+    frag->slots_cap = pond_ceil_pow2(frag->opt.pending_cap * 2);
+    frag->slots = calloc(frag->slots_cap, sizeof(*frag->slots));
+    pond_assert_alloc(frag->slots);
+
+    return frag;
+}
+
+static void frag_buf_free(struct pond_buf *buf)
+{
+    pond_buf_reset(buf);
+    free(buf);
+}
+
+void pond_frag_free(struct pond_frag *frag)
+{
+    for (size_t i = 0; i < frag->slots_cap; ++i) {
+        if (frag->slots[i].hash) frag_buf_free(frag->slots[i].buf);
+    }
+
+    for (size_t i = 0; i < frag->pool_len; ++i)
+        frag_buf_free(frag->pool[i]);
+
+    free(frag->slots);
+    free(frag->pool);
+    free(frag);
+}
+
+void pond_frag_stats(struct pond_frag *frag, struct pond_frag_stats *dst)
+{
+    *dst = frag->stats;
+}
+
+
+// -----------------------------------------------------------------------------
+// split
+// -----------------------------------------------------------------------------
+
+static size_t frag_chunk(struct pond_frag *frag)
+{
+    return frag->opt.mtu - pond_frag_header_len;
+}
+
+static size_t frag_count(struct pond_frag *frag, const struct pond_buf *src)
+{
+    size_t count = pond_max(pond_ceil_div(src->len, frag_chunk(frag)), (size_t) 1);
+    if (count <= pond_frag_count_cap) return count;
+
+    pond_fail("message too large: %zu > %zu",
+            src->len, frag_chunk(frag) * pond_frag_count_cap);
+    return 0;
+}
+
+static void frag_fill(
+        struct pond_frag *frag, const struct pond_buf *src,
+        uint32_t id, size_t count, size_t from, size_t to,
+        struct pond_mmsg *dst, size_t first,
+        const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t chunk = frag_chunk(frag);
+
+    for (size_t index = from; index < to; ++index) {
+        size_t msg = first + (index - from);
+        struct pond_iovec *iovec = pond_mmsg_iovec(dst, msg);
+        struct pond_iov *iov = &iovec->vec[0];
+
+        pond_assert(iovec->cap && iov->cap >= frag->opt.mtu,
+                "mmsg iov too small for mtu: %zu < %zu", iov->cap, frag->opt.mtu);
+
+        struct frag_header header = {
+            .id = htole32(id),
+            .index = htole16(index),
+            .count = htole16(count),
+            .len = htole32(src->len),
+        };
+        pond_iov_write(iov, (const uint8_t *) &header, sizeof(header));
+
+        size_t off = index * chunk;
+        pond_iov_append(iov, src->d + off, pond_min(chunk, src->len - off));
+
+        iovec->len = 1;
+        pond_mmsg_set_addr(dst, msg, addr, addr_len);
+    }
+}
+
+size_t pond_frag_split(
+        struct pond_frag *frag, const struct pond_buf *src,
+        struct pond_mmsg *dst, size_t first,
+        const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t count = frag_count(frag, src);
+    if (!count) return 0;
+    if (first + count > pond_mmsg_cap(dst)) return 0;
+
+    frag_fill(frag, src, frag->id++, count, 0, count, dst, first, addr, addr_len);
+    return first + count;
+}
+
+bool pond_frag_send(
+        struct pond_frag *frag, struct pond_udp *dst, struct pond_mmsg *msg,
+        const struct pond_buf *src,
+        const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t count = frag_count(frag, src);
+    if (!count) return false;
+
+    uint32_t id = frag->id++;
+    size_t cap = pond_mmsg_cap(msg);
+
+    for (size_t from = 0; from < count; from += cap) {
+        size_t to = pond_min(from + cap, count);
+        frag_fill(frag, src, id, count, from, to, msg, 0, addr, addr_len);
+        if (!pond_udp_msend(dst, msg, to - from)) return false;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// table
+// -----------------------------------------------------------------------------
+
+static uint64_t frag_hash(const struct sockaddr *addr, socklen_t addr_len, uint32_t id)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL ^ id;
+    const uint8_t *it = (const uint8_t *) addr;
+    for (socklen_t i = 0; i < addr_len; ++i)
+        hash = (hash ^ it[i]) * 0x100000001b3ULL;
+
+    return hash ? hash : 1;
+}
+
+static struct frag_msg *frag_find(
+        struct pond_frag *frag, uint64_t hash, uint32_t id,
+        const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t mask = frag->slots_cap - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct frag_msg *msg = &frag->slots[i];
+        if (!msg->hash) return msg;
+
+        if (msg->hash == hash && msg->id == id && msg->addr_len == addr_len &&
+                !memcmp(&msg->addr, addr, addr_len))
+            return msg;
+    }
+}
+
+// Backward shift deletion which avoids the need for tombstones.
+static void frag_del(struct pond_frag *frag, size_t i)
+{
+    size_t mask = frag->slots_cap - 1;
+    struct frag_msg *slots = frag->slots;
+
+    for (size_t j = (i + 1) & mask; slots[j].hash; j = (j + 1) & mask) {
+        size_t home = slots[j].hash & mask;
+
+        bool in_place = i <= j ?
+            (i < home && home <= j) :
+            (i < home || home <= j);
+        if (in_place) continue;
+
+        slots[i] = slots[j];
+        i = j;
+    }
+
+    slots[i].hash = 0;
+}
+
+static struct pond_buf *frag_buf(struct pond_frag *frag, size_t len)
+{
+    struct pond_buf *buf = NULL;
+
+    if (frag->pool_len) buf = frag->pool[--frag->pool_len];
+    else {
+        buf = calloc(1, sizeof(*buf));
+        pond_assert_alloc(buf);
+    }
+
+    pond_buf_reserve(buf, len);
+    buf->len = len;
+    return buf;
+}
+
+void pond_frag_release(struct pond_frag *frag, struct pond_buf *buf)
+{
+    if (frag->pool_len == frag->opt.pool_cap) { frag_buf_free(buf); return; }
+
+    buf->len = 0;
+    frag->pool[frag->pool_len++] = buf;
+}
+
+static void frag_drop(struct pond_frag *frag, struct frag_msg *msg)
+{
+    frag->mem -= msg->buf->len;
+    frag->pending--;
+
+    pond_frag_release(frag, msg->buf);
+    frag_del(frag, msg - frag->slots);
+}
+
+
+// -----------------------------------------------------------------------------
+// recv
+// -----------------------------------------------------------------------------
+
+struct pond_buf *pond_frag_recv(
+        struct pond_frag *frag, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const uint8_t *data, size_t len)
+{
+    if (pond_unlikely(len < sizeof(struct frag_header))) goto invalid;
+
+    struct frag_header header;
+    memcpy(&header, data, sizeof(header));
+
+    uint32_t id = le32toh(header.id);
+    size_t index = le16toh(header.index);
+    size_t count = le16toh(header.count);
+    size_t total = le32toh(header.len);
+
+    const uint8_t *payload = data + sizeof(header);
+    size_t payload_len = len - sizeof(header);
+
+    if (pond_unlikely(!count || count > pond_frag_count_cap || index >= count))
+        goto invalid;
+
+    // Every fragment must agree on the chunk length which is also used to
+    // validate that they cover the total length without gaps or overflows.
+    // The last fragment must also end exactly on the total so that
+    // total == (count - 1) * chunk + payload_len and no byte of the pooled
+    // buffer is left holding the data of a previous message.
+    size_t chunk = payload_len, off = index * chunk;
+    if (index == count - 1) {
+        if (payload_len > total) goto invalid;
+        off = total - payload_len;
+
+        if (count == 1) {
+            if (off) goto invalid;
+        }
+        else {
+            chunk = off / (count - 1);
+            if (!payload_len || off % (count - 1) || payload_len > chunk) goto invalid;
+        }
+    }
+    else if (!chunk || pond_ceil_div(total, chunk) != count) goto invalid;
+
+    uint64_t hash = frag_hash(addr, addr_len, id);
+    struct frag_msg *msg = frag_find(frag, hash, id, addr, addr_len);
+
+    if (!msg->hash) {
+        if (frag->pending == frag->opt.pending_cap ||
+                frag->mem + total > frag->opt.mem_cap)
+        {
+            frag->stats.dropped++;
+            return NULL;
+        }
+
+        *msg = (struct frag_msg) {
+            .hash = hash,
+            .id = id,
+            .addr_len = addr_len,
+            .count = count,
+            .chunk = chunk,
+            .deadline = now + frag->opt.timeout,
+            .buf = frag_buf(frag, total),
+        };
+        memcpy(&msg->addr, addr, addr_len);
+
+        frag->mem += total;
+        frag->pending++;
+    }
+    else if (msg->count != count || msg->chunk != chunk || msg->buf->len != total) {
+        goto invalid;
+    }
+
+    uint64_t mask = 1ULL << (index % 64);
+    if (msg->bitmap[index / 64] & mask) { frag->stats.duplicate++; return NULL; }
+    msg->bitmap[index / 64] |= mask;
+
+    memcpy(msg->buf->d + off, payload, payload_len);
+    if (++msg->received < msg->count) return NULL;
+
+    struct pond_buf *buf = msg->buf;
+    frag->mem -= buf->len;
+    frag->pending--;
+    frag_del(frag, msg - frag->slots);
+
+    frag->stats.complete++;
+    return buf;
+
+  invalid:
+    frag->stats.invalid++;
+    return NULL;
+}
+
+size_t pond_frag_expire(struct pond_frag *frag, uint64_t now)
+{
+    size_t expired = 0;
+
+    // Deleting shifts the following entries back into the current slot so we
+    // only move forward when the slot is kept.
+    for (size_t i = 0; i < frag->slots_cap;) {
+        struct frag_msg *msg = &frag->slots[i];
+        if (!msg->hash || msg->deadline > now) { ++i; continue; }
+
+        frag_drop(frag, msg);
+        expired++;
+    }
+
+    frag->stats.expired += expired;
+    return expired;
+}
@@ -0,0 +1,89 @@
+/* frag.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Splits messages larger then a datagram into MTU sized fragments and
+   reassembles them on the receiving end.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_buf;
+struct pond_mmsg;
+struct pond_udp;
+
+
+// -----------------------------------------------------------------------------
+// frag
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pond_frag_header_len = 12,
+    pond_frag_count_cap = 1024,
+};
+
+struct pond_frag_opt
+{
+    size_t mtu;          // max datagram payload including the header; defaults to 1472.
+    uint64_t timeout;    // nanoseconds before an incomplete message is dropped.
+    size_t mem_cap;      // max bytes held by incomplete messages.
+    size_t pending_cap;  // max number of incomplete messages.
+    size_t pool_cap;     // max number of idle buffers kept for reuse.
+};
+
+struct pond_frag_stats
+{
+    uint64_t complete;
+    uint64_t expired;
+    uint64_t dropped;    // rejected due to the memory or pending caps.
+    uint64_t invalid;
+    uint64_t duplicate;
+};
+
+struct pond_frag;
+
+struct pond_frag *pond_frag_alloc(const struct pond_frag_opt *) pond_malloc;
+void pond_frag_free(struct pond_frag *);
+
+void pond_frag_stats(struct pond_frag *, struct pond_frag_stats *dst);
+
+
+// Writes the fragments of src in dst starting at message first and returns the
+// index past the last fragment or 0 if dst doesn't have enough room.
+size_t pond_frag_split(
+        struct pond_frag *, const struct pond_buf *src,
+        struct pond_mmsg *dst, size_t first,
+        const struct sockaddr *addr, socklen_t addr_len);
+
+// Sends src through dst in as many batches as needed using msg as scratch.
+bool pond_frag_send(
+        struct pond_frag *, struct pond_udp *dst, struct pond_mmsg *msg,
+        const struct pond_buf *src,
+        const struct sockaddr *addr, socklen_t addr_len);
+
+
+// Returns a reassembled message when the given datagram completes it or NULL
+// otherwise. The returned buffer must be given back via pond_frag_release.
+struct pond_buf *pond_frag_recv(
+        struct pond_frag *, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const uint8_t *data, size_t len);
+
+void pond_frag_release(struct pond_frag *, struct pond_buf *);
+
+// Drops all incomplete messages whose deadline is before now.
+size_t pond_frag_expire(struct pond_frag *, uint64_t now);
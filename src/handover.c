@@ -0,0 +1,458 @@
+/* handover.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "handover.h"
+#include "net.h"
+#include "errors.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// -----------------------------------------------------------------------------
+// msg
+// -----------------------------------------------------------------------------
+
+// Both ends are expected to run builds of the same library so the messages
+// are raw structs guarded by a version that must be bumped on any change.
+enum
+{
+    handover_magic = 0x504F4E44, // POND
+    handover_version = 1,
+};
+
+enum handover_kind
+{
+    handover_udp = 1,  // carries one fd.
+    handover_end = 2,  // count holds the number of udp messages sent.
+    handover_ack = 3,
+};
+
+struct handover_msg
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint32_t count;
+
+    uint8_t cpu_affinity;
+    uint8_t reuse_port;
+    uint8_t mcast_no_loop;
+    int32_t mcast_ttl;
+    int32_t rcvbuf;
+    int32_t sndbuf;
+    uint64_t adapt_batch_min;
+    uint64_t adapt_wait_max;
+};
+
+static bool handover_send_msg(int fd, const struct handover_msg *msg, int pass)
+{
+    struct iovec iov = { .iov_base = (void *) msg, .iov_len = sizeof(*msg) };
+    struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    if (pass != -1) {
+        memset(&control, 0, sizeof(control));
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass, sizeof(pass));
+    }
+
+    ssize_t ret;
+    do { ret = sendmsg(fd, &hdr, MSG_NOSIGNAL); } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        pond_fail_errno("unable to send handover message");
+        return false;
+    }
+
+    return true;
+}
+
+// pass is set to the received fd or -1 if the message carried none.
+static bool handover_recv_msg(int fd, struct handover_msg *msg, int *pass)
+{
+    struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t ret;
+    do { ret = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC); } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        pond_fail_errno("unable to recv handover message");
+        return false;
+    }
+
+    *pass = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        memcpy(pass, CMSG_DATA(cmsg), sizeof(*pass));
+    }
+
+    if (!ret) {
+        pond_fail("handover peer closed the connection");
+        goto fail;
+    }
+
+    if (hdr.msg_flags & MSG_CTRUNC) {
+        pond_fail("truncated handover control message");
+        goto fail;
+    }
+
+    if ((size_t) ret != sizeof(*msg) || msg->magic != handover_magic) {
+        pond_fail("invalid handover message: len=%zd", ret);
+        goto fail;
+    }
+
+    if (msg->version != handover_version) {
+        pond_fail("unsupported handover version: %u != %u", msg->version, handover_version);
+        goto fail;
+    }
+
+    return true;
+
+  fail:
+    if (*pass != -1) close(*pass);
+    *pass = -1;
+    return false;
+}
+
+static bool handover_poll(int fd, uint64_t timeout, bool *ready)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct timespec ts = {
+        .tv_sec = timeout / (1000UL * 1000 * 1000),
+        .tv_nsec = timeout % (1000UL * 1000 * 1000),
+    };
+
+    int ret = ppoll(&pfd, 1, timeout == UINT64_MAX ? NULL : &ts, NULL);
+    if (ret == -1 && errno != EINTR) {
+        pond_fail_errno("unable to poll handover socket");
+        return false;
+    }
+
+    *ready = ret > 0;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// handover
+// -----------------------------------------------------------------------------
+
+struct pond_handover
+{
+    int listen_fd; // -1 for the incoming process.
+    int fd;        // -1 until connected.
+    bool linked;   // path still needs to be unlinked.
+
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+};
+
+static struct pond_handover *handover_alloc(const char *path)
+{
+    pond_assert(path != NULL, "path can't be nil");
+
+    struct pond_handover *handover = calloc(1, sizeof(*handover));
+    pond_assert_alloc(handover);
+
+    handover->listen_fd = handover->fd = -1;
+
+    handover->addr_len = pond_unix_addr(path, &handover->addr);
+    if (!handover->addr_len) {
+        free(handover);
+        return NULL;
+    }
+
+    return handover;
+}
+
+// SOCK_SEQPACKET keeps the message boundaries and with them the association
+// between each fd and the options that go with it.
+struct pond_handover *pond_handover_listen(const char *path)
+{
+    struct pond_handover *handover = handover_alloc(path);
+    if (!handover) return NULL;
+
+    handover->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (handover->listen_fd == -1) {
+        pond_fail_errno("unable to create handover socket for '%s'", path);
+        goto fail;
+    }
+
+    if (path[0] != '@' && unlink(path) == -1 && errno != ENOENT) {
+        pond_fail_errno("unable to unlink handover socket '%s'", path);
+        goto fail;
+    }
+
+    struct sockaddr *addr = (struct sockaddr *) &handover->addr;
+    if (bind(handover->listen_fd, addr, handover->addr_len) == -1) {
+        pond_fail_errno("unable to bind handover socket '%s'", path);
+        goto fail;
+    }
+    handover->linked = path[0] != '@';
+
+    if (listen(handover->listen_fd, 1) == -1) {
+        pond_fail_errno("unable to listen on handover socket '%s'", path);
+        goto fail;
+    }
+
+    return handover;
+
+  fail:
+    pond_handover_close(handover);
+    return NULL;
+}
+
+struct pond_handover *pond_handover_connect(const char *path)
+{
+    struct pond_handover *handover = handover_alloc(path);
+    if (!handover) return NULL;
+
+    handover->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (handover->fd == -1) {
+        pond_fail_errno("unable to create handover socket for '%s'", path);
+        goto fail;
+    }
+
+    struct sockaddr *addr = (struct sockaddr *) &handover->addr;
+    if (connect(handover->fd, addr, handover->addr_len) == -1) {
+        pond_fail_errno("unable to connect to handover socket '%s'", path);
+        goto fail;
+    }
+
+    return handover;
+
+  fail:
+    pond_handover_close(handover);
+    return NULL;
+}
+
+static void handover_unlink(struct pond_handover *handover)
+{
+    if (!handover->linked) return;
+
+    struct sockaddr_un *addr = (struct sockaddr_un *) &handover->addr;
+    (void) unlink(addr->sun_path);
+    handover->linked = false;
+}
+
+void pond_handover_close(struct pond_handover *handover)
+{
+    if (!handover) return;
+
+    if (handover->fd != -1) close(handover->fd);
+
+    if (handover->listen_fd != -1) close(handover->listen_fd);
+    handover_unlink(handover);
+
+    free(handover);
+}
+
+
+// -----------------------------------------------------------------------------
+// outgoing
+// -----------------------------------------------------------------------------
+
+// Whoever connects gets our sockets so the path alone, which could be bound
+// by anyone in the abstract namespace, isn't trusted to identify the peer.
+static bool handover_peer_check(int fd)
+{
+    struct ucred cred = {0};
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        pond_fail_errno("unable to get the handover peer credentials");
+        return false;
+    }
+
+    if (cred.uid != geteuid()) {
+        pond_fail("rejected handover peer: pid=%d, uid=%u", cred.pid, cred.uid);
+        return false;
+    }
+
+    return true;
+}
+
+bool pond_handover_send(
+        struct pond_handover *handover,
+        struct pond_udp *const *udps, size_t len, uint64_t timeout)
+{
+    pond_assert(handover->listen_fd != -1, "handover send from the incoming process");
+
+    if (handover->fd == -1) {
+        bool ready = false;
+        if (!handover_poll(handover->listen_fd, timeout, &ready)) return false;
+        if (!ready) {
+            pond_fail("timed out waiting for the incoming process");
+            return false;
+        }
+
+        handover->fd = accept4(handover->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (handover->fd == -1) {
+            pond_fail_errno("unable to accept handover connection");
+            return false;
+        }
+
+        if (!handover_peer_check(handover->fd)) {
+            close(handover->fd);
+            handover->fd = -1;
+            return false;
+        }
+
+        // The incoming process is likely to listen on the same path for the
+        // next restart so the path must be gone before it gets the chance.
+        handover_unlink(handover);
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        const struct pond_udp_opt *opt = pond_udp_options(udps[i]);
+
+        struct handover_msg msg = {
+            .magic = handover_magic,
+            .version = handover_version,
+            .kind = handover_udp,
+            .count = i,
+
+            .cpu_affinity = opt->cpu_affinity,
+            .reuse_port = opt->reuse_port,
+            .mcast_no_loop = opt->mcast_no_loop,
+            .mcast_ttl = opt->mcast_ttl,
+            .rcvbuf = opt->rcvbuf,
+            .sndbuf = opt->sndbuf,
+            .adapt_batch_min = opt->adapt_batch_min,
+            .adapt_wait_max = opt->adapt_wait_max,
+        };
+
+        if (!handover_send_msg(handover->fd, &msg, pond_udp_fd(udps[i]))) return false;
+    }
+
+    struct handover_msg end = {
+        .magic = handover_magic,
+        .version = handover_version,
+        .kind = handover_end,
+        .count = len,
+    };
+    return handover_send_msg(handover->fd, &end, -1);
+}
+
+bool pond_handover_wait(struct pond_handover *handover, uint64_t timeout, bool *done)
+{
+    pond_assert(handover->fd != -1, "handover wait before send");
+
+    *done = false;
+
+    bool ready = false;
+    if (!handover_poll(handover->fd, timeout, &ready)) return false;
+    if (!ready) return true;
+
+    int pass = -1;
+    struct handover_msg msg;
+    if (!handover_recv_msg(handover->fd, &msg, &pass)) return false;
+
+    if (pass != -1) close(pass);
+    if (msg.kind != handover_ack) {
+        pond_fail("unexpected handover message: %u", msg.kind);
+        return false;
+    }
+
+    *done = true;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// incoming
+// -----------------------------------------------------------------------------
+
+bool pond_handover_recv(
+        struct pond_handover *handover, struct pond_udp **dst, size_t cap, size_t *len)
+{
+    pond_assert(handover->listen_fd == -1, "handover recv from the outgoing process");
+
+    *len = 0;
+
+    while (true) {
+        int pass = -1;
+        struct handover_msg msg;
+        if (!handover_recv_msg(handover->fd, &msg, &pass)) goto fail;
+
+        if (msg.kind == handover_end) {
+            if (msg.count == *len) return true;
+            pond_fail("handover count mismatch: %u != %zu", msg.count, *len);
+            goto fail;
+        }
+
+        if (msg.kind != handover_udp || pass == -1) {
+            if (pass != -1) close(pass);
+            pond_fail("unexpected handover message: %u", msg.kind);
+            goto fail;
+        }
+
+        if (*len == cap) {
+            close(pass);
+            pond_fail("too many handover sockets: %zu", cap);
+            goto fail;
+        }
+
+        struct pond_udp_opt opt = {
+            .cpu_affinity = msg.cpu_affinity,
+            .reuse_port = msg.reuse_port,
+            .mcast_no_loop = msg.mcast_no_loop,
+            .mcast_ttl = msg.mcast_ttl,
+            .rcvbuf = msg.rcvbuf,
+            .sndbuf = msg.sndbuf,
+            .adapt_batch_min = msg.adapt_batch_min,
+            .adapt_wait_max = msg.adapt_wait_max,
+        };
+
+        dst[*len] = pond_udp_adopt(pass, &opt);
+        if (!dst[*len]) { close(pass); goto fail; }
+        (*len)++;
+    }
+
+  fail:
+    for (size_t i = 0; i < *len; ++i) pond_udp_close(dst[i]);
+    *len = 0;
+    return false;
+}
+
+bool pond_handover_ack(struct pond_handover *handover)
+{
+    pond_assert(handover->listen_fd == -1, "handover ack from the outgoing process");
+
+    struct handover_msg msg = {
+        .magic = handover_magic,
+        .version = handover_version,
+        .kind = handover_ack,
+    };
+    return handover_send_msg(handover->fd, &msg, -1);
+}
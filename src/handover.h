@@ -0,0 +1,68 @@
+/* handover.h
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Hands pond_udp sockets over to a new process for hot restarts.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+
+
+// -----------------------------------------------------------------------------
+// handover
+// -----------------------------------------------------------------------------
+
+// The outgoing process listens on a unix socket and passes its pond_udp fds
+// along with their options to the incoming process through SCM_RIGHTS. Both
+// processes then refer to the same kernel sockets so the datagrams queued on
+// them, their bound addresses, their SO_REUSEPORT group membership and any
+// attached socket filter all carry over without the sockets ever closing.
+//
+// The outgoing process keeps draining the sockets until the incoming one acks
+// that it's draining them as well, after which the outgoing process can stop
+// and close its copies of the fds without any datagram being dropped.
+//
+// Paths starting with @ are in the abstract namespace.
+
+struct pond_handover;
+
+// outgoing process
+struct pond_handover *pond_handover_listen(const char *path) pond_malloc;
+
+// Waits at most timeout nanoseconds for the incoming process to connect and
+// sends it the sockets. A timeout of UINT64_MAX waits forever. Peers that
+// don't run under our effective uid are disconnected and fail the call which
+// can be retried to wait for the next one.
+bool pond_handover_send(
+        struct pond_handover *, struct pond_udp *const *udps, size_t len, uint64_t timeout);
+
+// Waits at most timeout nanoseconds for the ack of the incoming process and
+// sets done once it has been received. A timeout of 0 never blocks which makes
+// it possible to poll in between receive batches.
+bool pond_handover_wait(struct pond_handover *, uint64_t timeout, bool *done);
+
+
+// incoming process
+struct pond_handover *pond_handover_connect(const char *path) pond_malloc;
+
+// Writes the sockets in the order they were sent and sets len to their count.
+bool pond_handover_recv(
+        struct pond_handover *, struct pond_udp **dst, size_t cap, size_t *len);
+
+// Signals that the sockets are being drained by this process.
+bool pond_handover_ack(struct pond_handover *);
+
+void pond_handover_close(struct pond_handover *);
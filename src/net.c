@@ -8,19 +8,32 @@
 #include "process.h"
 #include "math.h"
 #include "buf.h"
+#include "bits.h"
+#include "probe.h"
+#include "sim.h"
 
 #include <stdio.h>
+#include <errno.h>
 #include <bsd/string.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <linux/sock_diag.h>
+#include <linux/sockios.h>
 
 // -----------------------------------------------------------------------------
 // host
 // -----------------------------------------------------------------------------
 
-struct pond_host *pond_host_parse(const char *str)
+struct pond_host *pond_host_from_str(const char *str)
 {
     size_t sep = 0;
     for (size_t i = 0; i < pond_host_cap + 1; ++i) {
@@ -28,7 +41,7 @@ struct pond_host *pond_host_parse(const char *str)
         if (str[i] == ':') { sep = i; break; }
     }
 
-    if (sep == 0) {
+    if (sep == 0 || sep >= pond_host_cap) {
         pond_fail("invalid host string: %s", str);
         return NULL;
     }
@@ -42,17 +55,19 @@ struct pond_host *pond_host_parse(const char *str)
 
     struct pond_host *s = calloc(1, sizeof(*s));
 
-    size_t ret = strlcpy(s->host, str, sep + 1);
-    pond_assert(ret == sep, "unable to copy host: str='%s', len=%zu", str, sep + 1);
+    // strlcpy returns the length of the whole source string which here also
+    // includes the service so the host is copied by hand.
+    memcpy(s->host, str, sep);
+    s->host[sep] = '\0';
 
-    ret = strlcpy(s->service, service, pond_host_cap);
+    size_t ret = strlcpy(s->service, service, pond_host_cap);
     pond_assert(ret < pond_host_cap,
             "unable to copy service: str='%s', len=%d", service, pond_host_cap);
 
     return s;
 }
 
-struct pond_host *pond_host_port(const char *host, uint16_t port)
+struct pond_host *pond_host_from_port(const char *host, uint16_t port)
 {
     if (strnlen(host, pond_host_cap) >= pond_host_cap) {
         pond_fail("invalid host length: %s", host);
@@ -77,7 +92,7 @@ struct pond_host *pond_host_port(const char *host, uint16_t port)
     return s;
 }
 
-struct pond_host *pond_host_service(const char *host, const char *service)
+struct pond_host *pond_host_from_service(const char *host, const char *service)
 {
     if (strnlen(host, pond_host_cap) >= pond_host_cap) {
         pond_fail("invalid host length: %s", host);
@@ -141,21 +156,22 @@ struct pond_it pond_iov_it(struct pond_iov *iov)
 }
 
 
-static size_t iovec_len(const size_t *sizes, size_t cap)
+static size_t iovec_header_len(size_t cap)
 {
-    size_t sum = 0;
-    for (size_t i = 0; i < cap; ++i) sum += sizes[0];
+    return sizeof(struct pond_iovec) + sizeof(struct pond_iov) * cap;
+}
 
-    return sizeof(struct pond_iovec) + sizeof(struct pond_iov) * cap + sum;
+static size_t iovec_data_len(const size_t *sizes, size_t cap)
+{
+    size_t sum = 0;
+    for (size_t i = 0; i < cap; ++i) sum += sizes[i];
+    return sum;
 }
 
-static void iovec_init(struct pond_iovec *iovec, const size_t *sizes, size_t cap)
+static void iovec_init(struct pond_iovec *iovec, const size_t *sizes, size_t cap, uint8_t *bin)
 {
     *iovec = (struct pond_iovec) { .cap = cap };
 
-    size_t header_len = sizeof(struct pond_iovec) + sizeof(struct pond_iov) * cap;
-    uint8_t *bin = ((uint8_t *) iovec) + header_len;
-
     for (size_t i = 0; i < cap; ++i) {
         struct pond_iov *iov = &iovec->vec[i];
         *iov = (struct pond_iov) {
@@ -168,9 +184,10 @@ static void iovec_init(struct pond_iovec *iovec, const size_t *sizes, size_t cap
 
 struct pond_iovec *pond_iovec_alloc(const size_t *sizes, size_t cap)
 {
-    struct pond_iovec *iovec = calloc(1, iovec_len(sizes, cap));
+    size_t header_len = iovec_header_len(cap);
+    struct pond_iovec *iovec = calloc(1, header_len + iovec_data_len(sizes, cap));
     pond_assert_alloc(iovec);
-    iovec_init(iovec, sizes, cap);
+    iovec_init(iovec, sizes, cap, ((uint8_t *) iovec) + header_len);
     return iovec;
 }
 
@@ -183,30 +200,70 @@ void pond_iovec_free(struct pond_iovec *iovec)
 // mmsg
 // -----------------------------------------------------------------------------
 
-struct pond_mmsg
-{
-    size_t len, cap;
-    size_t iovecs_len;
-    struct msghdr headers[];
-};
+// Every array is a separate cache-line aligned run indexed by message so that
+// recvmmsg and sendmmsg scan headers, iovecs and addresses sequentially while
+// the pond_iovec headers and payloads which are written by the consumer of a
+// batch never share a cache line across messages. Payloads start on a page and
+// each slot is padded to a cache line or, once a slot reaches a page, to a page.
+
+extern inline size_t pond_mmsg_len(const struct pond_mmsg *);
+extern inline size_t pond_mmsg_cap(const struct pond_mmsg *);
+extern inline struct msghdr *pond_mmsg_header(struct pond_mmsg *, size_t i);
+extern inline struct pond_iovec *pond_mmsg_iovec(struct pond_mmsg *, size_t i);
+extern inline const struct sockaddr *pond_mmsg_addr(struct pond_mmsg *, size_t i, socklen_t *len);
 
 struct pond_mmsg *pond_mmsg_alloc(size_t msg_cap, const size_t *iov_sizes, size_t iov_cap)
 {
-    size_t headers_len = sizeof(struct msghdr) * msg_cap;
-    size_t iovecs_len = iovec_len(iov_sizes, iov_cap) * msg_cap;
-    struct pond_mmsg *mmsg = calloc(1, sizeof(*mmsg) + headers_len + iovecs_len);
-    pond_assert_alloc(mmsg);
-
-    *mmsg = (struct pond_mmsg) { .cap = msg_cap, .iovecs_len = iovecs_len };
+    size_t data_len = iovec_data_len(iov_sizes, iov_cap);
+    size_t data_align = data_len >= pond_mmsg_page_len ? pond_mmsg_page_len : pond_mmsg_line_len;
+
+    size_t iovecs_stride = pond_bit_align(iovec_header_len(iov_cap), pond_mmsg_line_len);
+    size_t data_stride = pond_bit_align(data_len, data_align);
+
+    size_t off = pond_bit_align(sizeof(struct pond_mmsg), pond_mmsg_line_len);
+    size_t headers_off = off; off += pond_bit_align(sizeof(struct mmsghdr) * msg_cap, pond_mmsg_line_len);
+    size_t iovs_off = off; off += pond_bit_align(sizeof(struct iovec) * iov_cap * msg_cap, pond_mmsg_line_len);
+    size_t addrs_off = off; off += pond_bit_align(sizeof(struct sockaddr_storage) * msg_cap, pond_mmsg_line_len);
+    size_t cmsgs_off = off; off += pond_mmsg_cmsg_cap * msg_cap;
+    size_t iovecs_off = off; off += iovecs_stride * msg_cap;
+    size_t data_off = pond_bit_align(off, pond_mmsg_page_len);
+    size_t total = pond_bit_align(data_off + data_stride * msg_cap, pond_mmsg_page_len);
+
+    uint8_t *base = aligned_alloc(pond_mmsg_page_len, total);
+    pond_assert_alloc(base);
+    memset(base, 0, total);
+
+    struct pond_mmsg *mmsg = (void *) base;
+    *mmsg = (struct pond_mmsg) {
+        .cap = msg_cap,
+        .iov_cap = iov_cap,
+        .headers_stride = sizeof(struct mmsghdr),
+        .iovecs_stride = iovecs_stride,
+        .data_stride = data_stride,
+
+        .headers = (void *) (base + headers_off),
+        .iovs = (void *) (base + iovs_off),
+        .addrs = (void *) (base + addrs_off),
+        .cmsgs = base + cmsgs_off,
+        .iovecs = base + iovecs_off,
+        .data = base + data_off,
+    };
 
     for (size_t i = 0; i < msg_cap; ++i) {
-        struct msghdr *hdr = &mmsg->headers[i];
-        struct pond_iovec *iov = pond_mmsg_iovec(mmsg, i);
+        struct iovec *iovs = &mmsg->iovs[i * iov_cap];
+        struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+        iovec_init(iovec, iov_sizes, iov_cap, mmsg->data + data_stride * i);
+
+        for (size_t j = 0; j < iov_cap; ++j)
+            iovs[j].iov_base = iovec->vec[j].bin;
 
-        hdr->msg_iov = pond_iov_sys(iov);
-        iovec_init(iov, iov_sizes, iov_cap);
+        struct msghdr *hdr = &mmsg->headers[i].msg_hdr;
+        hdr->msg_iov = iovs;
+        hdr->msg_name = &mmsg->addrs[i];
+        hdr->msg_control = mmsg->cmsgs + pond_mmsg_cmsg_cap * i;
     }
 
+    pond_probe3(mmsg_alloc, msg_cap, iov_cap, total);
     return mmsg;
 }
 
@@ -216,27 +273,149 @@ void pond_mmsg_free(struct pond_mmsg *mmsg)
 }
 
 
-size_t pond_mmsg_len(const struct pond_mmsg *mmsg)
+void pond_mmsg_set_len(struct pond_mmsg *mmsg, size_t len)
+{
+    pond_assert(len <= mmsg->cap, "invalid mmsg len: %zu > %zu", len, mmsg->cap);
+    mmsg->len = len;
+}
+
+
+void pond_mmsg_set_addr(
+        struct pond_mmsg *mmsg, size_t i, const struct sockaddr *addr, socklen_t len)
+{
+    pond_assert(len <= sizeof(mmsg->addrs[i]), "invalid addr len: %u", len);
+
+    if (len) memcpy(&mmsg->addrs[i], addr, len);
+    mmsg->headers[i].msg_hdr.msg_namelen = len;
+}
+
+
+// pond_iov isn't layout compatible with iovec as an array so the lengths must
+// be synced with the iovec array handed to the kernel before and after each
+// syscall.
+//
+// Unnamed batches are for connected sockets where the peer address is fixed so
+// the kernel neither fills nor reads the per-message addresses.
+static bool mmsg_recv(int fd, struct pond_mmsg *mmsg, size_t len, int flags, bool named)
+{
+    len = pond_min(len, mmsg->cap);
+
+    for (size_t i = 0; i < len; ++i) {
+        struct msghdr *hdr = &mmsg->headers[i].msg_hdr;
+        struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+
+        for (size_t j = 0; j < mmsg->iov_cap; ++j)
+            hdr->msg_iov[j].iov_len = iovec->vec[j].cap;
+
+        hdr->msg_iovlen = mmsg->iov_cap;
+        hdr->msg_name = named ? &mmsg->addrs[i] : NULL;
+        hdr->msg_namelen = named ? sizeof(mmsg->addrs[i]) : 0;
+        hdr->msg_controllen = pond_mmsg_cmsg_cap;
+        hdr->msg_flags = 0;
+    }
+
+    pond_probe2(mrecv_entry, fd, len);
+
+    int ret;
+    do {
+        ret = recvmmsg(fd, mmsg->headers, len, flags, NULL);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        mmsg->len = 0;
+        pond_probe3(mrecv_return, fd, 0, 0);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+
+        pond_fail_errno("unable to receive messages");
+        return false;
+    }
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < (size_t) ret; ++i) {
+        size_t left = mmsg->headers[i].msg_len;
+        bytes += left;
+        struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+
+        iovec->len = 0;
+        for (size_t j = 0; j < mmsg->iov_cap; ++j) {
+            struct pond_iov *iov = &iovec->vec[j];
+            iov->len = pond_min(left, iov->cap);
+            left -= iov->len;
+            if (iov->len) iovec->len = j + 1;
+        }
+    }
+
+    pond_probe3(mrecv_return, fd, ret, bytes);
+
+    mmsg->len = ret;
+    return true;
+}
+
+static bool mmsg_send_sys(int fd, struct mmsghdr *headers, size_t len)
 {
-    return mmsg->len;
+    pond_probe2(msend_entry, fd, len);
+
+    size_t sent = 0;
+    while (sent < len) {
+        int ret = sendmmsg(fd, headers + sent, len - sent, 0);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+
+            pond_probe2(msend_return, fd, sent);
+            pond_fail_errno("unable to send messages: %zu/%zu", sent, len);
+            return false;
+        }
+
+        sent += ret;
+    }
+
+    pond_probe2(msend_return, fd, sent);
+    return true;
 }
 
-size_t pond_mmsg_cap(const struct pond_mmsg *mmsg)
+static bool mmsg_send(int fd, struct pond_mmsg *mmsg, size_t len, bool named)
 {
-    return mmsg->cap;
+    len = pond_min(len, mmsg->cap);
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < len; ++i) {
+        struct msghdr *hdr = &mmsg->headers[i].msg_hdr;
+        struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+
+        for (size_t j = 0; j < iovec->len; ++j) {
+            hdr->msg_iov[j].iov_len = iovec->vec[j].len;
+            bytes += iovec->vec[j].len;
+        }
+
+        hdr->msg_iovlen = iovec->len;
+        hdr->msg_name = &mmsg->addrs[i];
+        if (!named) hdr->msg_namelen = 0;
+        hdr->msg_controllen = 0;
+    }
+
+    pond_probe3(msend_bytes, fd, len, bytes);
+    return mmsg_send_sys(fd, mmsg->headers, len);
 }
 
 
-struct msghdr *pond_mmsg_header(struct pond_mmsg *mmsg, size_t i)
+// -----------------------------------------------------------------------------
+// sock
+// -----------------------------------------------------------------------------
+
+static bool sock_opt(int fd, int level, int name, int value)
 {
-    return &mmsg->headers[i];
+    return setsockopt(fd, level, name, &value, sizeof(value)) != -1;
 }
 
-struct pond_iovec *pond_mmsg_iovec(struct pond_mmsg *mmsg, size_t i)
+static bool sock_opts(int fd, bool cpu_affinity, bool reuse_port)
 {
-    return ((void *) mmsg) + sizeof(*mmsg) +
-        sizeof(mmsg->headers[0]) * mmsg->cap +
-        mmsg->iovecs_len * i;
+    if (cpu_affinity && !sock_opt(fd, SOL_SOCKET, SO_INCOMING_CPU, pond_cpu()))
+        return false;
+
+    if (reuse_port && !sock_opt(fd, SOL_SOCKET, SO_REUSEPORT, 1))
+        return false;
+
+    return true;
 }
 
 
@@ -244,16 +423,86 @@ struct pond_iovec *pond_mmsg_iovec(struct pond_mmsg *mmsg, size_t i)
 // udp
 // -----------------------------------------------------------------------------
 
+// Backed either by a socket or, when sim is set, by an endpoint of the
+// simulated network in which case fd is -1.
 struct pond_udp
 {
     int fd;
+    struct pond_sim_udp *sim;
     struct pond_udp_opt opt;
+
+    socklen_t local_len;
+    struct sockaddr_storage local;
+
+    socklen_t peer_len;
+    struct sockaddr_storage peer;
+
+    struct pond_udp_stats stats;
+    uint64_t adapt_fill; // fixed point over udp_adapt_one.
+};
+
+enum
+{
+    udp_adapt_batch_min = 1,
+    udp_adapt_wait_max = 1000 * 1000,
+    udp_adapt_wait_step = 10 * 1000,
+
+    udp_adapt_one = 1 << 16,
+    udp_adapt_shrink = udp_adapt_one / 4,
 };
 
-static int udp_socket(const struct pond_host *host, const struct pond_udp_opt *opt)
+static bool udp_connected(struct pond_udp *udp)
+{
+    return udp->peer_len != 0;
+}
+
+static bool udp_buf_opts(int fd, const struct pond_udp_opt *opt)
+{
+    if (opt->rcvbuf && !sock_opt(fd, SOL_SOCKET, SO_RCVBUF, opt->rcvbuf))
+        return false;
+
+    if (opt->sndbuf && !sock_opt(fd, SOL_SOCKET, SO_SNDBUF, opt->sndbuf))
+        return false;
+
+    return true;
+}
+
+static bool udp_mcast_opts(int fd, int family, const struct pond_udp_opt *opt)
+{
+    bool v6 = family == AF_INET6;
+    int level = v6 ? IPPROTO_IPV6 : IPPROTO_IP;
+
+    if (opt->mcast_if) {
+        unsigned index = if_nametoindex(opt->mcast_if);
+        if (!index) return false;
+
+        if (v6) {
+            if (!sock_opt(fd, level, IPV6_MULTICAST_IF, index)) return false;
+        }
+        else {
+            struct ip_mreqn req = { .imr_ifindex = index };
+            if (setsockopt(fd, level, IP_MULTICAST_IF, &req, sizeof(req)) == -1)
+                return false;
+        }
+    }
+
+    if (opt->mcast_ttl) {
+        int name = v6 ? IPV6_MULTICAST_HOPS : IP_MULTICAST_TTL;
+        if (!sock_opt(fd, level, name, opt->mcast_ttl)) return false;
+    }
+
+    if (opt->mcast_no_loop) {
+        int name = v6 ? IPV6_MULTICAST_LOOP : IP_MULTICAST_LOOP;
+        if (!sock_opt(fd, level, name, 0)) return false;
+    }
+
+    return true;
+}
+
+static int udp_socket(const struct pond_host *host, const struct pond_udp_opt *opt, bool passive)
 {
     struct addrinfo hints = {0};
-    hints.ai_flags = AI_PASSIVE;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_DGRAM;
 
@@ -270,18 +519,21 @@ static int udp_socket(const struct pond_host *host, const struct pond_udp_opt *o
         fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
         if (fd == -1) continue;
 
-        if (opt->cpu_affinity) {
-            int cpu = pond_cpu();
-            if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1)
-                goto fail_sockopt;
-        }
+        if (!sock_opts(fd, opt->cpu_affinity, opt->reuse_port))
+            goto fail_sockopt;
 
-        if (opt->reuse_port) {
-            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, NULL, 0) == -1)
-                goto fail_sockopt;
-        }
+        if (!udp_buf_opts(fd, opt))
+            goto fail_sockopt;
+
+        if (!udp_mcast_opts(fd, addr->ai_family, opt))
+            goto fail_sockopt;
 
-        if (!bind(fd, addr->ai_addr, addr->ai_addrlen)) break;
+        if (passive) {
+            if (!bind(fd, addr->ai_addr, addr->ai_addrlen)) break;
+        }
+        else {
+            if (!connect(fd, addr->ai_addr, addr->ai_addrlen)) break;
+        }
 
       fail_sockopt:
         close(fd);
@@ -292,46 +544,872 @@ static int udp_socket(const struct pond_host *host, const struct pond_udp_opt *o
 
     if (fd != -1) return fd;
 
-    pond_fail_errno("unable to connect dgram socket for host '%s:%s'", host->host, host->service);
+    pond_fail_errno("unable to %s dgram socket for host '%s:%s'",
+            passive ? "bind" : "connect", host->host, host->service);
     return -1;
 }
 
+// The peer is looked up rather than passed in so that adopted sockets come out
+// connected or not just like the ones we create.
+static struct pond_udp *udp_wrap(int fd, const struct pond_udp_opt *opt)
+{
+    struct pond_udp *udp = calloc(1, sizeof(*udp));
+    pond_assert_alloc(udp);
 
-struct pond_udp *pond_udp_server(const struct pond_host *host, const struct pond_udp_opt *opt)
+    udp->fd = fd;
+    udp->opt = *opt;
+    if (!udp->opt.adapt_batch_min) udp->opt.adapt_batch_min = udp_adapt_batch_min;
+    if (!udp->opt.adapt_wait_max) udp->opt.adapt_wait_max = udp_adapt_wait_max;
+    udp->stats.adapt_batch = udp->opt.adapt_batch_min;
+    udp->adapt_fill = udp_adapt_one; // avoids shrinking on the warm-up batches.
+
+    udp->local_len = sizeof(udp->local);
+    if (getsockname(fd, (struct sockaddr *) &udp->local, &udp->local_len) == -1)
+        udp->local_len = 0;
+
+    udp->peer_len = sizeof(udp->peer);
+    if (getpeername(fd, (struct sockaddr *) &udp->peer, &udp->peer_len) == -1)
+        udp->peer_len = 0;
+
+    return udp;
+}
+
+static struct pond_udp *udp_alloc(
+        const struct pond_host *host, const struct pond_udp_opt *opt, bool passive)
 {
-    pond_assert(!host, "host can't be nil");
+    pond_assert(host != NULL, "host can't be nil");
 
     struct pond_udp_opt nil_opts = {0};
     if (!opt) opt = &nil_opts;
 
-    int fd = udp_socket(host, opt);
+    int fd = udp_socket(host, opt, passive);
     if (fd == -1) return NULL;
 
+    struct pond_udp *udp = udp_wrap(fd, opt);
+
+    if (!passive && !udp_connected(udp)) {
+        pond_fail("unable to get peer of dgram socket for host '%s:%s'",
+                host->host, host->service);
+        pond_udp_close(udp);
+        return NULL;
+    }
+
+    return udp;
+}
+
+struct pond_udp *pond_udp_adopt(int fd, const struct pond_udp_opt *opt)
+{
+    struct pond_udp_opt nil_opts = {0};
+    if (!opt) opt = &nil_opts;
+
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1) {
+        pond_fail_errno("unable to get type of socket %d", fd);
+        return NULL;
+    }
+
+    if (type != SOCK_DGRAM) {
+        pond_fail("socket %d is not a dgram socket: %d", fd, type);
+        return NULL;
+    }
+
+    struct pond_udp *udp = udp_wrap(fd, opt);
+    udp->opt.mcast_if = NULL;
+    return udp;
+}
+
+struct pond_udp *pond_udp_sim(struct pond_sim_udp *sim)
+{
+    pond_assert(sim != NULL, "sim endpoint can't be nil");
+
     struct pond_udp *udp = calloc(1, sizeof(*udp));
     pond_assert_alloc(udp);
 
-    udp->fd = fd;
-    udp->opt = *opt;
+    udp->fd = -1;
+    udp->sim = sim;
+    udp->opt.adapt_batch_min = udp_adapt_batch_min;
+    udp->opt.adapt_wait_max = udp_adapt_wait_max;
+    udp->stats.adapt_batch = udp->opt.adapt_batch_min;
+    udp->adapt_fill = udp_adapt_one;
+
+    const struct sockaddr *local = pond_sim_udp_local(sim, &udp->local_len);
+    memcpy(&udp->local, local, udp->local_len);
+
     return udp;
 }
 
+struct pond_udp *pond_udp_server(const struct pond_host *host, const struct pond_udp_opt *opt)
+{
+    return udp_alloc(host, opt, true);
+}
+
+struct pond_udp *pond_udp_client(const struct pond_host *host, const struct pond_udp_opt *opt)
+{
+    return udp_alloc(host, opt, false);
+}
+
 void pond_udp_close(struct pond_udp *udp)
 {
-    close(udp->fd);
+    if (udp->sim) pond_sim_udp_close(udp->sim);
+    else close(udp->fd);
     free(udp);
 }
 
-bool pond_udp_recv(struct pond_udp *udp, struct pond_it *dst, size_t len)
+int pond_udp_fd(struct pond_udp *udp)
+{
+    return udp->fd;
+}
+
+const struct pond_udp_opt *pond_udp_options(struct pond_udp *udp)
+{
+    return &udp->opt;
+}
+
+const struct sockaddr *pond_udp_local(struct pond_udp *udp, socklen_t *len)
+{
+    *len = udp->local_len;
+    return (struct sockaddr *) &udp->local;
+}
+
+const struct sockaddr *pond_udp_peer(struct pond_udp *udp, socklen_t *len)
+{
+    *len = udp->peer_len;
+    return udp_connected(udp) ? (struct sockaddr *) &udp->peer : NULL;
+}
+
+void pond_udp_stats(struct pond_udp *udp, struct pond_udp_stats *dst)
+{
+    *dst = udp->stats;
+    dst->adapt_fill = (double) udp->adapt_fill / udp_adapt_one;
+}
+
+int pond_udp_error(struct pond_udp *udp)
+{
+    if (udp->sim) return 0;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(udp->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) return errno;
+    return err;
+}
+
+bool pond_udp_drops(struct pond_udp *udp, uint64_t *dst)
+{
+    if (udp->sim) {
+        struct pond_sim_udp_stats stats;
+        pond_sim_udp_stats(udp->sim, &stats);
+        *dst = stats.overflow;
+        return true;
+    }
+
+    uint32_t meminfo[SK_MEMINFO_VARS] = {0};
+    socklen_t len = sizeof(meminfo);
+
+    if (getsockopt(udp->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == -1) {
+        pond_fail_errno("unable to get SO_MEMINFO");
+        return false;
+    }
+
+    *dst = meminfo[SK_MEMINFO_DROPS];
+    return true;
+}
+
+static bool udp_mrecv(struct pond_udp *udp, struct pond_mmsg *dst, size_t len, int flags)
+{
+    bool ok = udp->sim ?
+        pond_sim_udp_mrecv(udp->sim, dst, len) :
+        mmsg_recv(udp->fd, dst, len, flags, !udp_connected(udp));
+    if (!ok) return false;
+
+    udp->stats.recv_calls++;
+    udp->stats.recv_msgs += dst->len;
+    if (!dst->len) udp->stats.recv_empty++;
+    return true;
+}
+
+bool pond_udp_mrecv(struct pond_udp *udp, struct pond_mmsg *dst, size_t len)
+{
+    return udp_mrecv(udp, dst, len, MSG_WAITFORONE);
+}
+
+// Only falls back to ppoll if nothing is already queued on the socket so a busy
+// socket only costs one syscall per batch.
+bool pond_udp_mrecv_timeout(
+        struct pond_udp *udp, struct pond_mmsg *dst, size_t len, uint64_t timeout)
+{
+    if (timeout == UINT64_MAX) return pond_udp_mrecv(udp, dst, len);
+
+    if (!udp_mrecv(udp, dst, len, MSG_DONTWAIT)) return false;
+    if (dst->len || !timeout || udp->sim) return true;
+
+    struct pollfd pfd = { .fd = udp->fd, .events = POLLIN };
+    struct timespec ts = {
+        .tv_sec = timeout / (1000UL * 1000 * 1000),
+        .tv_nsec = timeout % (1000UL * 1000 * 1000),
+    };
+
+    int ret = ppoll(&pfd, 1, &ts, NULL);
+    if (ret == -1 && errno != EINTR) {
+        pond_fail_errno("unable to poll udp socket");
+        return false;
+    }
+    if (ret <= 0) return true;
+
+    return udp_mrecv(udp, dst, len, MSG_DONTWAIT);
+}
+
+bool pond_udp_mrecv_adapt(struct pond_udp *udp, struct pond_mmsg *dst)
 {
-    (void) udp; (void) dst; (void) len;
+    struct pond_udp_stats *stats = &udp->stats;
+
+    size_t cap = dst->cap;
+    size_t min = pond_min(udp->opt.adapt_batch_min, cap);
+    size_t batch = pond_max(pond_min(stats->adapt_batch, cap), min);
+
+    if (!pond_udp_mrecv_timeout(udp, dst, batch, stats->adapt_wait)) return false;
+
+    size_t len = dst->len;
+    uint64_t fill = (len * udp_adapt_one) / batch;
+    udp->adapt_fill = udp->adapt_fill - (udp->adapt_fill / 8) + (fill / 8);
+
+    // A full batch only means that the batch was too small if datagrams are
+    // still queued behind it. The memory charged to the receive queue can't
+    // tell as udp releases it lazily but SIOCINQ reports the size of the next
+    // datagram which is enough to know whether the queue is empty. The extra
+    // syscall is only paid on full batches which can still grow.
+    bool full = len == batch && batch < cap;
+    int next = 1;
+    if (full && udp->sim) {
+        struct pond_sim_udp_stats sim;
+        pond_sim_udp_stats(udp->sim, &sim);
+        next = sim.queued != 0;
+    }
+    else if (full && ioctl(udp->fd, SIOCINQ, &next) == -1) next = 1;
 
+    if (full && next) {
+        batch = pond_min(batch * 2, cap);
+        stats->adapt_grow++;
+    }
+    else if (udp->adapt_fill < udp_adapt_shrink && batch > min) {
+        batch = pond_max(batch / 2, min);
+        stats->adapt_shrink++;
+    }
+    stats->adapt_batch = batch;
 
+    // Once traffic shows up, waiting only delays the messages already queued
+    // so the wait is halved down to a straight poll.
+    uint64_t wait = stats->adapt_wait;
+    if (!len) wait = pond_min(wait ? wait * 2 : udp_adapt_wait_step, udp->opt.adapt_wait_max);
+    else wait = wait / 2 < udp_adapt_wait_step ? 0 : wait / 2;
+    stats->adapt_wait = wait;
 
     return true;
 }
 
-bool pond_udp_send(struct pond_udp *udp, const struct pond_it *src, size_t len)
+bool pond_udp_msend(struct pond_udp *udp, struct pond_mmsg *src, size_t len)
+{
+    len = pond_min(len, src->cap);
+    udp->stats.send_calls++;
+    udp->stats.send_msgs += len;
+
+    if (udp->sim) return pond_sim_udp_msend(udp->sim, src, len);
+    return mmsg_send(udp->fd, src, len, !udp_connected(udp));
+}
+
+bool pond_udp_msend_sys(struct pond_udp *udp, struct mmsghdr *src, size_t len)
+{
+    udp->stats.send_calls++;
+    udp->stats.send_msgs += len;
+
+    if (udp->sim) return pond_sim_udp_msend_sys(udp->sim, src, len);
+    return mmsg_send_sys(udp->fd, src, len);
+}
+
+
+static int udp_family(struct pond_udp *udp)
+{
+    return udp->local_len ? udp->local.ss_family : AF_UNSPEC;
+}
+
+static bool udp_mcast_group(
+        struct pond_udp *udp, const char *group, const char *iface, bool join)
+{
+    if (udp->sim) {
+        pond_fail("multicast isn't supported on sim endpoints: '%s'", group);
+        return false;
+    }
+
+    struct group_req req = {0};
+
+    if (iface) {
+        req.gr_interface = if_nametoindex(iface);
+        if (!req.gr_interface) {
+            pond_fail_errno("unknown multicast interface '%s'", iface);
+            return false;
+        }
+    }
+
+    struct addrinfo hints = {0};
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_family = udp_family(udp);
+    hints.ai_socktype = SOCK_DGRAM;
+    if (hints.ai_family == AF_INET6) hints.ai_flags |= AI_V4MAPPED;
+
+    struct addrinfo *head;
+    int err = getaddrinfo(group, NULL, &hints, &head);
+    if (err) {
+        pond_fail("unable to resolve multicast group '%s': %s", group, gai_strerror(err));
+        return false;
+    }
+
+    memcpy(&req.gr_group, head->ai_addr, head->ai_addrlen);
+    int level = head->ai_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+    freeaddrinfo(head);
+
+    // The kernel only accepts IPv4 groups on a dual-stack socket as a plain
+    // IPv4 address at the IP level so the mapping is undone.
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &req.gr_group;
+    if (level == IPPROTO_IPV6 && IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        struct sockaddr_in in = { .sin_family = AF_INET };
+        memcpy(&in.sin_addr, &in6->sin6_addr.s6_addr[12], sizeof(in.sin_addr));
+
+        memset(&req.gr_group, 0, sizeof(req.gr_group));
+        memcpy(&req.gr_group, &in, sizeof(in));
+        level = IPPROTO_IP;
+    }
+
+    int name = join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP;
+    if (setsockopt(udp->fd, level, name, &req, sizeof(req)) != -1) return true;
+
+    pond_fail_errno("unable to %s multicast group '%s'", join ? "join" : "leave", group);
+    return false;
+}
+
+bool pond_udp_join(struct pond_udp *udp, const char *group, const char *iface)
+{
+    return udp_mcast_group(udp, group, iface, true);
+}
+
+bool pond_udp_leave(struct pond_udp *udp, const char *group, const char *iface)
+{
+    return udp_mcast_group(udp, group, iface, false);
+}
+
+
+struct pond_udp_dests
 {
-    (void) udp; (void) src; (void) len;
+    size_t len;
+    struct sockaddr_storage *addrs;
+    struct mmsghdr *headers;
+
+    size_t iovs_cap;
+    struct iovec *iovs;
+};
+
+struct pond_udp_dests *pond_udp_dests_alloc(
+        struct pond_udp *udp, const struct pond_host *const *hosts, size_t len)
+{
+    struct pond_udp_dests *dests = calloc(1, sizeof(*dests));
+    pond_assert_alloc(dests);
+
+    dests->len = len;
+    dests->addrs = calloc(len, sizeof(*dests->addrs));
+    dests->headers = calloc(len, sizeof(*dests->headers));
+    pond_assert_alloc(dests->addrs);
+    pond_assert_alloc(dests->headers);
+
+    struct addrinfo hints = {0};
+    hints.ai_family = udp_family(udp);
+    hints.ai_socktype = SOCK_DGRAM;
+    if (hints.ai_family == AF_INET6) hints.ai_flags = AI_V4MAPPED;
+
+    for (size_t i = 0; i < len; ++i) {
+        const struct pond_host *host = hosts[i];
+
+        struct addrinfo *head;
+        int err = getaddrinfo(host->host, host->service, &hints, &head);
+        if (err) {
+            pond_fail("unable to resolve host '%s:%s': %s",
+                    host->host, host->service, gai_strerror(err));
+            pond_udp_dests_free(dests);
+            return NULL;
+        }
+
+        memcpy(&dests->addrs[i], head->ai_addr, head->ai_addrlen);
+        dests->headers[i].msg_hdr = (struct msghdr) {
+            .msg_name = &dests->addrs[i],
+            .msg_namelen = head->ai_addrlen,
+        };
+
+        freeaddrinfo(head);
+    }
+
+    return dests;
+}
+
+void pond_udp_dests_free(struct pond_udp_dests *dests)
+{
+    free(dests->addrs);
+    free(dests->headers);
+    free(dests->iovs);
+    free(dests);
+}
+
+size_t pond_udp_dests_len(struct pond_udp_dests *dests)
+{
+    return dests->len;
+}
+
+bool pond_udp_fanout(struct pond_udp *udp, struct pond_udp_dests *dests, const struct pond_iovec *src)
+{
+    if (src->len > dests->iovs_cap) {
+        dests->iovs_cap = src->len;
+        dests->iovs = realloc(dests->iovs, dests->iovs_cap * sizeof(*dests->iovs));
+        pond_assert_alloc(dests->iovs);
+    }
+
+    for (size_t j = 0; j < src->len; ++j) {
+        dests->iovs[j] = (struct iovec) {
+            .iov_base = src->vec[j].bin,
+            .iov_len = src->vec[j].len,
+        };
+    }
+
+    for (size_t i = 0; i < dests->len; ++i) {
+        struct msghdr *hdr = &dests->headers[i].msg_hdr;
+        hdr->msg_iov = dests->iovs;
+        hdr->msg_iovlen = src->len;
+    }
+
+    return pond_udp_msend_sys(udp, dests->headers, dests->len);
+}
+
+
+// -----------------------------------------------------------------------------
+// unix
+// -----------------------------------------------------------------------------
+
+struct pond_unix
+{
+    int fd;
+    struct pond_unix_opt opt;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+socklen_t pond_unix_addr(const char *path, struct sockaddr_storage *dst)
+{
+    struct sockaddr_un *addr = (struct sockaddr_un *) dst;
+    *addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+
+    bool abstract = path[0] == '@';
+    size_t len = strnlen(path, sizeof(addr->sun_path) + 1);
+
+    // Filesystem paths must be nul terminated while abstract names are
+    // delimited by the address length and start with a nul byte.
+    if (!abstract ? len >= sizeof(addr->sun_path) : len > sizeof(addr->sun_path)) {
+        pond_fail("unix path too long: %s", path);
+        return 0;
+    }
+
+    memcpy(addr->sun_path, path, len);
+    if (abstract) addr->sun_path[0] = '\0';
+
+    return offsetof(struct sockaddr_un, sun_path) + len + (abstract ? 0 : 1);
+}
+
+struct pond_unix *pond_unix_server(const char *path, const struct pond_unix_opt *opt)
+{
+    pond_assert(path != NULL, "path can't be nil");
+
+    struct pond_unix_opt nil_opts = {0};
+    if (!opt) opt = &nil_opts;
+
+    struct pond_unix *unix_ = calloc(1, sizeof(*unix_));
+    pond_assert_alloc(unix_);
+    unix_->opt = *opt;
+
+    unix_->addr_len = pond_unix_addr(path, &unix_->addr);
+    if (!unix_->addr_len) goto fail_addr;
+
+    unix_->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (unix_->fd == -1) {
+        pond_fail_errno("unable to create unix socket for '%s'", path);
+        goto fail_socket;
+    }
+
+    if (opt->unlink && path[0] != '@') {
+        if (unlink(path) == -1 && errno != ENOENT) {
+            pond_fail_errno("unable to unlink unix socket '%s'", path);
+            goto fail_bind;
+        }
+    }
+
+    if (bind(unix_->fd, (struct sockaddr *) &unix_->addr, unix_->addr_len) == -1) {
+        pond_fail_errno("unable to bind unix socket '%s'", path);
+        goto fail_bind;
+    }
+
+    return unix_;
+
+  fail_bind:
+    close(unix_->fd);
+  fail_socket:
+  fail_addr:
+    free(unix_);
+    return NULL;
+}
+
+void pond_unix_close(struct pond_unix *unix_)
+{
+    close(unix_->fd);
+
+    struct sockaddr_un *addr = (struct sockaddr_un *) &unix_->addr;
+    if (unix_->opt.unlink && addr->sun_path[0] != '\0')
+        (void) unlink(addr->sun_path);
+
+    free(unix_);
+}
+
+int pond_unix_fd(struct pond_unix *unix_)
+{
+    return unix_->fd;
+}
+
+bool pond_unix_mrecv(struct pond_unix *unix_, struct pond_mmsg *dst, size_t len)
+{
+    return mmsg_recv(unix_->fd, dst, len, MSG_WAITFORONE, true);
+}
+
+bool pond_unix_msend(struct pond_unix *unix_, struct pond_mmsg *src, size_t len)
+{
+    return mmsg_send(unix_->fd, src, len, true);
+}
+
+
+// -----------------------------------------------------------------------------
+// tcp
+// -----------------------------------------------------------------------------
+
+enum
+{
+    tcp_read_len = 64 * 1024,
+    tcp_iov_cap = 64,
+};
+
+struct pond_tcp_listen
+{
+    int fd;
+    struct pond_tcp_opt opt;
+};
+
+struct pond_tcp
+{
+    int fd;
+    bool eof;
+    struct pond_tcp_opt opt;
+
+    // Bytes that the kernel didn't accept on a previous write. As long as it's
+    // not empty, every new write must be queued here to preserve ordering.
+    size_t out_pos;
+    struct pond_buf out;
+};
+
+static void tcp_opt_init(struct pond_tcp_opt *dst, const struct pond_tcp_opt *src)
+{
+    *dst = src ? *src : (struct pond_tcp_opt) {0};
+    if (!dst->backlog) dst->backlog = SOMAXCONN;
+    if (!dst->read_len) dst->read_len = tcp_read_len;
+}
+
+static bool tcp_policy(int fd, enum pond_tcp_policy policy)
+{
+    switch (policy)
+    {
+    case pond_tcp_default: return true;
+    case pond_tcp_latency: return sock_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    case pond_tcp_throughput: return sock_opt(fd, IPPROTO_TCP, TCP_CORK, 1);
+    default: pond_unreachable();
+    }
+}
+
+static int tcp_socket(const struct pond_host *host, const struct pond_tcp_opt *opt, bool passive)
+{
+    struct addrinfo hints = {0};
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *head;
+    int err = getaddrinfo(host->host, host->service, &hints, &head);
+    if (err) {
+        pond_fail("unable to resolve host '%s:%s': %s", host->host, host->service, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *addr = head; addr; addr = addr->ai_next) {
+
+        int type = addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC;
+        fd = socket(addr->ai_family, type, addr->ai_protocol);
+        if (fd == -1) continue;
+
+        if (!sock_opts(fd, opt->cpu_affinity, opt->reuse_port))
+            goto fail_sockopt;
+
+        if (passive) {
+            if (!sock_opt(fd, SOL_SOCKET, SO_REUSEADDR, 1)) goto fail_sockopt;
+            if (!bind(fd, addr->ai_addr, addr->ai_addrlen) && !listen(fd, opt->backlog))
+                break;
+        }
+        else {
+            if (!tcp_policy(fd, opt->policy)) goto fail_sockopt;
+            if (!connect(fd, addr->ai_addr, addr->ai_addrlen) || errno == EINPROGRESS)
+                break;
+        }
+
+      fail_sockopt:
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(head);
+
+    if (fd != -1) return fd;
+
+    pond_fail_errno("unable to %s tcp socket for host '%s:%s'",
+            passive ? "listen on" : "connect", host->host, host->service);
+    return -1;
+}
+
+static struct pond_tcp *tcp_alloc(int fd, const struct pond_tcp_opt *opt)
+{
+    struct pond_tcp *tcp = calloc(1, sizeof(*tcp));
+    pond_assert_alloc(tcp);
+
+    tcp->fd = fd;
+    tcp->opt = *opt;
+    return tcp;
+}
+
+
+struct pond_tcp_listen *pond_tcp_listen(
+        const struct pond_host *host, const struct pond_tcp_opt *opt)
+{
+    pond_assert(host != NULL, "host can't be nil");
+
+    struct pond_tcp_opt tcp_opt;
+    tcp_opt_init(&tcp_opt, opt);
+
+    int fd = tcp_socket(host, &tcp_opt, true);
+    if (fd == -1) return NULL;
+
+    struct pond_tcp_listen *listen = calloc(1, sizeof(*listen));
+    pond_assert_alloc(listen);
+
+    listen->fd = fd;
+    listen->opt = tcp_opt;
+    return listen;
+}
+
+void pond_tcp_listen_close(struct pond_tcp_listen *listen)
+{
+    close(listen->fd);
+    free(listen);
+}
+
+int pond_tcp_listen_fd(struct pond_tcp_listen *listen)
+{
+    return listen->fd;
+}
+
+// Returns less then len only if the accept queue was drained or if an error
+// occured in which case pond_errno is set.
+size_t pond_tcp_accept(struct pond_tcp_listen *listen, struct pond_tcp **dst, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        int fd = accept4(listen->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+
+            pond_fail_errno("unable to accept tcp connection");
+            break;
+        }
+
+        if (!tcp_policy(fd, listen->opt.policy)) {
+            pond_warn_errno("unable to set policy on accepted tcp connection");
+            close(fd);
+            continue;
+        }
+
+        dst[i++] = tcp_alloc(fd, &listen->opt);
+    }
+
+    return i;
+}
+
+
+struct pond_tcp *pond_tcp_connect(const struct pond_host *host, const struct pond_tcp_opt *opt)
+{
+    pond_assert(host != NULL, "host can't be nil");
+
+    struct pond_tcp_opt tcp_opt;
+    tcp_opt_init(&tcp_opt, opt);
+
+    int fd = tcp_socket(host, &tcp_opt, false);
+    if (fd == -1) return NULL;
+
+    return tcp_alloc(fd, &tcp_opt);
+}
+
+void pond_tcp_close(struct pond_tcp *tcp)
+{
+    close(tcp->fd);
+    pond_buf_reset(&tcp->out);
+    free(tcp);
+}
+
+int pond_tcp_fd(struct pond_tcp *tcp)
+{
+    return tcp->fd;
+}
+
+bool pond_tcp_eof(struct pond_tcp *tcp)
+{
+    return tcp->eof;
+}
+
+// Indicates that the kernel's send buffer filled up and that we need to wait
+// for EPOLLOUT before calling pond_tcp_flush.
+bool pond_tcp_pending(struct pond_tcp *tcp)
+{
+    return tcp->out_pos < tcp->out.len;
+}
+
+
+bool pond_tcp_recv(struct pond_tcp *tcp, struct pond_buf *dst)
+{
+    while (true) {
+        pond_buf_reserve(dst, dst->len + tcp->opt.read_len);
+        size_t avail = dst->cap - dst->len;
+
+        ssize_t ret = read(tcp->fd, dst->d + dst->len, avail);
+        // A short read doesn't mean that the socket was drained: a FIN that
+        // arrived along with the last bytes only shows up on the next read
+        // and, with EPOLLET, won't trigger another event.
+        if (ret > 0) { dst->len += ret; continue; }
+
+        if (!ret) { tcp->eof = true; return true; }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        if (errno == EINTR) continue;
+
+        pond_fail_errno("unable to read from tcp socket");
+        return false;
+    }
+}
+
+static bool tcp_drain(struct pond_tcp *tcp)
+{
+    while (tcp->out_pos < tcp->out.len) {
+        ssize_t ret = write(tcp->fd,
+                tcp->out.d + tcp->out_pos, tcp->out.len - tcp->out_pos);
+
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                pond_fail_errno("unable to write to tcp socket");
+                return false;
+            }
+
+            // A peer that's steadily slow never lets the buffer fully drain
+            // so the unsent tail is moved to the front to keep new writes
+            // from piling up behind the sent bytes.
+            if (tcp->out_pos) {
+                tcp->out.len -= tcp->out_pos;
+                memmove(tcp->out.d, tcp->out.d + tcp->out_pos, tcp->out.len);
+                tcp->out_pos = 0;
+            }
+            return true;
+        }
+
+        tcp->out_pos += ret;
+    }
+
+    tcp->out.len = tcp->out_pos = 0;
+    return true;
+}
+
+static void tcp_queue(struct pond_tcp *tcp, const struct pond_iovec *src, size_t i, size_t off)
+{
+    for (; i < src->len; ++i, off = 0) {
+        const struct pond_iov *iov = &src->vec[i];
+        pond_buf_append(&tcp->out, iov->bin + off, iov->len - off);
+    }
+}
+
+// The payloads are handed to writev directly from the iovec and only the bytes
+// that the kernel doesn't accept are copied in the output buffer.
+bool pond_tcp_send(struct pond_tcp *tcp, const struct pond_iovec *src)
+{
+    if (pond_tcp_pending(tcp)) {
+        if (!tcp_drain(tcp)) return false;
+        if (pond_tcp_pending(tcp)) { tcp_queue(tcp, src, 0, 0); return true; }
+    }
+
+    size_t i = 0, off = 0;
+    struct iovec iov[tcp_iov_cap];
+
+    while (i < src->len) {
+        size_t n = 0, total = 0;
+        for (size_t j = i; j < src->len && n < tcp_iov_cap; ++j) {
+            const struct pond_iov *it = &src->vec[j];
+            size_t skip = j == i ? off : 0;
+            if (it->len == skip) continue;
+
+            iov[n++] = (struct iovec) { .iov_base = it->bin + skip, .iov_len = it->len - skip };
+            total += it->len - skip;
+        }
+        if (!n) break;
+
+        ssize_t ret = writev(tcp->fd, iov, n);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+
+            pond_fail_errno("unable to write to tcp socket");
+            return false;
+        }
+
+        for (size_t left = ret; left && i < src->len;) {
+            size_t avail = src->vec[i].len - off;
+            if (left < avail) { off += left; left = 0; }
+            else { left -= avail; ++i; off = 0; }
+        }
+
+        // The send buffer is full so the next writev would only yield EAGAIN.
+        if ((size_t) ret < total) break;
+    }
+
+    tcp_queue(tcp, src, i, off);
+    return true;
+}
+
+bool pond_tcp_flush(struct pond_tcp *tcp)
+{
+    if (!tcp_drain(tcp)) return false;
+    if (tcp->opt.policy != pond_tcp_throughput) return true;
+
+    // Toggling the cork pushes out any partial frame held back by the kernel.
+    if (!sock_opt(tcp->fd, IPPROTO_TCP, TCP_CORK, 0) ||
+            !sock_opt(tcp->fd, IPPROTO_TCP, TCP_CORK, 1))
+    {
+        pond_fail_errno("unable to uncork tcp socket");
+        return false;
+    }
+
     return true;
 }
@@ -20,6 +20,9 @@
 // -----------------------------------------------------------------------------
 
 struct pond_it;
+struct pond_buf;
+struct mmsghdr;
+struct pond_sim_udp;
 
 // -----------------------------------------------------------------------------
 // host
@@ -66,6 +69,7 @@ size_t pond_iov_read(const struct pond_iov *, uint8_t *dst, size_t len);
 struct pond_it pond_iov_it(struct pond_iov *);
 
 
+// len is the number of iov in use and is updated when receiving.
 struct pond_iovec
 {
     size_t len, cap;
@@ -81,17 +85,67 @@ void pond_iovec_free(struct pond_iovec *);
 // mmsg
 // -----------------------------------------------------------------------------
 
-struct pond_mmsg;
+enum
+{
+    pond_mmsg_line_len = 64,
+    pond_mmsg_page_len = 4096,
+
+    // Ancillary data space reserved for every message and exposed through the
+    // msg_control field of the header. Reset to its full length on receive and
+    // left empty on send.
+    pond_mmsg_cmsg_cap = 64,
+};
 
 pond_malloc
 struct pond_mmsg *pond_mmsg_alloc(size_t msg_cap, const size_t *iov_sizes, size_t iov_cap);
 void pond_mmsg_free(struct pond_mmsg *);
 
-size_t pond_mmsg_len(const struct pond_mmsg *);
-size_t pond_mmsg_cap(const struct pond_mmsg *);
+// Only exposed so that the accessors read on every message can be inlined and
+// is otherwise private to net.c. Headers are struct mmsghdr which starts with
+// its msghdr and are indexed by their stride so that the accessors don't
+// depend on _GNU_SOURCE.
+struct pond_mmsg
+{
+    size_t len, cap;
+    size_t iov_cap;
+
+    size_t headers_stride;
+    size_t iovecs_stride;
+    size_t data_stride;
+
+    struct mmsghdr *headers;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    uint8_t *cmsgs;
+    uint8_t *iovecs;
+    uint8_t *data;
+};
+
+inline size_t pond_mmsg_len(const struct pond_mmsg *mmsg) { return mmsg->len; }
+inline size_t pond_mmsg_cap(const struct pond_mmsg *mmsg) { return mmsg->cap; }
 
-struct msghdr *pond_mmsg_header(struct pond_mmsg *, size_t i);
-struct pond_iovec *pond_mmsg_iovec(struct pond_mmsg *, size_t i);
+// The sockets set the length on receive so this is only needed by the code
+// that fills batches by other means.
+void pond_mmsg_set_len(struct pond_mmsg *, size_t len);
+
+inline struct msghdr *pond_mmsg_header(struct pond_mmsg *mmsg, size_t i)
+{
+    return (void *) ((uint8_t *) mmsg->headers + mmsg->headers_stride * i);
+}
+
+inline struct pond_iovec *pond_mmsg_iovec(struct pond_mmsg *mmsg, size_t i)
+{
+    return (void *) (mmsg->iovecs + mmsg->iovecs_stride * i);
+}
+
+// Destination address when sending and source address when receiving. A len of
+// 0 indicates that no address is attached to the message.
+inline const struct sockaddr *pond_mmsg_addr(struct pond_mmsg *mmsg, size_t i, socklen_t *len)
+{
+    *len = pond_mmsg_header(mmsg, i)->msg_namelen;
+    return (struct sockaddr *) &mmsg->addrs[i];
+}
+void pond_mmsg_set_addr(struct pond_mmsg *, size_t i, const struct sockaddr *, socklen_t len);
 
 
 // -----------------------------------------------------------------------------
@@ -104,11 +158,178 @@ struct pond_udp_opt
 {
     bool cpu_affinity;
     bool reuse_port;
+
+    const char *mcast_if; // outgoing multicast interface name; NULL is the default route.
+    int mcast_ttl;        // 0 keeps the kernel default of 1.
+    bool mcast_no_loop;   // don't loop back multicast sent from this host.
+
+    int rcvbuf; // SO_RCVBUF in bytes; 0 keeps the kernel default.
+    int sndbuf; // SO_SNDBUF in bytes; 0 keeps the kernel default.
+
+    size_t adapt_batch_min; // smallest adaptive batch; defaults to 1.
+    uint64_t adapt_wait_max; // longest adaptive wait in nanoseconds; defaults to 1ms.
+};
+
+struct pond_udp_stats
+{
+    uint64_t recv_calls;
+    uint64_t recv_msgs;
+    uint64_t recv_empty;
+    uint64_t send_calls;
+    uint64_t send_msgs;
+
+    // Current state of pond_udp_mrecv_adapt.
+    size_t adapt_batch;
+    uint64_t adapt_wait;
+    double adapt_fill;      // moving average of the fraction of each batch filled.
+    uint64_t adapt_grow;
+    uint64_t adapt_shrink;
 };
 
 struct pond_udp *pond_udp_server(const struct pond_host *host, const struct pond_udp_opt *opt) pond_malloc;
+
+// Connected to a single peer so batches carry no per-message address: the
+// addresses of received messages are left empty and the ones of sent messages
+// are ignored. ICMP errors from the peer (ECONNREFUSED and co.) fail the next
+// send or receive with the matching errno.
+struct pond_udp *pond_udp_client(const struct pond_host *host, const struct pond_udp_opt *opt) pond_malloc;
 void pond_udp_close(struct pond_udp *);
 
+// Wraps a dgram socket that was bound or connected elsewhere, typically
+// inherited from another process, and takes ownership of the fd. The socket
+// options are left as they are on the fd and opt is only recorded along with
+// the adaptive receive settings with mcast_if reset to NULL.
+struct pond_udp *pond_udp_adopt(int fd, const struct pond_udp_opt *opt) pond_malloc;
+
+// Runs the pond_udp API on an endpoint of the in-process simulated network
+// (see sim.h) and takes ownership of it. Nothing blocks as the sim's clock only
+// moves when it's advanced: receives return whatever was delivered so far. The
+// fd is -1, multicast isn't supported and drops are the datagrams that
+// overflowed the endpoint's receive queue.
+struct pond_udp *pond_udp_sim(struct pond_sim_udp *) pond_malloc;
+
 int pond_udp_fd(struct pond_udp *);
+const struct pond_udp_opt *pond_udp_options(struct pond_udp *);
+const struct sockaddr *pond_udp_local(struct pond_udp *, socklen_t *len);
+const struct sockaddr *pond_udp_peer(struct pond_udp *, socklen_t *len);
+void pond_udp_stats(struct pond_udp *, struct pond_udp_stats *dst);
+
+// Returns and clears the pending asynchronous socket error or 0 if none.
+int pond_udp_error(struct pond_udp *);
+
+// Datagrams dropped by the kernel since the socket was opened which includes
+// both the ones rejected by a socket filter and the ones that overflowed the
+// receive buffer. The kernel counter is 32 bits wide and wraps.
+bool pond_udp_drops(struct pond_udp *, uint64_t *dst);
 bool pond_udp_mrecv(struct pond_udp *, struct pond_mmsg *dst, size_t len);
-bool pond_udp_msend(struct pond_udp *, const struct pond_mmsg *dst, size_t len);
+
+// Waits at most timeout nanoseconds for a batch where 0 never blocks and
+// UINT64_MAX blocks until at least one message is received.
+bool pond_udp_mrecv_timeout(
+        struct pond_udp *, struct pond_mmsg *dst, size_t len, uint64_t timeout);
+bool pond_udp_msend(struct pond_udp *, struct pond_mmsg *src, size_t len);
+
+// Picks the number of messages requested and how long to wait for them from
+// the recent load: the batch doubles whenever it comes back full with datagrams
+// still queued behind it and halves as the average fill drops while the wait
+// for an empty socket backs off up to adapt_wait_max when idle and collapses
+// back to polling once traffic returns. The batch is bounded by the capacity of
+// dst.
+bool pond_udp_mrecv_adapt(struct pond_udp *, struct pond_mmsg *dst);
+
+// For callers which already own their buffers and only need the batched send.
+bool pond_udp_msend_sys(struct pond_udp *, struct mmsghdr *src, size_t len);
+
+// Group membership where iface is the interface name or NULL to let the kernel
+// pick one.
+bool pond_udp_join(struct pond_udp *, const char *group, const char *iface);
+bool pond_udp_leave(struct pond_udp *, const char *group, const char *iface);
+
+
+// Destinations are resolved once so that a payload can then be sent to all of
+// them with a single sendmmsg where every message shares the same iovecs.
+struct pond_udp_dests;
+
+struct pond_udp_dests *pond_udp_dests_alloc(
+        struct pond_udp *, const struct pond_host *const *hosts, size_t len) pond_malloc;
+void pond_udp_dests_free(struct pond_udp_dests *);
+
+size_t pond_udp_dests_len(struct pond_udp_dests *);
+
+bool pond_udp_fanout(struct pond_udp *, struct pond_udp_dests *, const struct pond_iovec *src);
+
+
+// -----------------------------------------------------------------------------
+// unix
+// -----------------------------------------------------------------------------
+
+// Unix datagram sockets for peers on the same host which skip the IP stack
+// entirely. Paths starting with '@' are bound in the abstract namespace.
+
+struct pond_unix;
+
+struct pond_unix_opt
+{
+    bool unlink; // removes any stale socket file before binding.
+};
+
+struct pond_unix *pond_unix_server(const char *path, const struct pond_unix_opt *opt) pond_malloc;
+void pond_unix_close(struct pond_unix *);
+
+socklen_t pond_unix_addr(const char *path, struct sockaddr_storage *dst);
+
+int pond_unix_fd(struct pond_unix *);
+bool pond_unix_mrecv(struct pond_unix *, struct pond_mmsg *dst, size_t len);
+bool pond_unix_msend(struct pond_unix *, struct pond_mmsg *src, size_t len);
+
+
+// -----------------------------------------------------------------------------
+// tcp
+// -----------------------------------------------------------------------------
+
+// All tcp sockets are non-blocking and every read, write and accept is drained
+// until EAGAIN which means that they can be safely registered with EPOLLET.
+
+struct pond_tcp_listen;
+struct pond_tcp;
+
+enum pond_tcp_policy
+{
+    pond_tcp_default = 0,
+
+    // TCP_NODELAY: small writes are put on the wire immediately.
+    pond_tcp_latency,
+
+    // TCP_CORK: partial frames are held back until pond_tcp_flush is called.
+    pond_tcp_throughput,
+};
+
+struct pond_tcp_opt
+{
+    bool cpu_affinity;
+    bool reuse_port;
+    enum pond_tcp_policy policy;
+
+    int backlog;     // listen backlog; defaults to SOMAXCONN.
+    size_t read_len; // minimum space reserved for each read; defaults to 64k.
+};
+
+struct pond_tcp_listen *pond_tcp_listen(
+        const struct pond_host *host, const struct pond_tcp_opt *opt) pond_malloc;
+void pond_tcp_listen_close(struct pond_tcp_listen *);
+
+int pond_tcp_listen_fd(struct pond_tcp_listen *);
+size_t pond_tcp_accept(struct pond_tcp_listen *, struct pond_tcp **dst, size_t len);
+
+
+struct pond_tcp *pond_tcp_connect(
+        const struct pond_host *host, const struct pond_tcp_opt *opt) pond_malloc;
+void pond_tcp_close(struct pond_tcp *);
+
+int pond_tcp_fd(struct pond_tcp *);
+bool pond_tcp_eof(struct pond_tcp *);
+bool pond_tcp_pending(struct pond_tcp *);
+
+bool pond_tcp_recv(struct pond_tcp *, struct pond_buf *dst);
+bool pond_tcp_send(struct pond_tcp *, const struct pond_iovec *src);
+bool pond_tcp_flush(struct pond_tcp *);
@@ -0,0 +1,347 @@
+/* pace.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "pace.h"
+#include "net.h"
+#include "math.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+// -----------------------------------------------------------------------------
+// pace
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pace_sec = 1000UL * 1000 * 1000,
+
+    pace_burst = 64 * 1024,
+    pace_interval = 50 * 1000,
+    pace_msg_len = 2048,
+    pace_queue_cap = 1024,
+    pace_batch_cap = 64,
+};
+
+struct pace_dest
+{
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    bool explicit_rate;
+    bool blocked;
+    uint64_t rate;
+
+    // Can go negative to let messages larger then the burst through.
+    int64_t tokens;
+    uint64_t last;
+};
+
+struct pace_msg
+{
+    uint64_t ts;
+    size_t dest;
+    size_t len;
+    uint8_t *data;
+};
+
+struct pond_pace
+{
+    struct pond_udp *udp;
+    struct pond_pace_opt opt;
+    struct pond_pace_stats stats;
+    bool kernel;
+
+    size_t dests_len, dests_cap;
+    struct pace_dest *dests;
+
+    size_t queue_len;
+    struct pace_msg *queue;
+    uint8_t *arena;
+
+    uint64_t last_release;
+    struct mmsghdr *headers;
+    struct iovec *iovs;
+};
+
+
+static bool pace_fq(void)
+{
+    FILE *file = fopen("/proc/sys/net/core/default_qdisc", "r");
+    if (!file) return false;
+
+    char qdisc[32] = {0};
+    bool fq = fgets(qdisc, sizeof(qdisc), file) && !strcmp(qdisc, "fq\n");
+
+    fclose(file);
+    return fq;
+}
+
+static bool pace_kernel_rate(struct pond_pace *pace)
+{
+    uint64_t rate = pace->opt.rate ? pace->opt.rate : ~0ULL;
+    int fd = pond_udp_fd(pace->udp);
+    return setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) != -1;
+}
+
+struct pond_pace *pond_pace_alloc(struct pond_udp *udp, const struct pond_pace_opt *opt)
+{
+    struct pond_pace *pace = calloc(1, sizeof(*pace));
+    pond_assert_alloc(pace);
+
+    pace->udp = udp;
+    if (opt) pace->opt = *opt;
+    if (!pace->opt.burst) pace->opt.burst = pace_burst;
+    if (!pace->opt.interval) pace->opt.interval = pace_interval;
+    if (!pace->opt.msg_len) pace->opt.msg_len = pace_msg_len;
+    if (!pace->opt.queue_cap) pace->opt.queue_cap = pace_queue_cap;
+    if (!pace->opt.batch_cap) pace->opt.batch_cap = pace_batch_cap;
+
+    switch (pace->opt.mode)
+    {
+    case pond_pace_user: break;
+
+    case pond_pace_auto:
+        pace->kernel = pace_fq() && pace_kernel_rate(pace);
+        break;
+
+    case pond_pace_kernel:
+        if (!pace_kernel_rate(pace)) {
+            pond_fail_errno("unable to set SO_MAX_PACING_RATE: %lu", pace->opt.rate);
+            free(pace);
+            return NULL;
+        }
+        pace->kernel = true;
+        break;
+
+    default: pond_unreachable();
+    }
+
+    size_t queue_cap = pace->opt.queue_cap;
+    pace->queue = calloc(queue_cap, sizeof(*pace->queue));
+    pace->arena = calloc(queue_cap, pace->opt.msg_len);
+    pond_assert_alloc(pace->queue);
+    pond_assert_alloc(pace->arena);
+
+    for (size_t i = 0; i < queue_cap; ++i)
+        pace->queue[i].data = pace->arena + i * pace->opt.msg_len;
+
+    pace->headers = calloc(pace->opt.batch_cap, sizeof(*pace->headers));
+    pace->iovs = calloc(pace->opt.batch_cap, sizeof(*pace->iovs));
+    pond_assert_alloc(pace->headers);
+    pond_assert_alloc(pace->iovs);
+
+    return pace;
+}
+
+void pond_pace_free(struct pond_pace *pace)
+{
+    free(pace->dests);
+    free(pace->queue);
+    free(pace->arena);
+    free(pace->headers);
+    free(pace->iovs);
+    free(pace);
+}
+
+bool pond_pace_is_kernel(struct pond_pace *pace)
+{
+    return pace->kernel;
+}
+
+void pond_pace_stats(struct pond_pace *pace, struct pond_pace_stats *dst)
+{
+    *dst = pace->stats;
+}
+
+
+// -----------------------------------------------------------------------------
+// dest
+// -----------------------------------------------------------------------------
+
+// The kernel already paces every destination without an explicit rate.
+static uint64_t pace_dest_rate(struct pond_pace *pace, bool explicit_rate, uint64_t rate)
+{
+    if (explicit_rate) return rate;
+    return pace->kernel ? 0 : pace->opt.rate;
+}
+
+// Linear scan which is meant for a modest number of destinations.
+static size_t pace_dest(struct pond_pace *pace, const struct sockaddr *addr, socklen_t addr_len)
+{
+    for (size_t i = 0; i < pace->dests_len; ++i) {
+        struct pace_dest *dest = &pace->dests[i];
+        if (dest->addr_len == addr_len && !memcmp(&dest->addr, addr, addr_len))
+            return i;
+    }
+
+    if (pace->dests_len == pace->dests_cap) {
+        pace->dests_cap = pace->dests_cap ? pace->dests_cap * 2 : 8;
+        pace->dests = realloc(pace->dests, pace->dests_cap * sizeof(*pace->dests));
+        pond_assert_alloc(pace->dests);
+    }
+
+    struct pace_dest *dest = &pace->dests[pace->dests_len];
+    *dest = (struct pace_dest) {
+        .addr_len = addr_len,
+        .rate = pace_dest_rate(pace, false, 0),
+        .tokens = pace->opt.burst,
+    };
+    memcpy(&dest->addr, addr, addr_len);
+
+    return pace->dests_len++;
+}
+
+void pond_pace_rate(
+        struct pond_pace *pace, const struct sockaddr *addr, socklen_t addr_len, uint64_t rate)
+{
+    struct pace_dest *dest = &pace->dests[pace_dest(pace, addr, addr_len)];
+    dest->explicit_rate = true;
+    dest->rate = pace_dest_rate(pace, true, rate);
+}
+
+static void pace_refill(struct pond_pace *pace, struct pace_dest *dest, uint64_t now)
+{
+    dest->blocked = false;
+    if (!dest->rate || !dest->last) { dest->last = now; return; }
+
+    uint64_t elapsed = now - dest->last;
+    dest->last = now;
+
+    unsigned __int128 tokens = (unsigned __int128) elapsed * dest->rate / pace_sec;
+    int64_t burst = pace->opt.burst;
+    dest->tokens = tokens >= (unsigned __int128) burst ?
+        burst : pond_min(dest->tokens + (int64_t) tokens, burst);
+}
+
+
+// -----------------------------------------------------------------------------
+// send
+// -----------------------------------------------------------------------------
+
+static bool pace_flush(struct pond_pace *pace, size_t len)
+{
+    if (!pond_udp_msend_sys(pace->udp, pace->headers, len)) return false;
+
+    pace->stats.sent += len;
+    return true;
+}
+
+bool pond_pace_poll(struct pond_pace *pace, uint64_t now, uint64_t *next)
+{
+    *next = 0;
+    if (!pace->queue_len) return true;
+
+    uint64_t release = pace->last_release + pace->opt.interval;
+    if (now < release) { *next = release; return true; }
+
+    for (size_t i = 0; i < pace->dests_len; ++i)
+        pace_refill(pace, &pace->dests[i], now);
+
+    // Released messages are swapped to the back of the queue so that the
+    // arena slots they point to stay owned by the queue.
+    size_t kept = 0, batch = 0;
+    for (size_t i = 0; i < pace->queue_len; ++i) {
+        struct pace_msg *msg = &pace->queue[i];
+        struct pace_dest *dest = &pace->dests[msg->dest];
+
+        if (dest->blocked || (dest->rate && dest->tokens <= 0)) {
+            dest->blocked = true;
+
+            struct pace_msg tmp = pace->queue[kept];
+            pace->queue[kept++] = *msg;
+            *msg = tmp;
+            continue;
+        }
+
+        if (dest->rate) dest->tokens -= msg->len;
+
+        uint64_t delay = now - msg->ts;
+        pace->stats.delay_total += delay;
+        pace->stats.delay_max = pond_max(pace->stats.delay_max, delay);
+
+        pace->iovs[batch] = (struct iovec) { .iov_base = msg->data, .iov_len = msg->len };
+        pace->headers[batch].msg_hdr = (struct msghdr) {
+            .msg_name = &dest->addr,
+            .msg_namelen = dest->addr_len,
+            .msg_iov = &pace->iovs[batch],
+            .msg_iovlen = 1,
+        };
+
+        if (++batch == pace->opt.batch_cap) {
+            if (!pace_flush(pace, batch)) return false;
+            batch = 0;
+        }
+    }
+
+    if (batch && !pace_flush(pace, batch)) return false;
+
+    if (kept < pace->queue_len) pace->last_release = now;
+    pace->queue_len = kept;
+    if (!kept) return true;
+
+    pace->stats.held++;
+
+    uint64_t wait = UINT64_MAX;
+    for (size_t i = 0; i < pace->dests_len; ++i) {
+        struct pace_dest *dest = &pace->dests[i];
+        if (!dest->blocked) continue;
+
+        uint64_t deficit = 1 - dest->tokens;
+        wait = pond_min(wait, (uint64_t) ((unsigned __int128) deficit * pace_sec / dest->rate));
+    }
+
+    *next = now + pond_max(wait, (uint64_t) pace->opt.interval);
+    return true;
+}
+
+bool pond_pace_send(struct pond_pace *pace, uint64_t now, struct pond_mmsg *src, size_t len)
+{
+    len = pond_min(len, pond_mmsg_cap(src));
+
+    // Nothing to pace in user-space so leave it all to the kernel.
+    if (pace->kernel && !pace->dests_len) {
+        if (!pond_udp_msend(pace->udp, src, len)) return false;
+        pace->stats.sent += len;
+        return true;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        if (pace->queue_len == pace->opt.queue_cap) {
+            pace->stats.dropped += len - i;
+            break;
+        }
+
+        socklen_t addr_len = 0;
+        const struct sockaddr *addr = pond_mmsg_addr(src, i, &addr_len);
+
+        struct pace_msg *msg = &pace->queue[pace->queue_len];
+        *msg = (struct pace_msg) {
+            .ts = now,
+            .dest = pace_dest(pace, addr, addr_len),
+            .data = msg->data,
+        };
+
+        struct pond_iovec *iovec = pond_mmsg_iovec(src, i);
+        for (size_t j = 0; j < iovec->len; ++j) {
+            struct pond_iov *iov = &iovec->vec[j];
+            if (msg->len + iov->len > pace->opt.msg_len) {
+                pond_fail("message too large for pacer: %zu > %zu",
+                        msg->len + iov->len, pace->opt.msg_len);
+                return false;
+            }
+
+            memcpy(msg->data + msg->len, iov->bin, iov->len);
+            msg->len += iov->len;
+        }
+
+        pace->queue_len++;
+    }
+
+    uint64_t next = 0;
+    return pond_pace_poll(pace, now, &next);
+}
@@ -0,0 +1,84 @@
+/* pace.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Send pacer for pond_udp which smooths out sendmmsg bursts.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// pace
+// -----------------------------------------------------------------------------
+
+enum pond_pace_mode
+{
+    // Uses the kernel if the fq qdisc is the default qdisc.
+    pond_pace_auto = 0,
+
+    // Token buckets in user-space released in timed micro-batches.
+    pond_pace_user,
+
+    // SO_MAX_PACING_RATE which is only enforced by the fq qdisc. Destinations
+    // with an explicit rate still go through the user-space token buckets.
+    pond_pace_kernel,
+};
+
+struct pond_pace_opt
+{
+    enum pond_pace_mode mode;
+
+    uint64_t rate;       // default bytes per second for each destination; 0 is unlimited.
+    uint64_t burst;      // token bucket depth in bytes; defaults to 64k.
+    uint64_t interval;   // min nanoseconds between micro-batches; defaults to 50us.
+
+    size_t msg_len;      // max datagram length; defaults to 2k.
+    size_t queue_cap;    // max queued messages; defaults to 1024.
+    size_t batch_cap;    // max messages per sendmmsg; defaults to 64.
+};
+
+struct pond_pace_stats
+{
+    uint64_t sent;
+    uint64_t dropped;    // rejected because the queue was full.
+
+    uint64_t held;       // micro-batches where at least one message was held back.
+    uint64_t delay_total;
+    uint64_t delay_max;
+};
+
+struct pond_pace;
+
+struct pond_pace *pond_pace_alloc(struct pond_udp *, const struct pond_pace_opt *) pond_malloc;
+void pond_pace_free(struct pond_pace *);
+
+bool pond_pace_is_kernel(struct pond_pace *);
+void pond_pace_stats(struct pond_pace *, struct pond_pace_stats *dst);
+
+void pond_pace_rate(
+        struct pond_pace *, const struct sockaddr *addr, socklen_t addr_len, uint64_t rate);
+
+// Queues the messages of src and releases whatever the buckets allow. The
+// messages are copied so src can be reused immediately.
+bool pond_pace_send(struct pond_pace *, uint64_t now, struct pond_mmsg *src, size_t len);
+
+// Releases the queued messages that the buckets allow and sets next to the time
+// at which it should be called again or 0 if the queue is empty.
+bool pond_pace_poll(struct pond_pace *, uint64_t now, uint64_t *next);
@@ -0,0 +1,315 @@
+/* pack.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "pack.h"
+#include "net.h"
+#include "buf.h"
+#include "math.h"
+#include "errors.h"
+
+#include <string.h>
+
+
+// -----------------------------------------------------------------------------
+// varint
+// -----------------------------------------------------------------------------
+
+enum { pack_varint_cap = 10 };
+
+static size_t pack_varint(uint8_t *dst, uint64_t value)
+{
+    size_t i = 0;
+    for (; value >= 0x80; value >>= 7) dst[i++] = value | 0x80;
+    dst[i++] = value;
+    return i;
+}
+
+
+// -----------------------------------------------------------------------------
+// pack
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pack_mtu = 1472,
+    pack_deadline = 50 * 1000,
+    pack_batch_cap = 64,
+};
+
+struct pack_dest
+{
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    uint64_t first;
+    struct pond_bin *bin;
+};
+
+struct pack_ready
+{
+    size_t dest;
+    struct pond_bin *bin;
+};
+
+struct pond_pack
+{
+    struct pond_udp *udp;
+    struct pond_pack_opt opt;
+    struct pond_pack_stats stats;
+
+    size_t dests_len, dests_cap;
+    struct pack_dest *dests;
+
+    size_t ready_len;
+    struct pack_ready *ready;
+
+    size_t pool_len;
+    struct pond_bin **pool;
+
+    struct mmsghdr *headers;
+    struct iovec *iovs;
+};
+
+
+struct pond_pack *pond_pack_alloc(struct pond_udp *udp, const struct pond_pack_opt *opt)
+{
+    struct pond_pack *pack = calloc(1, sizeof(*pack));
+    pond_assert_alloc(pack);
+
+    pack->udp = udp;
+    if (opt) pack->opt = *opt;
+    if (!pack->opt.mtu) pack->opt.mtu = pack_mtu;
+    if (!pack->opt.deadline) pack->opt.deadline = pack_deadline;
+    if (!pack->opt.batch_cap) pack->opt.batch_cap = pack_batch_cap;
+
+    size_t cap = pack->opt.batch_cap;
+    pack->ready = calloc(cap, sizeof(*pack->ready));
+    pack->pool = calloc(cap, sizeof(*pack->pool));
+    pack->headers = calloc(cap, sizeof(*pack->headers));
+    pack->iovs = calloc(cap * 2, sizeof(*pack->iovs));
+    pond_assert_alloc(pack->ready);
+    pond_assert_alloc(pack->pool);
+    pond_assert_alloc(pack->headers);
+    pond_assert_alloc(pack->iovs);
+
+    return pack;
+}
+
+void pond_pack_free(struct pond_pack *pack)
+{
+    for (size_t i = 0; i < pack->dests_len; ++i) {
+        if (pack->dests[i].bin) pond_bin_free(pack->dests[i].bin);
+    }
+
+    for (size_t i = 0; i < pack->ready_len; ++i) pond_bin_free(pack->ready[i].bin);
+    for (size_t i = 0; i < pack->pool_len; ++i) pond_bin_free(pack->pool[i]);
+
+    free(pack->dests);
+    free(pack->ready);
+    free(pack->pool);
+    free(pack->headers);
+    free(pack->iovs);
+    free(pack);
+}
+
+void pond_pack_stats(struct pond_pack *pack, struct pond_pack_stats *dst)
+{
+    *dst = pack->stats;
+}
+
+
+// Linear scan which is meant for a modest number of destinations.
+static size_t pack_dest(struct pond_pack *pack, const struct sockaddr *addr, socklen_t addr_len)
+{
+    for (size_t i = 0; i < pack->dests_len; ++i) {
+        struct pack_dest *dest = &pack->dests[i];
+        if (dest->addr_len == addr_len && !memcmp(&dest->addr, addr, addr_len))
+            return i;
+    }
+
+    if (pack->dests_len == pack->dests_cap) {
+        pack->dests_cap = pack->dests_cap ? pack->dests_cap * 2 : 8;
+        pack->dests = realloc(pack->dests, pack->dests_cap * sizeof(*pack->dests));
+        pond_assert_alloc(pack->dests);
+    }
+
+    struct pack_dest *dest = &pack->dests[pack->dests_len];
+    *dest = (struct pack_dest) { .addr_len = addr_len };
+    memcpy(&dest->addr, addr, addr_len);
+
+    return pack->dests_len++;
+}
+
+static struct pond_bin *pack_bin(struct pond_pack *pack)
+{
+    if (pack->pool_len) return pack->pool[--pack->pool_len];
+    return pond_bin_alloc(pack->opt.mtu);
+}
+
+static void pack_header(
+        struct pond_pack *pack, size_t i, struct pack_dest *dest, size_t iovs)
+{
+    pack->headers[i].msg_hdr = (struct msghdr) {
+        .msg_name = &dest->addr,
+        .msg_namelen = dest->addr_len,
+        .msg_iov = &pack->iovs[i * 2],
+        .msg_iovlen = iovs,
+    };
+}
+
+static bool pack_send(struct pond_pack *pack)
+{
+    if (!pack->ready_len) return true;
+
+    for (size_t i = 0; i < pack->ready_len; ++i) {
+        struct pack_ready *ready = &pack->ready[i];
+        pack->iovs[i * 2] = (struct iovec) { .iov_base = ready->bin->d, .iov_len = ready->bin->len };
+        pack_header(pack, i, &pack->dests[ready->dest], 1);
+    }
+
+    bool ok = pond_udp_msend_sys(pack->udp, pack->headers, pack->ready_len);
+    if (ok) pack->stats.datagrams += pack->ready_len;
+
+    for (size_t i = 0; i < pack->ready_len; ++i) {
+        struct pond_bin *bin = pack->ready[i].bin;
+        bin->len = 0;
+
+        if (pack->pool_len < pack->opt.batch_cap) pack->pool[pack->pool_len++] = bin;
+        else pond_bin_free(bin);
+    }
+
+    pack->ready_len = 0;
+    return ok;
+}
+
+static bool pack_ready(struct pond_pack *pack, size_t dest)
+{
+    struct pond_bin *bin = pack->dests[dest].bin;
+    pack->dests[dest].bin = NULL;
+
+    pack->ready[pack->ready_len++] = (struct pack_ready) { .dest = dest, .bin = bin };
+    return pack->ready_len < pack->opt.batch_cap || pack_send(pack);
+}
+
+// Oversized messages are sent on their own without a copy once everything
+// queued for the destination has been sent to preserve ordering.
+static bool pack_oversized(
+        struct pond_pack *pack, size_t dest,
+        const uint8_t *prefix, size_t prefix_len,
+        const uint8_t *data, size_t len)
+{
+    pack->stats.oversized++;
+
+    if (pack->dests[dest].bin && !pack_ready(pack, dest)) return false;
+    if (!pack_send(pack)) return false;
+
+    pack->iovs[0] = (struct iovec) { .iov_base = (void *) prefix, .iov_len = prefix_len };
+    pack->iovs[1] = (struct iovec) { .iov_base = (void *) data, .iov_len = len };
+    pack_header(pack, 0, &pack->dests[dest], 2);
+
+    if (!pond_udp_msend_sys(pack->udp, pack->headers, 1)) return false;
+
+    pack->stats.msgs++;
+    pack->stats.datagrams++;
+    return true;
+}
+
+bool pond_pack_push(
+        struct pond_pack *pack, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const uint8_t *data, size_t len)
+{
+    uint8_t prefix[pack_varint_cap];
+    size_t prefix_len = pack_varint(prefix, len);
+
+    size_t index = pack_dest(pack, addr, addr_len);
+    if (prefix_len + len > pack->opt.mtu)
+        return pack_oversized(pack, index, prefix, prefix_len, data, len);
+
+    struct pack_dest *dest = &pack->dests[index];
+    if (dest->bin && dest->bin->len + prefix_len + len > pack->opt.mtu) {
+        pack->stats.flush_size++;
+        if (!pack_ready(pack, index)) return false;
+    }
+
+    if (!dest->bin) {
+        dest->bin = pack_bin(pack);
+        dest->first = now;
+    }
+
+    pond_bin_append(dest->bin, prefix, prefix_len);
+    pond_bin_append(dest->bin, data, len);
+
+    pack->stats.msgs++;
+    return true;
+}
+
+bool pond_pack_poll(struct pond_pack *pack, uint64_t now, uint64_t *next)
+{
+    *next = 0;
+
+    for (size_t i = 0; i < pack->dests_len; ++i) {
+        struct pack_dest *dest = &pack->dests[i];
+        if (!dest->bin) continue;
+
+        uint64_t deadline = dest->first + pack->opt.deadline;
+        if (deadline > now) {
+            *next = *next ? pond_min(*next, deadline) : deadline;
+            continue;
+        }
+
+        pack->stats.flush_deadline++;
+        if (!pack_ready(pack, i)) return false;
+    }
+
+    return pack_send(pack);
+}
+
+bool pond_pack_flush(struct pond_pack *pack)
+{
+    for (size_t i = 0; i < pack->dests_len; ++i) {
+        if (!pack->dests[i].bin) continue;
+
+        pack->stats.flush_explicit++;
+        if (!pack_ready(pack, i)) return false;
+    }
+
+    return pack_send(pack);
+}
+
+
+// -----------------------------------------------------------------------------
+// unpack
+// -----------------------------------------------------------------------------
+
+bool pond_unpack(struct pond_it *it, const uint8_t **data, size_t *len)
+{
+    if (pond_it_end(*it)) return false;
+
+    uint64_t value = 0;
+    for (size_t shift = 0;; shift += 7) {
+        if (it->it == it->end || shift >= 64) {
+            pond_fail("malformed packed message length");
+            it->it = it->end;
+            return false;
+        }
+
+        uint8_t byte = *it->it++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+
+    if (value > (size_t) (it->end - it->it)) {
+        pond_fail("truncated packed message: %lu > %zu",
+                value, (size_t) (it->end - it->it));
+        it->it = it->end;
+        return false;
+    }
+
+    *data = it->it;
+    *len = value;
+    it->it += value;
+    return true;
+}
@@ -0,0 +1,76 @@
+/* pack.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Coalesces small application messages into MTU sized datagrams.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_it;
+struct pond_udp;
+
+
+// -----------------------------------------------------------------------------
+// pack
+// -----------------------------------------------------------------------------
+
+// Each message is prefixed by its length encoded as a LEB128 varint which is a
+// single byte for messages under 128 bytes.
+
+struct pond_pack_opt
+{
+    size_t mtu;         // max datagram payload; defaults to 1472.
+    uint64_t deadline;  // max nanoseconds a message can wait; defaults to 50us.
+    size_t batch_cap;   // max datagrams per sendmmsg; defaults to 64.
+};
+
+struct pond_pack_stats
+{
+    uint64_t msgs;
+    uint64_t datagrams;
+
+    uint64_t flush_size;
+    uint64_t flush_deadline;
+    uint64_t flush_explicit;
+    uint64_t oversized;  // messages too large to be packed and sent on their own.
+};
+
+struct pond_pack;
+
+struct pond_pack *pond_pack_alloc(struct pond_udp *, const struct pond_pack_opt *) pond_malloc;
+void pond_pack_free(struct pond_pack *);
+
+void pond_pack_stats(struct pond_pack *, struct pond_pack_stats *dst);
+
+bool pond_pack_push(
+        struct pond_pack *, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const uint8_t *data, size_t len);
+
+// Sends every datagram whose deadline is before now and sets next to the
+// earliest pending deadline or 0 if nothing is pending.
+bool pond_pack_poll(struct pond_pack *, uint64_t now, uint64_t *next);
+bool pond_pack_flush(struct pond_pack *);
+
+
+// -----------------------------------------------------------------------------
+// unpack
+// -----------------------------------------------------------------------------
+
+// Pops the next message of a packed datagram. Returns false once the datagram
+// is exhausted or if it's malformed in which case pond_errno is set.
+bool pond_unpack(struct pond_it *it, const uint8_t **data, size_t *len);
@@ -0,0 +1,497 @@
+/* pcap.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "pcap.h"
+#include "net.h"
+#include "math.h"
+#include "process.h"
+#include "errors.h"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+
+// -----------------------------------------------------------------------------
+// format
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pcap_magic_usec = 0xa1b2c3d4,
+    pcap_magic_nsec = 0xa1b23c4d,
+
+    pcap_link_ether = 1,
+    pcap_link_raw = 101,
+
+    pcap_ether_len = 14,
+};
+
+struct pond_packed pcap_file_header
+{
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t zone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t link;
+};
+
+struct pond_packed pcap_record_header
+{
+    uint32_t sec, frac;
+    uint32_t incl_len, orig_len;
+};
+
+
+// -----------------------------------------------------------------------------
+// capture
+// -----------------------------------------------------------------------------
+
+enum
+{
+    pcap_cap = 1UL << 30,
+    pcap_snaplen = 64 * 1024,
+};
+
+struct pond_pcap
+{
+    int fd;
+    struct pond_pcap_opt opt;
+    struct pond_pcap_stats stats;
+
+    size_t len;
+    uint8_t *data;
+};
+
+struct pond_pcap *pond_pcap_open(const char *path, const struct pond_pcap_opt *opt)
+{
+    struct pond_pcap *pcap = calloc(1, sizeof(*pcap));
+    pond_assert_alloc(pcap);
+
+    if (opt) pcap->opt = *opt;
+    if (!pcap->opt.cap) pcap->opt.cap = pcap_cap;
+    if (!pcap->opt.snaplen) pcap->opt.snaplen = pcap_snaplen;
+
+    pcap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pcap->fd == -1) {
+        pond_fail_errno("unable to open pcap file '%s'", path);
+        goto fail_open;
+    }
+
+    if (ftruncate(pcap->fd, pcap->opt.cap) == -1) {
+        pond_fail_errno("unable to size pcap file '%s' to %zu", path, pcap->opt.cap);
+        goto fail_truncate;
+    }
+
+    int flags = MAP_SHARED | (pcap->opt.populate ? MAP_POPULATE : 0);
+    pcap->data = mmap(NULL, pcap->opt.cap, PROT_READ | PROT_WRITE, flags, pcap->fd, 0);
+    if (pcap->data == MAP_FAILED) {
+        pond_fail_errno("unable to mmap pcap file '%s'", path);
+        goto fail_mmap;
+    }
+
+    struct pcap_file_header header = {
+        .magic = pcap_magic_nsec,
+        .major = 2,
+        .minor = 4,
+        .snaplen = pcap->opt.snaplen,
+        .link = pcap_link_raw,
+    };
+    memcpy(pcap->data, &header, sizeof(header));
+    pcap->len = sizeof(header);
+
+    return pcap;
+
+  fail_mmap:
+  fail_truncate:
+    close(pcap->fd);
+  fail_open:
+    free(pcap);
+    return NULL;
+}
+
+// Trims the file down to what was actually written.
+bool pond_pcap_close(struct pond_pcap *pcap)
+{
+    bool ok = true;
+
+    if (munmap(pcap->data, pcap->opt.cap) == -1) {
+        pond_fail_errno("unable to munmap pcap file");
+        ok = false;
+    }
+
+    if (ok && ftruncate(pcap->fd, pcap->len) == -1) {
+        pond_fail_errno("unable to truncate pcap file to %zu", pcap->len);
+        ok = false;
+    }
+
+    close(pcap->fd);
+    free(pcap);
+    return ok;
+}
+
+void pond_pcap_stats(struct pond_pcap *pcap, struct pond_pcap_stats *dst)
+{
+    *dst = pcap->stats;
+}
+
+
+static uint16_t pcap_ip_csum(const void *data, size_t len)
+{
+    uint32_t sum = 0;
+    const uint8_t *it = data;
+    for (size_t i = 0; i + 1 < len; i += 2) sum += (it[i] << 8) | it[i + 1];
+
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return htons(~sum);
+}
+
+static uint16_t pcap_port(const struct sockaddr *addr)
+{
+    switch (addr->sa_family)
+    {
+    case AF_INET: return ((const struct sockaddr_in *) addr)->sin_port;
+    case AF_INET6: return ((const struct sockaddr_in6 *) addr)->sin6_port;
+    default: return 0;
+    }
+}
+
+// Non-IP sources are recorded as IPv4 with unspecified addresses.
+static size_t pcap_ip(
+        uint8_t *dst, size_t len,
+        const struct sockaddr *src, socklen_t src_len,
+        const struct sockaddr *local, socklen_t local_len)
+{
+    bool same = local_len && local->sa_family == src->sa_family;
+
+    if (src_len && src->sa_family == AF_INET6) {
+        struct ip6_hdr ip = {0};
+        ip.ip6_flow = htonl(6 << 28);
+        ip.ip6_plen = htons(len + sizeof(struct udphdr));
+        ip.ip6_nxt = IPPROTO_UDP;
+        ip.ip6_hlim = 64;
+        ip.ip6_src = ((const struct sockaddr_in6 *) src)->sin6_addr;
+        if (same) ip.ip6_dst = ((const struct sockaddr_in6 *) local)->sin6_addr;
+
+        memcpy(dst, &ip, sizeof(ip));
+        return sizeof(ip);
+    }
+
+    struct iphdr ip = {0};
+    ip.version = 4;
+    ip.ihl = sizeof(ip) / 4;
+    ip.tot_len = htons(pond_min(len + sizeof(ip) + sizeof(struct udphdr), (size_t) UINT16_MAX));
+    ip.ttl = 64;
+    ip.protocol = IPPROTO_UDP;
+    if (src_len && src->sa_family == AF_INET)
+        ip.saddr = ((const struct sockaddr_in *) src)->sin_addr.s_addr;
+    if (same && local->sa_family == AF_INET)
+        ip.daddr = ((const struct sockaddr_in *) local)->sin_addr.s_addr;
+    ip.check = pcap_ip_csum(&ip, sizeof(ip));
+
+    memcpy(dst, &ip, sizeof(ip));
+    return sizeof(ip);
+}
+
+void pond_pcap_record(
+        struct pond_pcap *pcap, struct pond_mmsg *src,
+        const struct sockaddr *local, socklen_t local_len)
+{
+    struct timespec ts = {0};
+    (void) clock_gettime(CLOCK_REALTIME, &ts);
+
+    enum { headers_cap = sizeof(struct ip6_hdr) + sizeof(struct udphdr) };
+
+    for (size_t i = 0; i < pond_mmsg_len(src); ++i) {
+        struct pond_iovec *iovec = pond_mmsg_iovec(src, i);
+
+        size_t len = 0;
+        for (size_t j = 0; j < iovec->len; ++j) len += iovec->vec[j].len;
+        size_t incl = pond_min(len, (size_t) pcap->opt.snaplen);
+
+        size_t max = sizeof(struct pcap_record_header) + headers_cap + incl;
+        if (pond_unlikely(pcap->len + max > pcap->opt.cap)) {
+            pcap->stats.dropped += pond_mmsg_len(src) - i;
+            return;
+        }
+
+        socklen_t addr_len = 0;
+        const struct sockaddr *addr = pond_mmsg_addr(src, i, &addr_len);
+
+        uint8_t *record = pcap->data + pcap->len;
+        uint8_t *it = record + sizeof(struct pcap_record_header);
+
+        it += pcap_ip(it, len, addr, addr_len, local, local_len);
+
+        struct udphdr udp = {
+            .source = addr_len ? pcap_port(addr) : 0,
+            .dest = local_len ? pcap_port(local) : 0,
+            .len = htons(pond_min(len + sizeof(udp), (size_t) UINT16_MAX)),
+        };
+        memcpy(it, &udp, sizeof(udp));
+        it += sizeof(udp);
+
+        size_t headers_len = it - record - sizeof(struct pcap_record_header);
+
+        for (size_t j = 0, left = incl; j < iovec->len && left; ++j) {
+            size_t n = pond_min(left, iovec->vec[j].len);
+            memcpy(it, iovec->vec[j].bin, n);
+            it += n;
+            left -= n;
+        }
+
+        struct pcap_record_header header = {
+            .sec = ts.tv_sec,
+            .frac = ts.tv_nsec,
+            .incl_len = headers_len + incl,
+            .orig_len = headers_len + len,
+        };
+        memcpy(record, &header, sizeof(header));
+
+        pcap->len = it - pcap->data;
+        pcap->stats.records++;
+        pcap->stats.bytes += len;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// replay
+// -----------------------------------------------------------------------------
+
+enum { replay_slack = 100 * 1000 };
+
+struct pond_replay
+{
+    struct pond_replay_stats stats;
+
+    uint32_t link;
+    uint64_t frac_ns;
+
+    size_t len;
+    const uint8_t *data;
+};
+
+struct pond_replay *pond_replay_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        pond_fail_errno("unable to open pcap file '%s'", path);
+        return NULL;
+    }
+
+    struct stat stat = {0};
+    if (fstat(fd, &stat) == -1) {
+        pond_fail_errno("unable to stat pcap file '%s'", path);
+        close(fd);
+        return NULL;
+    }
+
+    if ((size_t) stat.st_size < sizeof(struct pcap_file_header)) {
+        pond_fail("pcap file '%s' too small: %zu", path, (size_t) stat.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        pond_fail_errno("unable to mmap pcap file '%s'", path);
+        return NULL;
+    }
+
+    struct pcap_file_header header;
+    memcpy(&header, data, sizeof(header));
+
+    uint64_t frac_ns = 0;
+    if (header.magic == pcap_magic_nsec) frac_ns = 1;
+    else if (header.magic == pcap_magic_usec) frac_ns = 1000;
+    else {
+        pond_fail("unsupported pcap magic in '%s': %x", path, header.magic);
+        goto fail;
+    }
+
+    if (header.link != pcap_link_raw && header.link != pcap_link_ether) {
+        pond_fail("unsupported pcap link type in '%s': %u", path, header.link);
+        goto fail;
+    }
+
+    struct pond_replay *replay = calloc(1, sizeof(*replay));
+    pond_assert_alloc(replay);
+
+    replay->link = header.link;
+    replay->frac_ns = frac_ns;
+    replay->len = stat.st_size;
+    replay->data = data;
+    return replay;
+
+  fail:
+    munmap(data, stat.st_size);
+    return NULL;
+}
+
+void pond_replay_close(struct pond_replay *replay)
+{
+    munmap((void *) replay->data, replay->len);
+    free(replay);
+}
+
+void pond_replay_stats(struct pond_replay *replay, struct pond_replay_stats *dst)
+{
+    *dst = replay->stats;
+}
+
+
+// Returns the UDP payload of a record or false if it's not a UDP datagram.
+static bool replay_payload(
+        struct pond_replay *replay, const uint8_t *it, size_t len,
+        const uint8_t **payload, size_t *payload_len)
+{
+    if (replay->link == pcap_link_ether) {
+        if (len < pcap_ether_len) return false;
+
+        uint16_t type = (it[12] << 8) | it[13];
+        if (type != 0x0800 && type != 0x86DD) return false;
+
+        it += pcap_ether_len;
+        len -= pcap_ether_len;
+    }
+
+    if (!len) return false;
+
+    size_t ip_len = 0;
+    switch (it[0] >> 4)
+    {
+    case 4:
+        ip_len = (it[0] & 0xF) * 4;
+        if (ip_len < sizeof(struct iphdr)) return false;
+        if (len < ip_len || it[9] != IPPROTO_UDP) return false;
+        break;
+
+    case 6:
+        ip_len = sizeof(struct ip6_hdr);
+        if (len < ip_len || it[6] != IPPROTO_UDP) return false;
+        break;
+
+    default: return false;
+    }
+
+    it += ip_len;
+    len -= ip_len;
+    if (len < sizeof(struct udphdr)) return false;
+
+    struct udphdr udp;
+    memcpy(&udp, it, sizeof(udp));
+    size_t udp_len = ntohs(udp.len);
+    if (udp_len < sizeof(udp)) return false;
+
+    *payload = it + sizeof(udp);
+    *payload_len = pond_min(udp_len, len) - sizeof(udp);
+    return true;
+}
+
+static void replay_fill(struct pond_iovec *iovec, const uint8_t *data, size_t len)
+{
+    iovec->len = 0;
+    for (size_t j = 0; j < iovec->cap && len; ++j) {
+        size_t n = pond_iov_write(&iovec->vec[j], data, len);
+        data += n;
+        len -= n;
+        iovec->len = j + 1;
+    }
+}
+
+static void replay_sleep(uint64_t until)
+{
+    struct timespec ts = {
+        .tv_sec = until / (1000UL * 1000 * 1000),
+        .tv_nsec = until % (1000UL * 1000 * 1000),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static bool replay_flush(
+        struct pond_replay *replay, struct pond_udp *dst, struct pond_mmsg *msg,
+        size_t len, bool late)
+{
+    if (!pond_udp_msend(dst, msg, len)) return false;
+
+    replay->stats.sent += len;
+    replay->stats.batches++;
+    replay->stats.late += late;
+    return true;
+}
+
+bool pond_replay_run(
+        struct pond_replay *replay, double speed,
+        struct pond_udp *dst, struct pond_mmsg *msg,
+        const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t cap = pond_mmsg_cap(msg);
+    size_t len = 0;
+    bool late = false;
+
+    uint64_t start = pond_now();
+    uint64_t first = UINT64_MAX;
+
+    const uint8_t *it = replay->data + sizeof(struct pcap_file_header);
+    const uint8_t *end = replay->data + replay->len;
+
+    while (it + sizeof(struct pcap_record_header) <= end) {
+        struct pcap_record_header header;
+        memcpy(&header, it, sizeof(header));
+        it += sizeof(header);
+
+        if (it + header.incl_len > end) break;
+        const uint8_t *record = it;
+        it += header.incl_len;
+
+        const uint8_t *payload = NULL;
+        size_t payload_len = 0;
+        if (!replay_payload(replay, record, header.incl_len, &payload, &payload_len)) {
+            replay->stats.skipped++;
+            continue;
+        }
+
+        if (speed > 0) {
+            uint64_t ts = header.sec * 1000UL * 1000 * 1000 + header.frac * replay->frac_ns;
+            if (first == UINT64_MAX) first = ts;
+
+            // Capture stamps come from CLOCK_REALTIME which can step backwards
+            // so records older than the first one are due immediately.
+            uint64_t elapsed = ts < first ? 0 : ts - first;
+            uint64_t due = start + (uint64_t) (elapsed / speed);
+            uint64_t now = pond_now();
+
+            if (due > now) {
+                if (len && !replay_flush(replay, dst, msg, len, late)) return false;
+                len = 0; late = false;
+                replay_sleep(due);
+            }
+            else if (now - due > replay_slack) late = true;
+        }
+
+        replay_fill(pond_mmsg_iovec(msg, len), payload, payload_len);
+        pond_mmsg_set_addr(msg, len, addr, addr_len);
+
+        if (++len == cap) {
+            if (!replay_flush(replay, dst, msg, len, late)) return false;
+            len = 0; late = false;
+        }
+    }
+
+    return !len || replay_flush(replay, dst, msg, len, late);
+}
@@ -0,0 +1,88 @@
+/* pcap.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Captures received batches to a memory-mapped pcap file and replays them.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// capture
+// -----------------------------------------------------------------------------
+
+// Datagrams are written with synthesized IP and UDP headers using the raw IP
+// link type and nanosecond timestamps so that the file can be opened as is by
+// the usual tools.
+
+struct pond_pcap_opt
+{
+    size_t cap;         // max file size; defaults to 1G.
+    uint32_t snaplen;   // max bytes of payload per datagram; defaults to 64k.
+    bool populate;      // pre-faults the whole mapping on open.
+};
+
+struct pond_pcap_stats
+{
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t dropped;   // records that didn't fit in the file.
+};
+
+struct pond_pcap;
+
+struct pond_pcap *pond_pcap_open(const char *path, const struct pond_pcap_opt *) pond_malloc;
+bool pond_pcap_close(struct pond_pcap *);
+
+void pond_pcap_stats(struct pond_pcap *, struct pond_pcap_stats *dst);
+
+// Records every message of src using one clock read for the whole batch. local
+// is the address of the receiving socket and is used as the destination.
+void pond_pcap_record(
+        struct pond_pcap *, struct pond_mmsg *src,
+        const struct sockaddr *local, socklen_t local_len);
+
+
+// -----------------------------------------------------------------------------
+// replay
+// -----------------------------------------------------------------------------
+
+struct pond_replay_stats
+{
+    uint64_t sent;
+    uint64_t batches;
+    uint64_t skipped;   // records that weren't UDP datagrams.
+    uint64_t late;      // batches sent after their scheduled time.
+};
+
+struct pond_replay;
+
+struct pond_replay *pond_replay_open(const char *path) pond_malloc;
+void pond_replay_close(struct pond_replay *);
+
+void pond_replay_stats(struct pond_replay *, struct pond_replay_stats *dst);
+
+// Sends every captured payload to addr using msg as scratch. A speed of 1
+// preserves the original timing, N replays N times faster and 0 sends as fast
+// as possible.
+bool pond_replay_run(
+        struct pond_replay *, double speed,
+        struct pond_udp *dst, struct pond_mmsg *msg,
+        const struct sockaddr *addr, socklen_t addr_len);
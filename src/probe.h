@@ -0,0 +1,36 @@
+/* probe.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   USDT static tracepoints usable from bpftrace or perf under the pond provider.
+*/
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+// probe
+// -----------------------------------------------------------------------------
+
+// A disabled probe is a single nop in the instruction stream along with a note
+// describing where to find its arguments so it costs nothing until attached.
+// Falls back to no-ops if sys/sdt.h (systemtap-sdt-dev) isn't installed.
+
+#if defined(__has_include) && __has_include(<sys/sdt.h>)
+
+# include <sys/sdt.h>
+
+# define pond_probe0(name)                DTRACE_PROBE(pond, name)
+# define pond_probe1(name, a)             DTRACE_PROBE1(pond, name, a)
+# define pond_probe2(name, a, b)          DTRACE_PROBE2(pond, name, a, b)
+# define pond_probe3(name, a, b, c)       DTRACE_PROBE3(pond, name, a, b, c)
+# define pond_probe4(name, a, b, c, d)    DTRACE_PROBE4(pond, name, a, b, c, d)
+
+#else
+
+# define pond_probe0(name)                do {} while (0)
+# define pond_probe1(name, a)             do { (void) (a); } while (0)
+# define pond_probe2(name, a, b)          do { (void) (a); (void) (b); } while (0)
+# define pond_probe3(name, a, b, c)       do { (void) (a); (void) (b); (void) (c); } while (0)
+# define pond_probe4(name, a, b, c, d)    do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+
+#endif
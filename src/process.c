@@ -6,9 +6,19 @@
 #include "process.h"
 #include "errors.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdatomic.h>
 #include <sched.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+# include <cpuid.h>
+# include <x86intrin.h>
+#endif
 
 // -----------------------------------------------------------------------------
 // utils
@@ -43,3 +53,276 @@ size_t pond_cpu(void)
     pond_fail_errno("unable to call getcpu to get current cpu");
     pond_abort();
 }
+
+bool pond_pin(size_t cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (!err) return true;
+
+    pond_fail_ierrno(err, "unable to pin thread to cpu '%zu'", cpu);
+    return false;
+}
+
+
+// -----------------------------------------------------------------------------
+// time
+// -----------------------------------------------------------------------------
+
+uint64_t pond_now(void)
+{
+    struct timespec ts = {0};
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return ts.tv_sec * 1000UL * 1000 * 1000 + ts.tv_nsec;
+
+    pond_fail_errno("unable to call clock_gettime to get monotonic time");
+    pond_abort();
+}
+
+
+// -----------------------------------------------------------------------------
+// clock
+// -----------------------------------------------------------------------------
+
+enum
+{
+    clock_shift = 32,
+    clock_samples = 8,
+
+    clock_warmup = 2UL * 1000 * 1000,
+    clock_period = 1000UL * 1000 * 1000,
+
+    // Largest disagreement with pond_now that is slewed away at each
+    // calibration on top of 1000ppm of the elapsed time. Anything beyond means
+    // that the TSC can't be trusted.
+    clock_tolerance = 1000UL * 1000,
+};
+
+// Published through a seqlock: the writer makes seq odd while it updates the
+// fields and readers retry if seq changed or was odd while they read them.
+struct clock_state
+{
+    atomic_uint_fast64_t seq;
+    atomic_uint_fast64_t tsc;
+    atomic_uint_fast64_t ns;
+    atomic_uint_fast64_t mult; // nanoseconds per cycle << clock_shift.
+    atomic_uint_fast64_t next; // tsc of the next calibration.
+};
+
+static struct clock_state clock_state;
+static atomic_bool clock_tsc = false;
+static atomic_uint_fast64_t clock_floor = 0;
+static atomic_flag clock_lock = ATOMIC_FLAG_INIT;
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+
+// First calibration point which is only touched by the calibrating thread and
+// gives the rate an ever longer baseline to be measured over.
+static uint64_t clock_origin_tsc, clock_origin_ns;
+
+static uint64_t clock_scale(uint64_t cycles, uint64_t mult)
+{
+    return ((unsigned __int128) cycles * mult) >> clock_shift;
+}
+
+static uint64_t clock_cycles(uint64_t ns, uint64_t mult)
+{
+    return ((unsigned __int128) ns << clock_shift) / mult;
+}
+
+static void clock_publish(uint64_t tsc, uint64_t ns, uint64_t mult)
+{
+    uint64_t seq = atomic_load_explicit(&clock_state.seq, memory_order_relaxed);
+    atomic_store_explicit(&clock_state.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&clock_state.tsc, tsc, memory_order_relaxed);
+    atomic_store_explicit(&clock_state.ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&clock_state.mult, mult, memory_order_relaxed);
+    atomic_store_explicit(&clock_state.next, tsc + clock_cycles(clock_period, mult), memory_order_relaxed);
+
+    atomic_store_explicit(&clock_state.seq, seq + 2, memory_order_release);
+}
+
+#if defined(__x86_64__)
+
+// The kernel demotes the TSC as its clocksource as soon as its watchdog sees it
+// drift or jump between cores so this covers more than the cpuid bit does. If
+// sysfs isn't available we have to take the cpu's word for it.
+static bool clock_reliable(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) return false;
+    if (!(edx & (1U << 27))) return false; // rdtscp
+
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    if (!(edx & (1U << 8))) return false; // invariant tsc
+
+    int fd = open("/sys/devices/system/clocksource/clocksource0/current_clocksource", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return true;
+
+    char buf[32] = {0};
+    ssize_t ret = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    return ret <= 0 || !strcmp(buf, "tsc\n");
+}
+
+// Brackets rdtscp between two reads of pond_now and keeps the tightest pair
+// out of a few attempts to filter out preemptions and vdso slow paths.
+static void clock_sample(uint64_t *tsc, uint64_t *ns)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (size_t i = 0; i < clock_samples; ++i) {
+        unsigned aux;
+        uint64_t start = pond_now();
+        uint64_t cycles = __rdtscp(&aux);
+        uint64_t end = pond_now();
+
+        if (end - start >= best) continue;
+        best = end - start;
+        *tsc = cycles;
+        *ns = start + best / 2;
+    }
+}
+
+static uint64_t clock_read(void)
+{
+    return __rdtsc();
+}
+
+#else
+
+static bool clock_reliable(void) { return false; }
+static void clock_sample(uint64_t *tsc, uint64_t *ns) { *tsc = *ns = 0; }
+static uint64_t clock_read(void) { return 0; }
+
+#endif
+
+static bool clock_mult(uint64_t cycles, uint64_t ns, uint64_t *mult)
+{
+    if (!cycles) return false;
+
+    // Keeps the frequency between 10MHz and 100GHz which is mostly meant to
+    // catch a TSC that doesn't tick.
+    *mult = ((unsigned __int128) ns << clock_shift) / cycles;
+    return *mult > (1ULL << clock_shift) / 100 && *mult < (1ULL << clock_shift) * 100;
+}
+
+static void clock_init(void)
+{
+    if (!clock_reliable()) return;
+
+    uint64_t tsc, ns;
+    clock_sample(&clock_origin_tsc, &clock_origin_ns);
+    do { clock_sample(&tsc, &ns); } while (ns - clock_origin_ns < clock_warmup);
+
+    uint64_t mult = 0;
+    if (tsc <= clock_origin_tsc) return;
+    if (!clock_mult(tsc - clock_origin_tsc, ns - clock_origin_ns, &mult)) return;
+
+    clock_publish(tsc, ns, mult);
+    atomic_store_explicit(&clock_tsc, true, memory_order_release);
+}
+
+// Readers may have returned TSC values up to floor which can be ahead of
+// pond_now by as much as the error that made the calibration fail so the
+// fallback holds at the floor until pond_now catches up.
+static void clock_fallback(uint64_t floor)
+{
+    atomic_store_explicit(&clock_floor, floor, memory_order_relaxed);
+    atomic_store_explicit(&clock_tsc, false, memory_order_release);
+}
+
+// The rate is re-measured over the whole baseline since the origin and then
+// nudged so that the error accumulated since the last calibration is absorbed
+// over the next period which keeps the clock continuous instead of stepping it.
+static void clock_calibrate(uint64_t base_tsc, uint64_t base_ns, uint64_t base_mult)
+{
+    uint64_t tsc, ns;
+    clock_sample(&tsc, &ns);
+
+    // A TSC that went backwards gives no bound on what readers returned so
+    // the end of the period is the best we have.
+    if (tsc <= base_tsc) {
+        clock_fallback(base_ns + clock_period);
+        return;
+    }
+
+    uint64_t now = base_ns + clock_scale(tsc - base_tsc, base_mult);
+
+    uint64_t rate = 0;
+    if (!clock_mult(tsc - clock_origin_tsc, ns - clock_origin_ns, &rate)) {
+        clock_fallback(now);
+        return;
+    }
+
+    int64_t err = ns - now;
+
+    uint64_t tolerance = clock_tolerance + (ns - base_ns) / 1000;
+    if ((uint64_t) (err < 0 ? -err : err) > tolerance) {
+        clock_fallback(now);
+        return;
+    }
+
+    __int128 mult = rate + ((__int128) rate * err) / (int64_t) clock_period;
+    if (mult < rate / 2) mult = rate / 2;
+
+    clock_publish(tsc, now, mult);
+}
+
+void pond_clock_init(void)
+{
+    pthread_once(&clock_once, clock_init);
+}
+
+uint64_t pond_clock(void)
+{
+    pthread_once(&clock_once, clock_init);
+
+    while (atomic_load_explicit(&clock_tsc, memory_order_relaxed)) {
+        uint64_t seq = atomic_load_explicit(&clock_state.seq, memory_order_acquire);
+        if (seq & 1) continue;
+
+        uint64_t base_tsc = atomic_load_explicit(&clock_state.tsc, memory_order_relaxed);
+        uint64_t base_ns = atomic_load_explicit(&clock_state.ns, memory_order_relaxed);
+        uint64_t mult = atomic_load_explicit(&clock_state.mult, memory_order_relaxed);
+        uint64_t next = atomic_load_explicit(&clock_state.next, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&clock_state.seq, memory_order_relaxed) != seq) continue;
+
+        uint64_t tsc = clock_read();
+
+        // A single thread calibrates while the others keep using the current
+        // parameters which remain valid until the new ones are published.
+        if (tsc >= next && !atomic_flag_test_and_set_explicit(&clock_lock, memory_order_acquire)) {
+            if (atomic_load_explicit(&clock_state.seq, memory_order_relaxed) == seq)
+                clock_calibrate(base_tsc, base_ns, mult);
+            atomic_flag_clear_explicit(&clock_lock, memory_order_release);
+            continue;
+        }
+
+        // The TSC of the calling cpu can lag the one that published the base
+        // by a few cycles.
+        if (tsc < base_tsc) return base_ns;
+        return base_ns + clock_scale(tsc - base_tsc, mult);
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t now = pond_now();
+    uint64_t floor = atomic_load_explicit(&clock_floor, memory_order_relaxed);
+    return now < floor ? floor : now;
+}
+
+uint64_t pond_clock_hz(void)
+{
+    pthread_once(&clock_once, clock_init);
+    if (!atomic_load_explicit(&clock_tsc, memory_order_relaxed)) return 0;
+
+    uint64_t mult = atomic_load_explicit(&clock_state.mult, memory_order_relaxed);
+    return ((unsigned __int128) 1000UL * 1000 * 1000 << clock_shift) / mult;
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 // -----------------------------------------------------------------------------
 // utils
@@ -15,3 +17,31 @@ size_t pond_tid(void);
 size_t pond_cpus(void);
 size_t pond_cpu(void);
 
+// Pins the calling thread to the given cpu.
+bool pond_pin(size_t cpu);
+
+
+// -----------------------------------------------------------------------------
+// time
+// -----------------------------------------------------------------------------
+
+// Monotonic clock in nanoseconds.
+uint64_t pond_now(void);
+
+// Monotonic clock in nanoseconds read from the invariant TSC which is cheap
+// enough to timestamp every batch. It's calibrated against pond_now by
+// pond_clock_init, or on first use if it wasn't called, and then about once a
+// second afterwards where any drift is slewed away over the next period so the
+// clock stays continuous and tracks pond_now to within the calibration error.
+//
+// Falls back on pond_now if the TSC isn't invariant, isn't the kernel's
+// clocksource or stops agreeing with pond_now during a calibration. The
+// fallback never goes below the last TSC reading.
+uint64_t pond_clock(void);
+
+// Runs the initial calibration which spins for a couple of milliseconds and
+// is meant to be called at startup to keep it out of the first pond_clock.
+void pond_clock_init(void);
+
+// Frequency of the TSC used by pond_clock or 0 if it fell back on pond_now.
+uint64_t pond_clock_hz(void);
@@ -0,0 +1,431 @@
+/* ring.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "ring.h"
+#include "net.h"
+#include "bits.h"
+#include "math.h"
+#include "process.h"
+#include "probe.h"
+#include "errors.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+
+// -----------------------------------------------------------------------------
+// region
+// -----------------------------------------------------------------------------
+
+enum
+{
+    ring_magic = 0x676e6972, // 'ring'
+    ring_version = 1,
+
+    ring_slot_cap = 1024,
+    ring_slot_len = 2048,
+    ring_batch_cap = 64,
+};
+
+// Lives at the start of the shared region. Each index is written by a single
+// side and sits on its own cache line to avoid bouncing it on every store.
+struct ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t slot_cap;
+    uint64_t slot_len;
+    uint64_t slot_stride;
+
+    pond_align(pond_mmsg_line_len) atomic_uint_fast64_t head;
+    pond_align(pond_mmsg_line_len) atomic_uint_fast64_t tail;
+
+    pond_align(pond_mmsg_line_len) atomic_uint seq;
+    atomic_uint sleeping;
+};
+
+pond_static_assert(sizeof(struct ring_header) <= pond_mmsg_page_len);
+
+static size_t ring_stride(size_t slot_len)
+{
+    return pond_bit_align(sizeof(struct pond_ring_msg) + slot_len, pond_mmsg_line_len);
+}
+
+static size_t ring_region_len(size_t slot_cap, size_t slot_stride)
+{
+    return pond_mmsg_page_len + pond_bit_align(slot_cap * slot_stride, pond_mmsg_page_len);
+}
+
+// Futexes in a MAP_SHARED region must not use the private variants which are
+// keyed on the virtual address of the calling process.
+static long ring_futex(atomic_uint *addr, int op, unsigned val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+
+// -----------------------------------------------------------------------------
+// ring
+// -----------------------------------------------------------------------------
+
+struct pond_ring
+{
+    int fd;
+    size_t len;
+    struct ring_header *header;
+    uint8_t *slots;
+
+    // The geometry is copied out of the shared header once validated so that
+    // the other side can't rewrite it to send us out of bounds.
+    struct pond_ring_opt opt;
+    size_t stride;
+
+    struct pond_ring_stats stats;
+
+    // Each side caches the last seen index of the other side so that it only
+    // needs to touch the other's cache line when it runs out.
+    uint64_t head_cache;
+    uint64_t tail_cache;
+
+    struct mmsghdr *headers;
+    struct iovec *iovs;
+};
+
+static struct pond_ring_msg *ring_msg(struct pond_ring *ring, uint64_t index)
+{
+    size_t slot = index & (ring->opt.slot_cap - 1);
+    return (void *) (ring->slots + slot * ring->stride);
+}
+
+struct pond_ring *pond_ring_alloc(const char *name, const struct pond_ring_opt *opt)
+{
+    struct pond_ring *ring = calloc(1, sizeof(*ring));
+    pond_assert_alloc(ring);
+
+    if (opt) ring->opt = *opt;
+    if (!ring->opt.slot_cap) ring->opt.slot_cap = ring_slot_cap;
+    if (!ring->opt.slot_len) ring->opt.slot_len = ring_slot_len;
+    if (!ring->opt.batch_cap) ring->opt.batch_cap = ring_batch_cap;
+    ring->opt.slot_cap = pond_ceil_pow2(ring->opt.slot_cap);
+
+    ring->stride = ring_stride(ring->opt.slot_len);
+    ring->len = ring_region_len(ring->opt.slot_cap, ring->stride);
+
+    ring->fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd == -1) {
+        pond_fail_errno("unable to create memfd '%s'", name);
+        goto fail_memfd;
+    }
+
+    if (ftruncate(ring->fd, ring->len) == -1) {
+        pond_fail_errno("unable to size memfd '%s' to %zu", name, ring->len);
+        goto fail_truncate;
+    }
+
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+    if (fcntl(ring->fd, F_ADD_SEALS, seals) == -1) {
+        pond_fail_errno("unable to seal memfd '%s'", name);
+        goto fail_seal;
+    }
+
+    void *data = mmap(NULL, ring->len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (data == MAP_FAILED) {
+        pond_fail_errno("unable to mmap memfd '%s'", name);
+        goto fail_mmap;
+    }
+
+    ring->header = data;
+    ring->slots = ((uint8_t *) data) + pond_mmsg_page_len;
+
+    ring->header->slot_cap = ring->opt.slot_cap;
+    ring->header->slot_len = ring->opt.slot_len;
+    ring->header->slot_stride = ring->stride;
+    atomic_init(&ring->header->head, 0);
+    atomic_init(&ring->header->tail, 0);
+    atomic_init(&ring->header->seq, 0);
+    atomic_init(&ring->header->sleeping, 0);
+    ring->header->version = ring_version;
+    ring->header->magic = ring_magic;
+
+    ring->headers = calloc(ring->opt.batch_cap, sizeof(*ring->headers));
+    ring->iovs = calloc(ring->opt.batch_cap, sizeof(*ring->iovs));
+    pond_assert_alloc(ring->headers);
+    pond_assert_alloc(ring->iovs);
+
+    return ring;
+
+  fail_mmap:
+  fail_seal:
+  fail_truncate:
+    close(ring->fd);
+  fail_memfd:
+    free(ring);
+    return NULL;
+}
+
+// The fd is owned by the ring from then on and closed when it's freed.
+struct pond_ring *pond_ring_attach(int fd)
+{
+    // Checked before the size is read since an unsealed fd could be resized
+    // from under the mapping which would fault on the next access.
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1) {
+        pond_fail_errno("unable to get seals of ring fd '%d'", fd);
+        return NULL;
+    }
+
+    if ((seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        pond_fail("ring fd '%d' isn't sealed against resizes: %x", fd, seals);
+        return NULL;
+    }
+
+    struct stat stat;
+    if (fstat(fd, &stat) == -1) {
+        pond_fail_errno("unable to stat ring fd '%d'", fd);
+        return NULL;
+    }
+
+    size_t len = stat.st_size;
+    if (len < pond_mmsg_page_len) {
+        pond_fail("ring fd '%d' is too small: %zu", fd, len);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        pond_fail_errno("unable to mmap ring fd '%d'", fd);
+        return NULL;
+    }
+
+    struct ring_header *header = data;
+    if (header->magic != ring_magic || header->version != ring_version) {
+        pond_fail("invalid ring header for fd '%d': %x:%u", fd, header->magic, header->version);
+        goto fail_header;
+    }
+
+    // Read once so that what's validated is what's used.
+    size_t slot_cap = ((volatile struct ring_header *) header)->slot_cap;
+    size_t slot_len = ((volatile struct ring_header *) header)->slot_len;
+    size_t stride = ((volatile struct ring_header *) header)->slot_stride;
+
+    if (!slot_cap || !pond_is_pow2(slot_cap) ||
+            slot_len >= len || stride != ring_stride(slot_len) ||
+            slot_cap > len / stride || ring_region_len(slot_cap, stride) != len)
+    {
+        pond_fail("invalid ring geometry for fd '%d': %zu/%zu/%zu", fd, slot_cap, slot_len, len);
+        goto fail_header;
+    }
+
+    struct pond_ring *ring = calloc(1, sizeof(*ring));
+    pond_assert_alloc(ring);
+
+    ring->fd = fd;
+    ring->len = len;
+    ring->header = header;
+    ring->slots = ((uint8_t *) data) + pond_mmsg_page_len;
+    ring->opt.slot_cap = slot_cap;
+    ring->opt.slot_len = slot_len;
+    ring->stride = stride;
+    ring->tail_cache = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    ring->head_cache = ring->tail_cache;
+
+    return ring;
+
+  fail_header:
+    munmap(data, len);
+    return NULL;
+}
+
+void pond_ring_free(struct pond_ring *ring)
+{
+    munmap(ring->header, ring->len);
+    close(ring->fd);
+    free(ring->headers);
+    free(ring->iovs);
+    free(ring);
+}
+
+int pond_ring_fd(struct pond_ring *ring)
+{
+    return ring->fd;
+}
+
+size_t pond_ring_cap(struct pond_ring *ring)
+{
+    return ring->opt.slot_cap;
+}
+
+size_t pond_ring_slot_len(struct pond_ring *ring)
+{
+    return ring->opt.slot_len;
+}
+
+void pond_ring_stats(struct pond_ring *ring, struct pond_ring_stats *dst)
+{
+    *dst = ring->stats;
+}
+
+
+// -----------------------------------------------------------------------------
+// producer
+// -----------------------------------------------------------------------------
+
+// The seq_cst fence pairs with the one in pond_ring_wait: either the consumer
+// sees the new head before sleeping or we see its sleeping flag.
+static void ring_publish(struct pond_ring *ring, uint64_t head)
+{
+    atomic_store_explicit(&ring->header->head, head, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!atomic_load_explicit(&ring->header->sleeping, memory_order_relaxed)) return;
+
+    atomic_fetch_add_explicit(&ring->header->seq, 1, memory_order_relaxed);
+    ring_futex(&ring->header->seq, FUTEX_WAKE, 1, NULL);
+    ring->stats.wakes++;
+}
+
+bool pond_ring_mrecv(struct pond_ring *ring, struct pond_udp *udp)
+{
+    pond_assert(ring->headers != NULL, "can't receive on an attached ring");
+
+    struct ring_header *header = ring->header;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+
+    size_t avail = ring->opt.slot_cap - (head - ring->tail_cache);
+    if (!avail) {
+        ring->tail_cache = atomic_load_explicit(&header->tail, memory_order_acquire);
+        avail = ring->opt.slot_cap - (head - ring->tail_cache);
+        if (!avail) { ring->stats.full++; return true; }
+    }
+
+    size_t len = pond_min(avail, ring->opt.batch_cap);
+    for (size_t i = 0; i < len; ++i) {
+        struct pond_ring_msg *msg = ring_msg(ring, head + i);
+        ring->iovs[i] = (struct iovec) { .iov_base = msg->data, .iov_len = ring->opt.slot_len };
+        ring->headers[i].msg_hdr = (struct msghdr) {
+            .msg_name = &msg->addr,
+            .msg_namelen = sizeof(msg->addr),
+            .msg_iov = &ring->iovs[i],
+            .msg_iovlen = 1,
+        };
+    }
+
+    int fd = pond_udp_fd(udp);
+    pond_probe2(mrecv_entry, fd, len);
+
+    int ret;
+    do {
+        ret = recvmmsg(fd, ring->headers, len, MSG_WAITFORONE, NULL);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        pond_probe3(mrecv_return, fd, 0, 0);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        pond_fail_errno("unable to receive messages into ring");
+        return false;
+    }
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < (size_t) ret; ++i) {
+        struct pond_ring_msg *msg = ring_msg(ring, head + i);
+        msg->len = pond_min(ring->headers[i].msg_len, ring->opt.slot_len);
+        msg->addr_len = ring->headers[i].msg_hdr.msg_namelen;
+        bytes += msg->len;
+    }
+    pond_probe3(mrecv_return, fd, ret, bytes);
+
+    ring_publish(ring, head + ret);
+
+    ring->stats.recv += ret;
+    ring->stats.batches++;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// consumer
+// -----------------------------------------------------------------------------
+
+size_t pond_ring_peek(struct pond_ring *ring, const struct pond_ring_msg **dst, size_t len)
+{
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+
+    if (ring->head_cache - tail < len)
+        ring->head_cache = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+
+    // The lengths are written by the producer so they're clamped to the slot
+    // before being handed out.
+    len = pond_min(len, ring->head_cache - tail);
+    for (size_t i = 0; i < len; ++i) {
+        struct pond_ring_msg *msg = ring_msg(ring, tail + i);
+        msg->len = pond_min(msg->len, ring->opt.slot_len);
+        msg->addr_len = pond_min(msg->addr_len, sizeof(msg->addr));
+        dst[i] = msg;
+    }
+
+    return len;
+}
+
+void pond_ring_release(struct pond_ring *ring, size_t len)
+{
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    pond_assert(len <= ring->head_cache - tail, "releasing unpublished slots: %zu", len);
+
+    atomic_store_explicit(&ring->header->tail, tail + len, memory_order_release);
+}
+
+static bool ring_ready(struct pond_ring *ring)
+{
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    if (ring->head_cache != tail) return true;
+
+    ring->head_cache = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+    return ring->head_cache != tail;
+}
+
+bool pond_ring_wait(struct pond_ring *ring, uint64_t timeout)
+{
+    struct ring_header *header = ring->header;
+    uint64_t deadline = timeout == UINT64_MAX ? UINT64_MAX : pond_now() + timeout;
+
+    while (true) {
+        if (ring_ready(ring)) return true;
+
+        uint64_t now = pond_now();
+        if (now >= deadline) return false;
+
+        unsigned seq = atomic_load_explicit(&header->seq, memory_order_relaxed);
+        atomic_store_explicit(&header->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (ring_ready(ring)) {
+            atomic_store_explicit(&header->sleeping, 0, memory_order_relaxed);
+            return true;
+        }
+
+        struct timespec ts = {0};
+        if (deadline != UINT64_MAX) {
+            ts.tv_sec = (deadline - now) / (1000UL * 1000 * 1000);
+            ts.tv_nsec = (deadline - now) % (1000UL * 1000 * 1000);
+        }
+
+        long ret = ring_futex(&header->seq, FUTEX_WAIT, seq,
+                deadline == UINT64_MAX ? NULL : &ts);
+        atomic_store_explicit(&header->sleeping, 0, memory_order_relaxed);
+
+        if (ret == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            pond_fail_errno("unable to wait on ring futex");
+            return false;
+        }
+    }
+}
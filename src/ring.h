@@ -0,0 +1,89 @@
+/* ring.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Single-producer single-consumer ring of datagram slots in a memfd region
+   shared with another process.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+
+
+// -----------------------------------------------------------------------------
+// ring
+// -----------------------------------------------------------------------------
+
+// The producer receives directly into the slots of the region and publishes
+// whole batches with a single store. The consumer reads the slots in place and
+// releases them once done. Wakeups go through a futex in the region which is
+// only signaled if the consumer is actually asleep so neither side pays a
+// syscall per message.
+//
+// The consumer gets access to the region by receiving the fd (SCM_RIGHTS or
+// /proc/<pid>/fd/<fd>) and attaching to it. The memfd is sealed against resizes
+// and attaching rejects any fd that isn't so the consumer can trust the size it
+// maps.
+
+struct pond_ring_opt
+{
+    size_t slot_cap; // rounded up to a power of 2; defaults to 1024.
+    size_t slot_len; // max payload per slot; defaults to 2048.
+    size_t batch_cap; // max datagrams per recvmmsg; defaults to 64.
+};
+
+struct pond_ring_stats
+{
+    uint64_t recv;
+    uint64_t batches;
+    uint64_t full;  // receive attempts that found no free slots.
+    uint64_t wakes; // futex wakes issued to a sleeping consumer.
+};
+
+struct pond_ring_msg
+{
+    uint32_t len;
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+    uint8_t data[];
+};
+
+struct pond_ring;
+
+struct pond_ring *pond_ring_alloc(const char *name, const struct pond_ring_opt *) pond_malloc;
+struct pond_ring *pond_ring_attach(int fd) pond_malloc;
+void pond_ring_free(struct pond_ring *);
+
+int pond_ring_fd(struct pond_ring *);
+size_t pond_ring_cap(struct pond_ring *);
+size_t pond_ring_slot_len(struct pond_ring *);
+void pond_ring_stats(struct pond_ring *, struct pond_ring_stats *dst);
+
+
+// Producer: receives at most one batch into the free slots and publishes it.
+// Never blocks on a full ring; the datagrams are left in the socket buffer.
+bool pond_ring_mrecv(struct pond_ring *, struct pond_udp *);
+
+
+// Consumer: points dst at up to len published messages in order without
+// releasing them.
+size_t pond_ring_peek(struct pond_ring *, const struct pond_ring_msg **dst, size_t len);
+void pond_ring_release(struct pond_ring *, size_t len);
+
+// Waits at most timeout nanoseconds for messages to be published where
+// UINT64_MAX waits forever. Returns false on timeout or failure.
+bool pond_ring_wait(struct pond_ring *, uint64_t timeout);
@@ -0,0 +1,548 @@
+/* rpc.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "rpc.h"
+#include "net.h"
+#include "buf.h"
+#include "bits.h"
+#include "math.h"
+#include "timer.h"
+#include "process.h"
+#include "errors.h"
+
+#include <string.h>
+#include <endian.h>
+#include <sys/random.h>
+
+
+// -----------------------------------------------------------------------------
+// header
+// -----------------------------------------------------------------------------
+
+enum
+{
+    rpc_kind_request = 1,
+    rpc_kind_response = 2,
+};
+
+// Wire format is little-endian and the header is kept in that format from the
+// moment it's built so that it can be handed as is to sendmmsg.
+struct pond_packed rpc_header
+{
+    uint64_t id;
+    uint16_t method;
+    uint8_t kind;
+    uint8_t status;
+};
+
+pond_static_assert(sizeof(struct rpc_header) == pond_rpc_header_len);
+
+
+// -----------------------------------------------------------------------------
+// rpc
+// -----------------------------------------------------------------------------
+
+enum
+{
+    rpc_inflight_cap = 1024,
+    rpc_msg_len = 1472,
+    rpc_timeout = 10 * 1000 * 1000,
+    rpc_deadline = 100 * 1000 * 1000,
+    rpc_tick = 100 * 1000,
+    rpc_batch_cap = 64,
+};
+
+// The timer must remain the first field so that the wheel callback can get
+// back to its call.
+struct rpc_call
+{
+    struct pond_timer timer;
+
+    uint64_t id;
+    uint64_t start;
+    uint64_t deadline;
+
+    bool queued;
+    size_t tx; // index in the pending batch while queued.
+
+    pond_rpc_fn fn;
+    void *ctx;
+
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    struct rpc_header header;
+    size_t len;
+    uint8_t *data;
+};
+
+// id of 0 indicates an empty slot.
+struct rpc_slot
+{
+    uint64_t id;
+    size_t call;
+};
+
+struct rpc_reply
+{
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    struct rpc_header header;
+    struct pond_bin *bin;
+};
+
+struct pond_rpc
+{
+    struct pond_udp *udp;
+    struct pond_rpc_opt opt;
+    struct pond_rpc_stats stats;
+    struct pond_wheel *wheel;
+
+    uint64_t ids;
+
+    struct rpc_call *calls;
+    uint8_t *calls_data;
+
+    size_t free_len;
+    size_t *free;
+
+    size_t slots_cap;
+    struct rpc_slot *slots;
+
+    size_t replies_len;
+    struct rpc_reply *replies;
+
+    // tx_calls is NULL for replies.
+    size_t tx_len;
+    struct rpc_call **tx_calls;
+    struct mmsghdr *headers;
+    struct iovec *iovs;
+};
+
+static void rpc_expire(struct pond_timer *);
+static void rpc_untx(struct pond_rpc *, struct rpc_call *);
+
+struct pond_rpc *pond_rpc_alloc(struct pond_udp *udp, const struct pond_rpc_opt *opt)
+{
+    struct pond_rpc *rpc = calloc(1, sizeof(*rpc));
+    pond_assert_alloc(rpc);
+
+    rpc->udp = udp;
+    if (opt) rpc->opt = *opt;
+    if (!rpc->opt.inflight_cap) rpc->opt.inflight_cap = rpc_inflight_cap;
+    if (!rpc->opt.msg_len) rpc->opt.msg_len = rpc_msg_len;
+    if (!rpc->opt.timeout) rpc->opt.timeout = rpc_timeout;
+    if (!rpc->opt.deadline) rpc->opt.deadline = rpc_deadline;
+    if (!rpc->opt.tick) rpc->opt.tick = rpc_tick;
+    if (!rpc->opt.batch_cap) rpc->opt.batch_cap = rpc_batch_cap;
+
+    pond_assert(rpc->opt.msg_len > pond_rpc_header_len,
+            "msg_len too small: %zu", rpc->opt.msg_len);
+
+    // Ids are only meant to be unique per socket but a random starting point
+    // avoids matching stale responses meant for a previous process.
+    if (getrandom(&rpc->ids, sizeof(rpc->ids), GRND_NONBLOCK) != sizeof(rpc->ids))
+        rpc->ids = pond_now();
+
+    rpc->wheel = pond_wheel_alloc(rpc->opt.tick, pond_now());
+
+    size_t cap = rpc->opt.inflight_cap;
+    size_t payload = rpc->opt.msg_len - pond_rpc_header_len;
+
+    rpc->calls = calloc(cap, sizeof(*rpc->calls));
+    rpc->calls_data = calloc(cap, payload);
+    rpc->free = calloc(cap, sizeof(*rpc->free));
+    pond_assert_alloc(rpc->calls);
+    pond_assert_alloc(rpc->calls_data);
+    pond_assert_alloc(rpc->free);
+
+    for (size_t i = 0; i < cap; ++i) {
+        struct rpc_call *call = &rpc->calls[i];
+        pond_timer_init(&call->timer, rpc_expire, rpc);
+        call->data = rpc->calls_data + i * payload;
+        rpc->free[rpc->free_len++] = cap - i - 1;
+    }
+
+    rpc->slots_cap = pond_ceil_pow2(cap * 2);
+    rpc->slots = calloc(rpc->slots_cap, sizeof(*rpc->slots));
+    pond_assert_alloc(rpc->slots);
+
+    size_t batch = rpc->opt.batch_cap;
+    rpc->replies = calloc(batch, sizeof(*rpc->replies));
+    rpc->tx_calls = calloc(batch, sizeof(*rpc->tx_calls));
+    rpc->headers = calloc(batch, sizeof(*rpc->headers));
+    rpc->iovs = calloc(batch * 2, sizeof(*rpc->iovs));
+    pond_assert_alloc(rpc->replies);
+    pond_assert_alloc(rpc->tx_calls);
+    pond_assert_alloc(rpc->headers);
+    pond_assert_alloc(rpc->iovs);
+
+    for (size_t i = 0; i < batch; ++i)
+        rpc->replies[i].bin = pond_bin_alloc(payload);
+
+    return rpc;
+}
+
+// Outstanding calls are dropped without invoking their callbacks.
+void pond_rpc_free(struct pond_rpc *rpc)
+{
+    for (size_t i = 0; i < rpc->opt.batch_cap; ++i)
+        pond_bin_free(rpc->replies[i].bin);
+
+    pond_wheel_free(rpc->wheel);
+    free(rpc->calls);
+    free(rpc->calls_data);
+    free(rpc->free);
+    free(rpc->slots);
+    free(rpc->replies);
+    free(rpc->tx_calls);
+    free(rpc->headers);
+    free(rpc->iovs);
+    free(rpc);
+}
+
+void pond_rpc_stats(struct pond_rpc *rpc, struct pond_rpc_stats *dst)
+{
+    *dst = rpc->stats;
+}
+
+size_t pond_rpc_inflight(struct pond_rpc *rpc)
+{
+    return rpc->opt.inflight_cap - rpc->free_len;
+}
+
+uint64_t pond_rpc_percentile(const struct pond_rpc_stats *stats, double p)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < pond_rpc_hist_len; ++i) total += stats->latency[i];
+    if (!total) return 0;
+
+    uint64_t target = p * total;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < pond_rpc_hist_len; ++i) {
+        sum += stats->latency[i];
+        if (sum > target) return i + 1 < 64 ? 1ULL << (i + 1) : UINT64_MAX;
+    }
+
+    return UINT64_MAX;
+}
+
+
+// -----------------------------------------------------------------------------
+// table
+// -----------------------------------------------------------------------------
+
+// Ids are sequential so a multiplicative hash is enough to spread them.
+static size_t rpc_home(struct pond_rpc *rpc, uint64_t id)
+{
+    return (id * 0x9E3779B97F4A7C15ULL) >> (64 - pond_ctz(rpc->slots_cap));
+}
+
+static size_t rpc_find(struct pond_rpc *rpc, uint64_t id)
+{
+    size_t mask = rpc->slots_cap - 1;
+
+    for (size_t i = rpc_home(rpc, id);; i = (i + 1) & mask) {
+        if (!rpc->slots[i].id || rpc->slots[i].id == id) return i;
+    }
+}
+
+static void rpc_del(struct pond_rpc *rpc, size_t i)
+{
+    size_t mask = rpc->slots_cap - 1;
+    struct rpc_slot *slots = rpc->slots;
+
+    for (size_t j = (i + 1) & mask; slots[j].id; j = (j + 1) & mask) {
+        size_t home = rpc_home(rpc, slots[j].id);
+
+        bool in_place = i <= j ?
+            (i < home && home <= j) :
+            (i < home || home <= j);
+        if (in_place) continue;
+
+        slots[i] = slots[j];
+        i = j;
+    }
+
+    slots[i].id = 0;
+}
+
+static void rpc_complete(
+        struct pond_rpc *rpc, size_t slot, enum pond_rpc_status status,
+        const uint8_t *data, size_t len)
+{
+    size_t index = rpc->slots[slot].call;
+    struct rpc_call *call = &rpc->calls[index];
+    uint64_t id = call->id;
+
+    rpc_del(rpc, slot);
+    if (pond_timer_armed(&call->timer)) pond_wheel_cancel(rpc->wheel, &call->timer);
+    if (call->queued) rpc_untx(rpc, call);
+    rpc->free[rpc->free_len++] = index;
+
+    call->fn(call->ctx, id, status, data, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// tx
+// -----------------------------------------------------------------------------
+
+static void rpc_tx(
+        struct pond_rpc *rpc, struct rpc_call *call,
+        struct sockaddr_storage *addr, socklen_t addr_len,
+        struct rpc_header *header, void *data, size_t len)
+{
+    size_t i = rpc->tx_len++;
+    struct iovec *iovs = &rpc->iovs[i * 2];
+    rpc->tx_calls[i] = call;
+    if (call) call->tx = i;
+
+    iovs[0] = (struct iovec) { .iov_base = header, .iov_len = sizeof(*header) };
+    iovs[1] = (struct iovec) { .iov_base = data, .iov_len = len };
+
+    rpc->headers[i].msg_hdr = (struct msghdr) {
+        .msg_name = addr_len ? addr : NULL,
+        .msg_namelen = addr_len,
+        .msg_iov = iovs,
+        .msg_iovlen = 2,
+    };
+}
+
+// A call completed while still queued must leave the batch before its index is
+// reused or its datagram would go out twice. The last entry takes its place.
+static void rpc_untx(struct pond_rpc *rpc, struct rpc_call *call)
+{
+    size_t i = call->tx;
+    size_t last = --rpc->tx_len;
+    call->queued = false;
+
+    if (i == last) return;
+
+    rpc->tx_calls[i] = rpc->tx_calls[last];
+    if (rpc->tx_calls[i]) rpc->tx_calls[i]->tx = i;
+
+    rpc->iovs[i * 2] = rpc->iovs[last * 2];
+    rpc->iovs[i * 2 + 1] = rpc->iovs[last * 2 + 1];
+    rpc->headers[i] = rpc->headers[last];
+    rpc->headers[i].msg_hdr.msg_iov = &rpc->iovs[i * 2];
+}
+
+bool pond_rpc_flush(struct pond_rpc *rpc)
+{
+    if (!rpc->tx_len) return true;
+
+    bool ok = pond_udp_msend_sys(rpc->udp, rpc->headers, rpc->tx_len);
+
+    // Calls are left in the table on failure and will be retried on expiry.
+    for (size_t i = 0; i < rpc->tx_len; ++i) {
+        if (rpc->tx_calls[i]) rpc->tx_calls[i]->queued = false;
+    }
+
+    rpc->tx_len = 0;
+    rpc->replies_len = 0;
+    return ok;
+}
+
+static bool rpc_queue(struct pond_rpc *rpc, struct rpc_call *call)
+{
+    if (call->queued) return true;
+    call->queued = true;
+
+    rpc_tx(rpc, call, &call->addr, call->addr_len, &call->header, call->data, call->len);
+    return rpc->tx_len < rpc->opt.batch_cap || pond_rpc_flush(rpc);
+}
+
+uint64_t pond_rpc_call(
+        struct pond_rpc *rpc, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        uint16_t method, const uint8_t *data, size_t len,
+        pond_rpc_fn fn, void *ctx)
+{
+    if (len > rpc->opt.msg_len - pond_rpc_header_len) {
+        pond_fail("rpc payload too large: %zu > %zu",
+                len, rpc->opt.msg_len - pond_rpc_header_len);
+        return 0;
+    }
+
+    if (!rpc->free_len) {
+        rpc->stats.full++;
+        pond_fail("too many inflight rpc calls: %zu", rpc->opt.inflight_cap);
+        return 0;
+    }
+
+    uint64_t id = ++rpc->ids;
+    if (!id) id = ++rpc->ids;
+
+    size_t slot = rpc_find(rpc, id);
+    pond_assert(!rpc->slots[slot].id, "duplicate rpc id: %lu", id);
+
+    size_t index = rpc->free[--rpc->free_len];
+    rpc->slots[slot] = (struct rpc_slot) { .id = id, .call = index };
+
+    struct rpc_call *call = &rpc->calls[index];
+    call->id = id;
+    call->start = now;
+    call->deadline = now + rpc->opt.deadline;
+    call->queued = false;
+    call->fn = fn;
+    call->ctx = ctx;
+
+    pond_assert(addr_len <= sizeof(call->addr), "invalid addr len: %u", addr_len);
+    call->addr_len = addr_len;
+    if (addr_len) memcpy(&call->addr, addr, addr_len);
+
+    call->header = (struct rpc_header) {
+        .id = htole64(id),
+        .method = htole16(method),
+        .kind = rpc_kind_request,
+    };
+    call->len = len;
+    memcpy(call->data, data, len);
+
+    pond_wheel_add(rpc->wheel, &call->timer, pond_min(now + rpc->opt.timeout, call->deadline));
+    rpc->stats.calls++;
+
+    // A failed send is handled like a lost datagram and retried on expiry.
+    (void) rpc_queue(rpc, call);
+    return id;
+}
+
+
+// -----------------------------------------------------------------------------
+// expire
+// -----------------------------------------------------------------------------
+
+static void rpc_expire(struct pond_timer *timer)
+{
+    struct pond_rpc *rpc = timer->data;
+    struct rpc_call *call = (struct rpc_call *) timer;
+    uint64_t now = pond_wheel_now(rpc->wheel);
+
+    if (now >= call->deadline) {
+        rpc->stats.timeouts++;
+        rpc_complete(rpc, rpc_find(rpc, call->id), pond_rpc_timeout, NULL, 0);
+        return;
+    }
+
+    rpc->stats.retries++;
+    pond_wheel_add(rpc->wheel, &call->timer, pond_min(now + rpc->opt.timeout, call->deadline));
+    (void) rpc_queue(rpc, call);
+}
+
+bool pond_rpc_poll(struct pond_rpc *rpc, uint64_t now, uint64_t *next)
+{
+    pond_wheel_advance(rpc->wheel, now);
+    *next = pond_wheel_next(rpc->wheel);
+    return pond_rpc_flush(rpc);
+}
+
+
+// -----------------------------------------------------------------------------
+// rx
+// -----------------------------------------------------------------------------
+
+static void rpc_response(
+        struct pond_rpc *rpc, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const struct rpc_header *header, const uint8_t *data, size_t len)
+{
+    size_t slot = rpc_find(rpc, header->id);
+    if (!rpc->slots[slot].id) { rpc->stats.unmatched++; return; }
+
+    // Connected sockets don't report the source address of their messages.
+    struct rpc_call *call = &rpc->calls[rpc->slots[slot].call];
+    if (addr_len && (addr_len != call->addr_len || memcmp(addr, &call->addr, addr_len))) {
+        rpc->stats.unmatched++;
+        return;
+    }
+
+    enum pond_rpc_status status = header->status ? pond_rpc_error : pond_rpc_ok;
+    if (status == pond_rpc_ok) {
+        uint64_t latency = now > call->start ? now - call->start : 1;
+        rpc->stats.latency[63 - pond_clz(latency)]++;
+        rpc->stats.ok++;
+    }
+    else rpc->stats.errors++;
+
+    rpc_complete(rpc, slot, status, data, len);
+}
+
+static bool rpc_serve(
+        struct pond_rpc *rpc,
+        const struct sockaddr *addr, socklen_t addr_len,
+        const struct rpc_header *header, const uint8_t *data, size_t len)
+{
+    struct rpc_reply *reply = &rpc->replies[rpc->replies_len++];
+    reply->bin->len = 0;
+
+    reply->addr_len = addr_len;
+    if (addr_len) memcpy(&reply->addr, addr, addr_len);
+
+    bool ok = rpc->opt.handler &&
+        rpc->opt.handler(rpc->opt.handler_ctx, header->method, data, len, reply->bin);
+    if (!ok) reply->bin->len = 0;
+
+    reply->header = (struct rpc_header) {
+        .id = htole64(header->id),
+        .method = htole16(header->method),
+        .kind = rpc_kind_response,
+        .status = !ok,
+    };
+    rpc->stats.served++;
+
+    rpc_tx(rpc, NULL, &reply->addr, reply->addr_len, &reply->header, reply->bin->d, reply->bin->len);
+    return rpc->tx_len < rpc->opt.batch_cap || pond_rpc_flush(rpc);
+}
+
+bool pond_rpc_recv(struct pond_rpc *rpc, uint64_t now, struct pond_mmsg *src)
+{
+    if (!pond_rpc_flush(rpc)) return false;
+
+    bool ok = true;
+    for (size_t i = 0; i < pond_mmsg_len(src); ++i) {
+        struct pond_iovec *iovec = pond_mmsg_iovec(src, i);
+        if (iovec->len != 1 || iovec->vec[0].len < pond_rpc_header_len) {
+            rpc->stats.invalid++;
+            continue;
+        }
+
+        struct rpc_header header;
+        memcpy(&header, iovec->vec[0].bin, sizeof(header));
+        header.id = le64toh(header.id);
+        header.method = le16toh(header.method);
+        const uint8_t *data = iovec->vec[0].bin + sizeof(header);
+        size_t len = iovec->vec[0].len - sizeof(header);
+
+        socklen_t addr_len = 0;
+        const struct sockaddr *addr = pond_mmsg_addr(src, i, &addr_len);
+
+        switch (header.kind)
+        {
+        case rpc_kind_request:
+            ok = rpc_serve(rpc, addr, addr_len, &header, data, len) && ok;
+            break;
+        case rpc_kind_response:
+            rpc_response(rpc, now, addr, addr_len, &header, data, len);
+            break;
+        default:
+            rpc->stats.invalid++;
+            break;
+        }
+    }
+
+    return pond_rpc_flush(rpc) && ok;
+}
+
+bool pond_rpc_mrecv(struct pond_rpc *rpc, struct pond_mmsg *dst)
+{
+    if (!pond_rpc_flush(rpc)) return false;
+
+    if (!pond_wheel_mrecv(rpc->wheel, rpc->udp, dst, pond_mmsg_cap(dst))) return false;
+    if (!pond_rpc_flush(rpc)) return false;
+
+    return pond_rpc_recv(rpc, pond_wheel_now(rpc->wheel), dst);
+}
@@ -0,0 +1,128 @@
+/* rpc.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Pipelined request/response calls over a pond_udp socket.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_bin;
+struct pond_udp;
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// rpc
+// -----------------------------------------------------------------------------
+
+// Every datagram starts with a 12 bytes header holding the 64-bit request id,
+// the method and whether it's a request or a response. Any number of calls can
+// be outstanding to any number of peers and are matched back through a flat
+// open-addressing table keyed on the id. Each attempt is retransmitted after
+// timeout until the call reaches its deadline.
+//
+// A single socket can both issue calls and serve them if a handler is set.
+
+enum
+{
+    pond_rpc_header_len = 12,
+    pond_rpc_hist_len = 64,
+};
+
+enum pond_rpc_status
+{
+    pond_rpc_ok = 0,
+    pond_rpc_timeout,
+    pond_rpc_error,   // the peer has no handler or the handler failed.
+};
+
+typedef void (*pond_rpc_fn) (
+        void *ctx, uint64_t id, enum pond_rpc_status,
+        const uint8_t *data, size_t len);
+
+// Writes the response in out whose cap is bounded by msg_len and returns false
+// to reply with pond_rpc_error.
+typedef bool (*pond_rpc_handler) (
+        void *ctx, uint16_t method,
+        const uint8_t *data, size_t len,
+        struct pond_bin *out);
+
+struct pond_rpc_opt
+{
+    size_t inflight_cap; // max outstanding calls; defaults to 1024.
+    size_t msg_len;      // max datagram including the header; defaults to 1472.
+    uint64_t timeout;    // nanoseconds before an attempt is retried; defaults to 10ms.
+    uint64_t deadline;   // nanoseconds before a call fails; defaults to 100ms.
+    uint64_t tick;       // resolution of the retry timers; defaults to 100us.
+    size_t batch_cap;    // max datagrams per sendmmsg; defaults to 64.
+
+    pond_rpc_handler handler;
+    void *handler_ctx;
+};
+
+struct pond_rpc_stats
+{
+    uint64_t calls;
+    uint64_t ok;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t retries;
+    uint64_t full;       // calls rejected because inflight_cap was reached.
+
+    uint64_t served;
+    uint64_t unmatched;  // responses for calls that already completed.
+    uint64_t invalid;
+
+    // latency[i] counts calls completed in [2^i, 2^(i+1)) nanoseconds from the
+    // first attempt.
+    uint64_t latency[pond_rpc_hist_len];
+};
+
+struct pond_rpc;
+
+struct pond_rpc *pond_rpc_alloc(struct pond_udp *, const struct pond_rpc_opt *) pond_malloc;
+void pond_rpc_free(struct pond_rpc *);
+
+void pond_rpc_stats(struct pond_rpc *, struct pond_rpc_stats *dst);
+size_t pond_rpc_inflight(struct pond_rpc *);
+
+// Latency in nanoseconds below which lies the given fraction of the calls.
+uint64_t pond_rpc_percentile(const struct pond_rpc_stats *, double p);
+
+
+// Queues a request and returns its id or 0 on failure. The request is only
+// sent once the queue fills up or on the next flush, poll or recv which makes
+// it possible to pipeline many calls in a single sendmmsg.
+uint64_t pond_rpc_call(
+        struct pond_rpc *, uint64_t now,
+        const struct sockaddr *addr, socklen_t addr_len,
+        uint16_t method, const uint8_t *data, size_t len,
+        pond_rpc_fn fn, void *ctx);
+
+bool pond_rpc_flush(struct pond_rpc *);
+
+// Dispatches a received batch: responses complete their calls and requests
+// are handed to the handler with the replies sent as a batch. Each datagram is
+// expected to sit in the first iov of its message.
+bool pond_rpc_recv(struct pond_rpc *, uint64_t now, struct pond_mmsg *src);
+
+// Retries or fails the calls whose attempt expired and sets next to the next
+// deadline or UINT64_MAX if no calls are outstanding.
+bool pond_rpc_poll(struct pond_rpc *, uint64_t now, uint64_t *next);
+
+// Receive loop which waits no longer than the next retry.
+bool pond_rpc_mrecv(struct pond_rpc *, struct pond_mmsg *dst);
@@ -0,0 +1,538 @@
+/* shed.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "shed.h"
+#include "net.h"
+#include "bits.h"
+#include "errors.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    shed_width = 2048,
+
+    // Fixed so that the row loops unroll into straight scalar code.
+    shed_depth = 4,
+    shed_top_cap = 16,
+    shed_batch_len = 64,
+
+    // Only one packet in this many is offered to the top-K which keeps its
+    // upkeep off the per-packet path. Heavy hitters are sampled in proportion
+    // to their rate so they still make it in quickly and the tracked
+    // estimates are refreshed from the sketch when queried.
+    shed_top_sample = 16,
+
+    // Counters are fixed point so that the decay of small counts doesn't
+    // truncate them to zero on the first tick.
+    shed_scale = 256,
+
+    // Decay ticks per half-life which bounds the error of the discrete decay
+    // to about 4% of the continuous one.
+    shed_ticks = 8,
+};
+
+static const uint64_t shed_half_life = 1000ULL * 1000 * 1000;
+
+
+// -----------------------------------------------------------------------------
+// shed
+// -----------------------------------------------------------------------------
+
+struct shed_cell
+{
+    uint64_t pkts;
+    uint64_t bytes;
+};
+
+struct shed_addr
+{
+    socklen_t len;
+    struct sockaddr_storage addr;
+};
+
+struct pond_shed
+{
+    struct pond_shed_opt opt;
+    struct pond_shed_stats stats;
+
+    size_t mask;
+    struct shed_cell *cells;
+
+    uint64_t tick;
+    uint64_t next_tick;
+    double to_rate;  // counter to rate per second.
+
+    uint64_t pkt_limit;
+    uint64_t byte_limit;
+
+    // Hashes and counts are kept apart from the addresses so that scanning
+    // them only touches a couple of cache lines.
+    size_t top_len;
+    uint64_t top_seq;
+    uint64_t top_min;
+    uint64_t top_mask;
+    uint64_t *top_hash;
+    uint64_t *top_pkts;
+    uint64_t *top_bytes;
+    struct shed_addr *top_addr;
+
+    size_t over_cap;
+    bool *over;
+};
+
+// A rate sustained over every tick settles the counter at the geometric sum
+// rate * tick / (1 - decay) where decay is the fraction retained per tick which
+// gives the conversions in both directions.
+static uint64_t shed_limit(struct pond_shed *shed, double rate)
+{
+    if (!rate) return UINT64_MAX;
+    return rate / shed->to_rate * shed_scale;
+}
+
+struct pond_shed *pond_shed_alloc(const struct pond_shed_opt *opt)
+{
+    struct pond_shed *shed = calloc(1, sizeof(*shed));
+    pond_assert_alloc(shed);
+
+    if (opt) shed->opt = *opt;
+    if (!shed->opt.width) shed->opt.width = shed_width;
+    if (!shed->opt.half_life) shed->opt.half_life = shed_half_life;
+    if (!shed->opt.top_cap) shed->opt.top_cap = shed_top_cap;
+
+    shed->opt.width = pond_ceil_pow2(shed->opt.width);
+    shed->mask = shed->opt.width - 1;
+
+    shed->cells = aligned_alloc(pond_mmsg_line_len,
+            shed->opt.width * shed_depth * sizeof(*shed->cells));
+    pond_assert_alloc(shed->cells);
+    memset(shed->cells, 0, shed->opt.width * shed_depth * sizeof(*shed->cells));
+
+    shed->tick = shed->opt.half_life / shed_ticks;
+    if (!shed->tick) shed->tick = 1;
+
+    double decay = __builtin_exp2(-1.0 / shed_ticks);
+    shed->to_rate = (1 - decay) / (shed->tick / 1e9);
+    shed->pkt_limit = shed_limit(shed, shed->opt.pkt_rate);
+    shed->byte_limit = shed_limit(shed, shed->opt.byte_rate);
+
+    shed->top_hash = calloc(shed->opt.top_cap, sizeof(*shed->top_hash));
+    shed->top_pkts = calloc(shed->opt.top_cap, sizeof(*shed->top_pkts));
+    shed->top_bytes = calloc(shed->opt.top_cap, sizeof(*shed->top_bytes));
+    shed->top_addr = calloc(shed->opt.top_cap, sizeof(*shed->top_addr));
+    pond_assert_alloc(shed->top_hash);
+    pond_assert_alloc(shed->top_pkts);
+    pond_assert_alloc(shed->top_bytes);
+    pond_assert_alloc(shed->top_addr);
+
+    return shed;
+}
+
+void pond_shed_free(struct pond_shed *shed)
+{
+    if (!shed) return;
+
+    free(shed->cells);
+    free(shed->top_hash);
+    free(shed->top_pkts);
+    free(shed->top_bytes);
+    free(shed->top_addr);
+    free(shed->over);
+    free(shed);
+}
+
+void pond_shed_stats(struct pond_shed *shed, struct pond_shed_stats *dst)
+{
+    *dst = shed->stats;
+}
+
+
+// -----------------------------------------------------------------------------
+// hash
+// -----------------------------------------------------------------------------
+
+// IPv4 addresses are hashed as their v4-mapped IPv6 equivalent. The halves of
+// the key are assembled in registers as writing the mapped key to memory and
+// reading it back as words stalls on store forwarding.
+static bool shed_hash(
+        bool per_port, const struct sockaddr *addr, socklen_t len, uint64_t *hash)
+{
+    uint64_t a = 0, b = 0;
+    uint16_t port = 0;
+
+    switch (addr->sa_family) {
+
+    case AF_INET: {
+        if (len < sizeof(struct sockaddr_in)) return false;
+        const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+
+        uint32_t ip;
+        memcpy(&ip, &in->sin_addr, sizeof(ip));
+        b = 0xFFFFULL << 16 | (uint64_t) ip << 32;
+        port = in->sin_port;
+        break;
+    }
+
+    case AF_INET6: {
+        if (len < sizeof(struct sockaddr_in6)) return false;
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+
+        memcpy(&a, &in6->sin6_addr.s6_addr[0], sizeof(a));
+        memcpy(&b, &in6->sin6_addr.s6_addr[8], sizeof(b));
+        port = in6->sin6_port;
+        break;
+    }
+
+    default: return false;
+    }
+
+    if (per_port) b += port;
+
+    uint64_t h = a * 0x9E3779B97F4A7C15ULL;
+    h ^= b * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    *hash = h;
+    return true;
+}
+
+// Rows are indexed through double hashing of the two halves of a single hash
+// which is as good as independent hashes for the sketch's error bounds.
+static void shed_rows(size_t width, uint64_t hash, uint32_t *rows)
+{
+    uint64_t lo = (uint32_t) hash;
+    uint64_t hi = (hash >> 32) | 1;
+
+    for (size_t row = 0; row < shed_depth; ++row)
+        rows[row] = row * width + ((lo + row * hi) & (width - 1));
+}
+
+static void shed_prefetch(struct shed_cell *cells, const uint32_t *rows)
+{
+    for (size_t row = 0; row < shed_depth; ++row)
+        __builtin_prefetch(&cells[rows[row]], 1);
+}
+
+static uint64_t shed_estimate(struct pond_shed *shed, uint64_t hash, uint64_t *bytes)
+{
+    uint32_t rows[shed_depth];
+    shed_rows(shed->opt.width, hash, rows);
+
+    uint64_t pkts = UINT64_MAX;
+    *bytes = UINT64_MAX;
+
+    for (size_t row = 0; row < shed_depth; ++row) {
+        struct shed_cell *cell = &shed->cells[rows[row]];
+        if (cell->pkts < pkts) pkts = cell->pkts;
+        if (cell->bytes < *bytes) *bytes = cell->bytes;
+    }
+
+    return pkts;
+}
+
+
+// -----------------------------------------------------------------------------
+// top
+// -----------------------------------------------------------------------------
+
+static void shed_top_min(struct pond_shed *shed)
+{
+    shed->top_min = 0;
+    if (shed->top_len < shed->opt.top_cap) return;
+
+    shed->top_min = UINT64_MAX;
+    for (size_t i = 0; i < shed->top_len; ++i) {
+        if (shed->top_pkts[i] < shed->top_min)
+            shed->top_min = shed->top_pkts[i];
+    }
+}
+
+// The mask has a bit set for the top bits of every tracked hash so that most
+// untracked sources can skip the scan. Untracked sources must beat the
+// smallest tracked estimate by a margin to keep sources of similar rates from
+// evicting each other on every packet.
+static uint64_t shed_top_bit(uint64_t hash)
+{
+    return 1ULL << (hash >> 58);
+}
+
+static bool shed_top_gate(struct pond_shed *shed, uint64_t hash, uint64_t pkts)
+{
+    if (pkts <= shed->top_min) return false;
+    if (shed->top_mask & shed_top_bit(hash)) return true;
+    return shed->top_len < shed->opt.top_cap || pkts > shed->top_min + shed->top_min / 8;
+}
+
+static void shed_top_update(
+        struct pond_shed *shed, uint64_t hash,
+        const struct sockaddr *addr, socklen_t addr_len,
+        uint64_t pkts, uint64_t bytes)
+{
+    size_t i = 0;
+    while (i < shed->top_len && shed->top_hash[i] != hash) i++;
+
+    if (i == shed->top_len) {
+        if (shed->top_len < shed->opt.top_cap) shed->top_len++;
+        else {
+            if (pkts <= shed->top_min + shed->top_min / 8) return;
+            for (i = 0; shed->top_pkts[i] != shed->top_min; ++i);
+        }
+
+        shed->top_hash[i] = hash;
+        shed->top_mask = 0;
+        for (size_t j = 0; j < shed->top_len; ++j)
+            shed->top_mask |= shed_top_bit(shed->top_hash[j]);
+
+        shed->top_addr[i].len = addr_len;
+        memcpy(&shed->top_addr[i].addr, addr, addr_len);
+    }
+
+    bool min = shed->top_pkts[i] <= shed->top_min;
+    shed->top_pkts[i] = pkts;
+    shed->top_bytes[i] = bytes;
+    if (min) shed_top_min(shed);
+}
+
+static int shed_top_cmp(const void *lhs, const void *rhs)
+{
+    const struct pond_shed_hitter *a = lhs, *b = rhs;
+    return a->pkt_rate < b->pkt_rate ? 1 : a->pkt_rate > b->pkt_rate ? -1 : 0;
+}
+
+// The tracked counts are only as fresh as the last sampled packet of each
+// source so they're brought up to date from the sketch first.
+size_t pond_shed_top(struct pond_shed *shed, struct pond_shed_hitter *dst, size_t cap)
+{
+    size_t len = shed->top_len;
+    if (!len) return 0;
+
+    struct pond_shed_hitter hitters[len];
+
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t bytes = 0;
+        uint64_t pkts = shed_estimate(shed, shed->top_hash[i], &bytes);
+        if (pkts > shed->top_pkts[i]) shed->top_pkts[i] = pkts;
+        if (bytes > shed->top_bytes[i]) shed->top_bytes[i] = bytes;
+    }
+    shed_top_min(shed);
+
+    for (size_t i = 0; i < len; ++i) {
+        hitters[i] = (struct pond_shed_hitter) {
+            .addr_len = shed->top_addr[i].len,
+            .addr = shed->top_addr[i].addr,
+            .pkt_rate = (double) shed->top_pkts[i] / shed_scale * shed->to_rate,
+            .byte_rate = (double) shed->top_bytes[i] / shed_scale * shed->to_rate,
+        };
+    }
+
+    qsort(hitters, len, sizeof(*hitters), shed_top_cmp);
+
+    if (len > cap) len = cap;
+    memcpy(dst, hitters, len * sizeof(*dst));
+    return len;
+}
+
+
+// -----------------------------------------------------------------------------
+// update
+// -----------------------------------------------------------------------------
+
+// Sources that go quiet for long enough decay to zero in a single sweep once
+// the factor underflows the fixed point.
+static void shed_decay(struct pond_shed *shed, uint64_t now)
+{
+    if (!shed->next_tick) shed->next_tick = now + shed->tick;
+    if (now < shed->next_tick) return;
+
+    uint64_t ticks = (now - shed->next_tick) / shed->tick + 1;
+    shed->next_tick += ticks * shed->tick;
+    shed->stats.decays++;
+
+    uint64_t factor = __builtin_exp2(16 - (double) ticks / shed_ticks);
+    size_t len = shed->opt.width * shed_depth;
+
+    for (size_t i = 0; i < len; ++i) {
+        shed->cells[i].pkts = (shed->cells[i].pkts * factor) >> 16;
+        shed->cells[i].bytes = (shed->cells[i].bytes * factor) >> 16;
+    }
+
+    for (size_t i = 0; i < shed->top_len; ++i) {
+        shed->top_pkts[i] = (shed->top_pkts[i] * factor) >> 16;
+        shed->top_bytes[i] = (shed->top_bytes[i] * factor) >> 16;
+    }
+    shed_top_min(shed);
+}
+
+// Conservative update: only the counters that would fall below the new
+// estimate are raised which bounds the overestimation from collisions far
+// better than incrementing every row. Whether a row gets raised is random so
+// the stores are unconditional to keep the branches out of the hot loop.
+static uint64_t shed_update(
+        struct shed_cell *cells, const uint32_t *rows, size_t len, uint64_t *bytes)
+{
+    uint64_t pkts_min = UINT64_MAX, bytes_min = UINT64_MAX;
+
+    for (size_t row = 0; row < shed_depth; ++row) {
+        struct shed_cell *cell = &cells[rows[row]];
+        pkts_min = cell->pkts < pkts_min ? cell->pkts : pkts_min;
+        bytes_min = cell->bytes < bytes_min ? cell->bytes : bytes_min;
+    }
+
+    uint64_t pkts = pkts_min + shed_scale;
+    *bytes = bytes_min + len * shed_scale;
+
+    for (size_t row = 0; row < shed_depth; ++row) {
+        struct shed_cell *cell = &cells[rows[row]];
+        cell->pkts = cell->pkts < pkts ? pkts : cell->pkts;
+        cell->bytes = cell->bytes < *bytes ? *bytes : cell->bytes;
+    }
+
+    return pkts;
+}
+
+bool pond_shed_over(
+        struct pond_shed *shed, uint64_t now,
+        const struct sockaddr *addr, socklen_t len, size_t bytes)
+{
+    shed_decay(shed, now);
+
+    uint64_t hash;
+    if (!len || !shed_hash(shed->opt.per_port, addr, len, &hash)) {
+        shed->stats.invalid++;
+        return false;
+    }
+
+    uint32_t rows[shed_depth];
+    shed_rows(shed->opt.width, hash, rows);
+
+    uint64_t est_bytes = 0;
+    uint64_t est_pkts = shed_update(shed->cells, rows, bytes, &est_bytes);
+
+    if (!(++shed->top_seq % shed_top_sample) && shed_top_gate(shed, hash, est_pkts))
+        shed_top_update(shed, hash, addr, len, est_pkts, est_bytes);
+
+    bool over = est_pkts > shed->pkt_limit || est_bytes > shed->byte_limit;
+    shed->stats.pkts++;
+    shed->stats.bytes += bytes;
+    shed->stats.over += over;
+    return over;
+}
+
+static size_t shed_bytes(struct pond_mmsg *mmsg, size_t i)
+{
+    struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+
+    size_t bytes = 0;
+    for (size_t j = 0; j < iovec->len; ++j) bytes += iovec->vec[j].len;
+    return bytes;
+}
+
+// The sketch rows of a whole chunk are prefetched before any of them is
+// updated so that the misses of independent sources overlap. Everything that
+// the loops read on every message is kept in locals as the stores to the
+// batch arrays would otherwise force it to be reloaded, and the stats are
+// written back once per call.
+size_t pond_shed_filter(
+        struct pond_shed *shed, uint64_t now, struct pond_mmsg *mmsg, size_t *order)
+{
+    shed_decay(shed, now);
+
+    size_t len = pond_mmsg_len(mmsg);
+    if (len > shed->over_cap) {
+        shed->over_cap = pond_mmsg_cap(mmsg);
+        shed->over = realloc(shed->over, shed->over_cap * sizeof(*shed->over));
+        pond_assert_alloc(shed->over);
+    }
+
+    bool *over = shed->over;
+    struct shed_cell *cells = shed->cells;
+    const size_t width = shed->opt.width;
+    const bool per_port = shed->opt.per_port;
+    const uint64_t pkt_limit = shed->pkt_limit;
+    const uint64_t byte_limit = shed->byte_limit;
+
+    uint64_t top_seq = shed->top_seq;
+    struct pond_shed_stats stats = {0};
+
+    for (size_t base = 0; base < len; base += shed_batch_len) {
+        size_t n = len - base < shed_batch_len ? len - base : shed_batch_len;
+
+        bool valid[shed_batch_len];
+        uint64_t hashes[shed_batch_len];
+        uint32_t rows[shed_batch_len][shed_depth];
+        size_t bytes[shed_batch_len];
+
+        // Everything needed from the batch is read in this pass so that the
+        // update pass only touches the sketch.
+        for (size_t i = 0; i < n; ++i) {
+            socklen_t addr_len;
+            const struct sockaddr *addr = pond_mmsg_addr(mmsg, base + i, &addr_len);
+
+            valid[i] = addr_len && shed_hash(per_port, addr, addr_len, &hashes[i]);
+            if (valid[i]) {
+                shed_rows(width, hashes[i], rows[i]);
+                shed_prefetch(cells, rows[i]);
+            }
+
+            bytes[i] = shed_bytes(mmsg, base + i);
+            stats.pkts += valid[i];
+            stats.bytes += valid[i] ? bytes[i] : 0;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            if (!valid[i]) { over[base + i] = false; continue; }
+
+            uint64_t est_bytes;
+            uint64_t est_pkts = shed_update(cells, rows[i], bytes[i], &est_bytes);
+
+            if (!(++top_seq % shed_top_sample) && shed_top_gate(shed, hashes[i], est_pkts)) {
+                socklen_t addr_len;
+                const struct sockaddr *addr = pond_mmsg_addr(mmsg, base + i, &addr_len);
+                shed_top_update(shed, hashes[i], addr, addr_len, est_pkts, est_bytes);
+            }
+
+            bool is_over = est_pkts > pkt_limit || est_bytes > byte_limit;
+            over[base + i] = is_over;
+            stats.over += is_over;
+        }
+    }
+
+    shed->top_seq = top_seq;
+    shed->stats.pkts += stats.pkts;
+    shed->stats.bytes += stats.bytes;
+    shed->stats.over += stats.over;
+    shed->stats.invalid += len - stats.pkts;
+
+    // Which sources are over is about as predictable as a coin toss under
+    // attack so the order is built without branching on it.
+    size_t out = 0;
+    for (size_t i = 0; i < len; ++i) {
+        order[out] = i;
+        out += !shed->over[i];
+    }
+
+    switch (shed->opt.action) {
+    case pond_shed_drop: break;
+    case pond_shed_defer:
+        for (size_t i = 0; i < len && out < len; ++i) {
+            order[out] = i;
+            out += shed->over[i];
+        }
+        break;
+    default: pond_unreachable();
+    }
+
+    return out;
+}
@@ -0,0 +1,101 @@
+/* shed.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Per-source rate estimation and load shedding of received batches.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// shed
+// -----------------------------------------------------------------------------
+
+// Packet and byte counts per source are kept in a 4 rows count-min sketch with
+// conservative updates so the memory is fixed regardless of the number of
+// sources and estimates can only err on the high side when sources collide.
+// Counters decay such that they halve every half_life which turns them into
+// exponentially weighted rates. The decay is applied to the whole sketch a few
+// times per half_life and costs a pass over the 4 * width counters.
+//
+// Sources are keyed by address only unless per_port is set so that a client
+// can't dodge its budget by rotating its source port.
+
+enum pond_shed_action
+{
+    pond_shed_drop = 0, // over budget sources are left out of the batch.
+    pond_shed_defer,    // over budget sources are moved to the end of the batch.
+};
+
+struct pond_shed_opt
+{
+    size_t width;       // counters per row rounded up to a power of 2; defaults to 2048.
+    uint64_t half_life; // nanoseconds; defaults to 1s.
+
+    double pkt_rate;    // packets per second per source; 0 is unlimited.
+    double byte_rate;   // bytes per second per source; 0 is unlimited.
+
+    bool per_port;
+    enum pond_shed_action action;
+    size_t top_cap;     // heavy hitters tracked; defaults to 16.
+};
+
+struct pond_shed_stats
+{
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t over;      // messages from sources over budget.
+    uint64_t invalid;   // messages without a supported source address.
+    uint64_t decays;
+};
+
+struct pond_shed_hitter
+{
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    double pkt_rate;
+    double byte_rate;
+};
+
+struct pond_shed;
+
+struct pond_shed *pond_shed_alloc(const struct pond_shed_opt *) pond_malloc;
+void pond_shed_free(struct pond_shed *);
+
+void pond_shed_stats(struct pond_shed *, struct pond_shed_stats *dst);
+
+// Accounts for a single datagram and returns true if its source is over
+// budget.
+bool pond_shed_over(
+        struct pond_shed *, uint64_t now,
+        const struct sockaddr *addr, socklen_t len, size_t bytes);
+
+// Accounts for every message of the batch and writes to order the indexes of
+// the messages to process: in-budget sources first in their received order
+// followed by the over budget ones if the action is pond_shed_defer. Returns
+// the number of indexes written which is bounded by the length of the batch.
+// Messages without a supported address are always kept.
+size_t pond_shed_filter(
+        struct pond_shed *, uint64_t now, struct pond_mmsg *, size_t *order);
+
+// Heaviest sources by packet rate in decreasing order. Sources are picked up
+// from a sample of the traffic so one that just ramped up can take a few dozen
+// packets to show up.
+size_t pond_shed_top(struct pond_shed *, struct pond_shed_hitter *dst, size_t cap);
@@ -0,0 +1,689 @@
+/* sim.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "sim.h"
+#include "net.h"
+#include "math.h"
+#include "bits.h"
+#include "errors.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    sim_default_queue_cap = 1024,
+    sim_default_msg_len = 2048,
+    sim_default_reorder_delay = 1000,
+
+    sim_port_first = 32768,
+    sim_port_last = 60999,
+};
+
+static const uint64_t sim_default_seed = 0x706F6E6473696DULL;
+
+
+// -----------------------------------------------------------------------------
+// key
+// -----------------------------------------------------------------------------
+
+struct sim_key
+{
+    uint8_t addr[16];
+    uint16_t port;
+};
+
+static bool sim_key(struct sim_key *key, const struct sockaddr *addr, socklen_t len)
+{
+    memset(key, 0, sizeof(*key));
+
+    switch (addr->sa_family) {
+
+    case AF_INET: {
+        if (len < sizeof(struct sockaddr_in)) return false;
+        const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+
+        key->addr[10] = key->addr[11] = 0xFF;
+        memcpy(key->addr + 12, &in->sin_addr, 4);
+        key->port = in->sin_port;
+        return true;
+    }
+
+    case AF_INET6: {
+        if (len < sizeof(struct sockaddr_in6)) return false;
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+
+        memcpy(key->addr, &in6->sin6_addr, 16);
+        key->port = in6->sin6_port;
+        return true;
+    }
+
+    default: return false;
+    }
+}
+
+static bool sim_key_eq(const struct sim_key *lhs, const struct sim_key *rhs)
+{
+    return !memcmp(lhs->addr, rhs->addr, sizeof(lhs->addr)) && lhs->port == rhs->port;
+}
+
+static uint64_t sim_hash(const struct sim_key *key)
+{
+    uint64_t a, b;
+    memcpy(&a, key->addr, sizeof(a));
+    memcpy(&b, key->addr + 8, sizeof(b));
+
+    uint64_t h = a * 0x9E3779B97F4A7C15ULL;
+    h ^= (b + key->port) * 0xC2B2AE3D27D4EB4FULL;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void sim_set_port(struct sockaddr_storage *addr, uint16_t port)
+{
+    if (addr->ss_family == AF_INET) ((struct sockaddr_in *) addr)->sin_port = port;
+    else ((struct sockaddr_in6 *) addr)->sin6_port = port;
+}
+
+
+// -----------------------------------------------------------------------------
+// pkt
+// -----------------------------------------------------------------------------
+
+// Datagrams are copied once on send into a pooled buffer which is then handed
+// from the in-flight queue to the receive queue of the destination without any
+// further copy until it's received.
+struct sim_pkt
+{
+    uint64_t time;
+    uint64_t seq;
+    struct sim_pkt *next;
+
+    struct sim_key dst;
+    socklen_t src_len;
+    struct sockaddr_storage src;
+
+    size_t len;
+    uint8_t data[];
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct pond_sim_udp
+{
+    struct pond_sim *sim;
+
+    struct sim_key key;
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+
+    struct pond_sim_link link;
+    uint64_t busy; // time at which the link is done serializing.
+
+    size_t head, tail;
+    struct sim_pkt **queue;
+
+    struct pond_sim_udp_stats stats;
+};
+
+struct pond_sim
+{
+    uint64_t now;
+    uint64_t rng;
+    uint64_t seq;
+
+    size_t queue_cap;
+    size_t msg_len;
+
+    // Binary min-heap on (time, seq) where the sequence number keeps datagrams
+    // arriving at the same time in the order they were sent.
+    size_t heap_len, heap_cap;
+    struct sim_pkt **heap;
+
+    struct sim_pkt *free;
+
+    // Open addressing with linear probing and backward shift deletion.
+    size_t udps_len, udps_cap;
+    struct pond_sim_udp **udps;
+    uint16_t next_port;
+
+    struct pond_sim_stats stats;
+};
+
+
+// -----------------------------------------------------------------------------
+// rng
+// -----------------------------------------------------------------------------
+
+// splitmix64
+static uint64_t sim_rand(struct pond_sim *sim)
+{
+    uint64_t z = (sim->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Draws from the generator only if p is non-zero so that enabling one knob on a
+// link doesn't change the random sequence seen by the others.
+static bool sim_chance(struct pond_sim *sim, double p)
+{
+    if (p <= 0) return false;
+    return (sim_rand(sim) >> 11) * 0x1p-53 < p;
+}
+
+
+// -----------------------------------------------------------------------------
+// pool
+// -----------------------------------------------------------------------------
+
+static struct sim_pkt *sim_pkt_alloc(struct pond_sim *sim)
+{
+    struct sim_pkt *pkt = sim->free;
+    if (pkt) {
+        sim->free = pkt->next;
+        return pkt;
+    }
+
+    pkt = malloc(sizeof(*pkt) + sim->msg_len);
+    pond_assert_alloc(pkt);
+    return pkt;
+}
+
+static void sim_pkt_free(struct pond_sim *sim, struct sim_pkt *pkt)
+{
+    pkt->next = sim->free;
+    sim->free = pkt;
+}
+
+
+// -----------------------------------------------------------------------------
+// heap
+// -----------------------------------------------------------------------------
+
+static bool sim_pkt_before(const struct sim_pkt *lhs, const struct sim_pkt *rhs)
+{
+    return lhs->time < rhs->time || (lhs->time == rhs->time && lhs->seq < rhs->seq);
+}
+
+static void sim_heap_push(struct pond_sim *sim, struct sim_pkt *pkt)
+{
+    if (sim->heap_len == sim->heap_cap) {
+        sim->heap_cap = sim->heap_cap ? sim->heap_cap * 2 : 64;
+        sim->heap = realloc(sim->heap, sim->heap_cap * sizeof(*sim->heap));
+        pond_assert_alloc(sim->heap);
+    }
+
+    struct sim_pkt **heap = sim->heap;
+
+    size_t i = sim->heap_len++;
+    while (i) {
+        size_t parent = (i - 1) / 2;
+        if (!sim_pkt_before(pkt, heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = pkt;
+}
+
+static struct sim_pkt *sim_heap_pop(struct pond_sim *sim)
+{
+    struct sim_pkt **heap = sim->heap;
+    struct sim_pkt *top = heap[0];
+
+    struct sim_pkt *last = heap[--sim->heap_len];
+    size_t len = sim->heap_len;
+
+    size_t i = 0;
+    while (true) {
+        size_t child = i * 2 + 1;
+        if (child >= len) break;
+        if (child + 1 < len && sim_pkt_before(heap[child + 1], heap[child])) child++;
+        if (!sim_pkt_before(heap[child], last)) break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (len) heap[i] = last;
+
+    return top;
+}
+
+
+// -----------------------------------------------------------------------------
+// table
+// -----------------------------------------------------------------------------
+
+static size_t sim_slot(struct pond_sim *sim, const struct sim_key *key)
+{
+    size_t mask = sim->udps_cap - 1;
+
+    size_t i = sim_hash(key) & mask;
+    for (; sim->udps[i]; i = (i + 1) & mask)
+        if (sim_key_eq(&sim->udps[i]->key, key)) break;
+
+    return i;
+}
+
+static struct pond_sim_udp *sim_find(struct pond_sim *sim, const struct sim_key *key)
+{
+    if (!sim->udps_cap) return NULL;
+    return sim->udps[sim_slot(sim, key)];
+}
+
+static void sim_insert(struct pond_sim *sim, struct pond_sim_udp *udp)
+{
+    if ((sim->udps_len + 1) * 2 > sim->udps_cap) {
+        size_t old_cap = sim->udps_cap;
+        struct pond_sim_udp **old = sim->udps;
+
+        sim->udps_cap = old_cap ? old_cap * 2 : 64;
+        sim->udps = calloc(sim->udps_cap, sizeof(*sim->udps));
+        pond_assert_alloc(sim->udps);
+
+        for (size_t i = 0; i < old_cap; ++i)
+            if (old[i]) sim->udps[sim_slot(sim, &old[i]->key)] = old[i];
+
+        free(old);
+    }
+
+    sim->udps[sim_slot(sim, &udp->key)] = udp;
+    sim->udps_len++;
+}
+
+static void sim_remove(struct pond_sim *sim, struct pond_sim_udp *udp)
+{
+    size_t mask = sim->udps_cap - 1;
+    size_t hole = sim_slot(sim, &udp->key);
+    pond_assert(sim->udps[hole] == udp, "removing unknown sim endpoint");
+
+    // Backward shift: pulls any entry of the cluster that can legally move
+    // into the hole so that lookups never need tombstones.
+    for (size_t i = (hole + 1) & mask; sim->udps[i]; i = (i + 1) & mask) {
+        size_t home = sim_hash(&sim->udps[i]->key) & mask;
+        if (((i - home) & mask) < ((i - hole) & mask)) continue;
+
+        sim->udps[hole] = sim->udps[i];
+        hole = i;
+    }
+
+    sim->udps[hole] = NULL;
+    sim->udps_len--;
+}
+
+
+// -----------------------------------------------------------------------------
+// sim
+// -----------------------------------------------------------------------------
+
+struct pond_sim *pond_sim_alloc(const struct pond_sim_opt *opt)
+{
+    struct pond_sim_opt nil = {0};
+    if (!opt) opt = &nil;
+
+    struct pond_sim *sim = calloc(1, sizeof(*sim));
+    pond_assert_alloc(sim);
+
+    sim->now = opt->now;
+    sim->rng = opt->seed ? opt->seed : sim_default_seed;
+    sim->queue_cap = pond_ceil_pow2(opt->queue_cap ? opt->queue_cap : sim_default_queue_cap);
+    sim->msg_len = opt->msg_len ? opt->msg_len : sim_default_msg_len;
+    sim->next_port = sim_port_first;
+
+    return sim;
+}
+
+void pond_sim_free(struct pond_sim *sim)
+{
+    if (!sim) return;
+
+    for (size_t i = 0; i < sim->udps_cap; ++i) {
+        while (sim->udps[i]) pond_sim_udp_close(sim->udps[i]);
+    }
+    free(sim->udps);
+
+    for (size_t i = 0; i < sim->heap_len; ++i) free(sim->heap[i]);
+    free(sim->heap);
+
+    while (sim->free) {
+        struct sim_pkt *next = sim->free->next;
+        free(sim->free);
+        sim->free = next;
+    }
+
+    free(sim);
+}
+
+void pond_sim_stats(struct pond_sim *sim, struct pond_sim_stats *dst)
+{
+    *dst = sim->stats;
+    dst->inflight = sim->heap_len;
+}
+
+uint64_t pond_sim_now(struct pond_sim *sim)
+{
+    return sim->now;
+}
+
+static void sim_deliver(struct pond_sim *sim, struct sim_pkt *pkt)
+{
+    struct pond_sim_udp *udp = sim_find(sim, &pkt->dst);
+    if (!udp) {
+        sim->stats.unroutable++;
+        sim_pkt_free(sim, pkt);
+        return;
+    }
+
+    if (udp->tail - udp->head == sim->queue_cap) {
+        udp->stats.overflow++;
+        sim->stats.overflow++;
+        sim_pkt_free(sim, pkt);
+        return;
+    }
+
+    udp->queue[udp->tail++ & (sim->queue_cap - 1)] = pkt;
+    sim->stats.delivered++;
+    sim->stats.bytes += pkt->len;
+}
+
+static void sim_run(struct pond_sim *sim)
+{
+    while (sim->heap_len && sim->heap[0]->time <= sim->now)
+        sim_deliver(sim, sim_heap_pop(sim));
+}
+
+void pond_sim_advance(struct pond_sim *sim, uint64_t delta)
+{
+    sim->now = delta > UINT64_MAX - sim->now ? UINT64_MAX : sim->now + delta;
+    sim_run(sim);
+}
+
+bool pond_sim_step(struct pond_sim *sim)
+{
+    if (!sim->heap_len) return false;
+
+    if (sim->heap[0]->time > sim->now) sim->now = sim->heap[0]->time;
+    sim_run(sim);
+    return true;
+}
+
+bool pond_sim_next(struct pond_sim *sim, uint64_t *dst)
+{
+    if (!sim->heap_len) return false;
+    *dst = sim->heap[0]->time;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// link
+// -----------------------------------------------------------------------------
+
+// Returns the arrival time of a datagram of len bytes or false if the link
+// drops it. Lost datagrams still consume bandwidth as they're lost in transit.
+static bool sim_link(struct pond_sim_udp *udp, size_t len, uint64_t *arrival)
+{
+    struct pond_sim *sim = udp->sim;
+    const struct pond_sim_link *link = &udp->link;
+
+    uint64_t depart = sim->now;
+    if (link->bandwidth) {
+        uint64_t start = pond_max(udp->busy, sim->now);
+
+        if (link->buffer) {
+            double backlog = (double) (start - sim->now) * link->bandwidth / 1e9;
+            if (backlog + len > link->buffer) {
+                sim->stats.congested++;
+                return false;
+            }
+        }
+
+        uint64_t tx = (len * 1000000000ULL + link->bandwidth - 1) / link->bandwidth;
+        depart = udp->busy = start + tx;
+    }
+
+    if (sim_chance(sim, link->loss)) {
+        sim->stats.lost++;
+        return false;
+    }
+
+    uint64_t delay = link->latency;
+    if (link->jitter) delay += sim_rand(sim) % link->jitter;
+
+    if (sim_chance(sim, link->reorder)) {
+        sim->stats.reordered++;
+        if (link->reorder_delay) delay += link->reorder_delay;
+        else delay += link->latency ? link->latency : sim_default_reorder_delay;
+    }
+
+    *arrival = depart + delay;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// udp
+// -----------------------------------------------------------------------------
+
+struct pond_sim_udp *pond_sim_udp_alloc(
+        struct pond_sim *sim,
+        const struct sockaddr *addr, socklen_t len,
+        const struct pond_sim_link *link)
+{
+    struct sim_key key;
+    if (len > sizeof(struct sockaddr_storage) || !sim_key(&key, addr, len)) {
+        pond_fail("invalid sim endpoint address: family=%u len=%u", addr->sa_family, len);
+        return NULL;
+    }
+
+    struct sockaddr_storage storage = {0};
+    memcpy(&storage, addr, len);
+
+    if (!key.port) {
+        size_t ports = sim_port_last - sim_port_first + 1;
+        for (size_t i = 0; i < ports; ++i) {
+            key.port = htons(sim->next_port);
+            sim->next_port = sim->next_port == sim_port_last ? sim_port_first : sim->next_port + 1;
+            if (!sim_find(sim, &key)) break;
+            key.port = 0;
+        }
+
+        if (!key.port) {
+            pond_fail("no ephemeral ports left in sim");
+            return NULL;
+        }
+        sim_set_port(&storage, key.port);
+    }
+    else if (sim_find(sim, &key)) {
+        pond_fail("sim endpoint address already in use");
+        return NULL;
+    }
+
+    struct pond_sim_udp *udp = calloc(1, sizeof(*udp));
+    pond_assert_alloc(udp);
+
+    udp->sim = sim;
+    udp->key = key;
+    udp->addr_len = len;
+    udp->addr = storage;
+    if (link) udp->link = *link;
+
+    udp->queue = calloc(sim->queue_cap, sizeof(*udp->queue));
+    pond_assert_alloc(udp->queue);
+
+    sim_insert(sim, udp);
+    return udp;
+}
+
+// Datagrams still in flight towards the endpoint become unroutable.
+void pond_sim_udp_close(struct pond_sim_udp *udp)
+{
+    if (!udp) return;
+
+    struct pond_sim *sim = udp->sim;
+    sim_remove(sim, udp);
+
+    for (; udp->head != udp->tail; udp->head++)
+        sim_pkt_free(sim, udp->queue[udp->head & (sim->queue_cap - 1)]);
+
+    free(udp->queue);
+    free(udp);
+}
+
+const struct sockaddr *pond_sim_udp_local(struct pond_sim_udp *udp, socklen_t *len)
+{
+    *len = udp->addr_len;
+    return (struct sockaddr *) &udp->addr;
+}
+
+void pond_sim_udp_stats(struct pond_sim_udp *udp, struct pond_sim_udp_stats *dst)
+{
+    *dst = udp->stats;
+    dst->queued = udp->tail - udp->head;
+}
+
+void pond_sim_udp_link(struct pond_sim_udp *udp, const struct pond_sim_link *link)
+{
+    udp->link = link ? *link : (struct pond_sim_link) {0};
+}
+
+bool pond_sim_udp_mrecv(struct pond_sim_udp *udp, struct pond_mmsg *dst, size_t len)
+{
+    struct pond_sim *sim = udp->sim;
+    sim_run(sim);
+
+    len = pond_min(len, pond_mmsg_cap(dst));
+    len = pond_min(len, udp->tail - udp->head);
+
+    for (size_t i = 0; i < len; ++i) {
+        struct sim_pkt *pkt = udp->queue[udp->head++ & (sim->queue_cap - 1)];
+        struct pond_iovec *iovec = pond_mmsg_iovec(dst, i);
+
+        size_t off = 0;
+        iovec->len = 0;
+        for (size_t j = 0; j < iovec->cap; ++j) {
+            struct pond_iov *iov = &iovec->vec[j];
+            iov->len = pond_min(pkt->len - off, iov->cap);
+            memcpy(iov->bin, pkt->data + off, iov->len);
+            off += iov->len;
+            if (iov->len) iovec->len = j + 1;
+        }
+
+        pond_mmsg_header(dst, i)->msg_flags = off < pkt->len ? MSG_TRUNC : 0;
+        pond_mmsg_set_addr(dst, i, (struct sockaddr *) &pkt->src, pkt->src_len);
+        sim_pkt_free(sim, pkt);
+    }
+
+    pond_mmsg_set_len(dst, len);
+
+    udp->stats.recv_calls++;
+    udp->stats.recv_msgs += len;
+    return true;
+}
+
+// Routes a datagram of bytes to addr and sets pkt to the packet its payload
+// should be copied into before it's pushed in flight or to NULL if the link
+// dropped it.
+static bool sim_send(
+        struct pond_sim_udp *udp, const struct sockaddr *addr, socklen_t addr_len,
+        size_t bytes, struct sim_pkt **pkt)
+{
+    struct pond_sim *sim = udp->sim;
+    *pkt = NULL;
+
+    struct sim_key dst;
+    if (!addr_len || !sim_key(&dst, addr, addr_len)) {
+        pond_fail("invalid sim destination address: family=%u len=%u",
+                addr_len ? addr->sa_family : 0, addr_len);
+        return false;
+    }
+
+    if (bytes > sim->msg_len) {
+        pond_fail("sim datagram too large: %zu > %zu", bytes, sim->msg_len);
+        return false;
+    }
+
+    udp->stats.send_msgs++;
+    sim->stats.sent++;
+
+    uint64_t arrival = 0;
+    if (!sim_link(udp, bytes, &arrival)) return true;
+
+    *pkt = sim_pkt_alloc(sim);
+    (*pkt)->time = arrival;
+    (*pkt)->seq = sim->seq++;
+    (*pkt)->dst = dst;
+    (*pkt)->src_len = udp->addr_len;
+    (*pkt)->src = udp->addr;
+    (*pkt)->len = bytes;
+    return true;
+}
+
+bool pond_sim_udp_msend(struct pond_sim_udp *udp, struct pond_mmsg *src, size_t len)
+{
+    len = pond_min(len, pond_mmsg_cap(src));
+    udp->stats.send_calls++;
+
+    for (size_t i = 0; i < len; ++i) {
+        socklen_t addr_len = 0;
+        const struct sockaddr *addr = pond_mmsg_addr(src, i, &addr_len);
+        const struct pond_iovec *iovec = pond_mmsg_iovec(src, i);
+
+        size_t bytes = 0;
+        for (size_t j = 0; j < iovec->len; ++j) bytes += iovec->vec[j].len;
+
+        struct sim_pkt *pkt = NULL;
+        if (!sim_send(udp, addr, addr_len, bytes, &pkt)) return false;
+        if (!pkt) continue;
+
+        size_t off = 0;
+        for (size_t j = 0; j < iovec->len; ++j) {
+            memcpy(pkt->data + off, iovec->vec[j].bin, iovec->vec[j].len);
+            off += iovec->vec[j].len;
+        }
+
+        sim_heap_push(udp->sim, pkt);
+    }
+
+    return true;
+}
+
+bool pond_sim_udp_msend_sys(struct pond_sim_udp *udp, struct mmsghdr *src, size_t len)
+{
+    udp->stats.send_calls++;
+
+    for (size_t i = 0; i < len; ++i) {
+        const struct msghdr *hdr = &src[i].msg_hdr;
+
+        size_t bytes = 0;
+        for (size_t j = 0; j < hdr->msg_iovlen; ++j) bytes += hdr->msg_iov[j].iov_len;
+
+        struct sim_pkt *pkt = NULL;
+        if (!sim_send(udp, hdr->msg_name, hdr->msg_namelen, bytes, &pkt)) return false;
+        src[i].msg_len = bytes;
+        if (!pkt) continue;
+
+        size_t off = 0;
+        for (size_t j = 0; j < hdr->msg_iovlen; ++j) {
+            memcpy(pkt->data + off, hdr->msg_iov[j].iov_base, hdr->msg_iov[j].iov_len);
+            off += hdr->msg_iov[j].iov_len;
+        }
+
+        sim_heap_push(udp->sim, pkt);
+    }
+
+    return true;
+}
@@ -0,0 +1,147 @@
+/* sim.h
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   In-process simulated network for pond_udp style endpoints.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_mmsg;
+struct mmsghdr;
+
+
+// -----------------------------------------------------------------------------
+// sim
+// -----------------------------------------------------------------------------
+
+// Endpoints exchange pond_mmsg batches through in-memory queues instead of
+// sockets so that application logic can be run against hundreds of peers in a
+// single process without paying for any syscall. Time is virtual and only
+// moves when the sim is advanced which, along with a seeded generator for
+// every random decision, makes each run exactly reproducible.
+//
+// Datagrams in flight are kept in a single queue ordered by arrival time and
+// are moved to the receive queue of their destination as the clock passes
+// their arrival. Nothing is thread-safe: the whole sim is meant to be driven
+// from one thread.
+
+struct pond_sim_opt
+{
+    uint64_t seed;   // 0 picks a fixed default seed.
+    uint64_t now;    // initial value of the virtual clock.
+    size_t queue_cap; // receive queue length of each endpoint; defaults to 1024.
+    size_t msg_len;   // max datagram length; defaults to 2048.
+};
+
+struct pond_sim_stats
+{
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t bytes;      // payload bytes delivered.
+    uint64_t lost;       // dropped by the loss probability of a link.
+    uint64_t congested;  // dropped because the buffer of a link was full.
+    uint64_t overflow;   // dropped because the receive queue was full.
+    uint64_t unroutable; // sent to an address without an endpoint.
+    uint64_t reordered;  // held back by the reorder probability of a link.
+    size_t inflight;
+};
+
+struct pond_sim;
+
+struct pond_sim *pond_sim_alloc(const struct pond_sim_opt *) pond_malloc;
+void pond_sim_free(struct pond_sim *);
+
+void pond_sim_stats(struct pond_sim *, struct pond_sim_stats *dst);
+
+uint64_t pond_sim_now(struct pond_sim *);
+
+// Moves the clock forward by delta nanoseconds and delivers every datagram
+// whose arrival falls before the new time.
+void pond_sim_advance(struct pond_sim *, uint64_t delta);
+
+// Moves the clock to the arrival of the next datagram in flight and delivers
+// it along with any other arriving at the same time. Returns false if nothing
+// is in flight in which case the clock doesn't move.
+bool pond_sim_step(struct pond_sim *);
+
+// Sets dst to the arrival of the next datagram in flight if any.
+bool pond_sim_next(struct pond_sim *, uint64_t *dst);
+
+
+// -----------------------------------------------------------------------------
+// link
+// -----------------------------------------------------------------------------
+
+// Shapes the datagrams sent by an endpoint, much like a qdisc on its uplink.
+// Every datagram is first serialized at the bandwidth of the link behind the
+// ones already queued and then propagated after the latency plus a uniformly
+// distributed jitter. A jitter larger than the gap between two datagrams also
+// reorders them.
+//
+// All fields default to an ideal link when 0.
+
+struct pond_sim_link
+{
+    uint64_t latency;    // one-way delay in nanoseconds.
+    uint64_t jitter;     // extra delay in [0, jitter) nanoseconds.
+    uint64_t bandwidth;  // bytes per second; 0 is unlimited.
+    size_t buffer;       // bytes waiting to be serialized before dropping; 0 is unlimited.
+
+    double loss;         // probability that a datagram is dropped.
+    double reorder;      // probability that a datagram is held back by reorder_delay.
+    uint64_t reorder_delay; // defaults to the latency or 1us if there's none.
+};
+
+
+// -----------------------------------------------------------------------------
+// udp
+// -----------------------------------------------------------------------------
+
+// Endpoints are identified by an IPv4 or IPv6 address where port 0 picks an
+// unused ephemeral port. Received messages carry the address of their sender.
+// They're meant to be used through pond_udp_sim which puts a pond_udp in front
+// of them so that code written against pond_udp, pond_rpc included, runs on
+// the sim unmodified. The endpoint calls below are what that backend uses.
+
+struct pond_sim_udp_stats
+{
+    uint64_t recv_calls;
+    uint64_t recv_msgs;
+    uint64_t send_calls;
+    uint64_t send_msgs;
+    uint64_t overflow;   // datagrams dropped on arrival because the queue was full.
+    size_t queued;       // datagrams waiting to be received.
+};
+
+struct pond_sim_udp;
+
+struct pond_sim_udp *pond_sim_udp_alloc(
+        struct pond_sim *,
+        const struct sockaddr *addr, socklen_t len,
+        const struct pond_sim_link *link) pond_malloc;
+void pond_sim_udp_close(struct pond_sim_udp *);
+
+const struct sockaddr *pond_sim_udp_local(struct pond_sim_udp *, socklen_t *len);
+void pond_sim_udp_stats(struct pond_sim_udp *, struct pond_sim_udp_stats *dst);
+
+// Changing the link only affects datagrams sent afterwards.
+void pond_sim_udp_link(struct pond_sim_udp *, const struct pond_sim_link *link);
+
+// Never blocks: the clock only moves through pond_sim_advance and co.
+bool pond_sim_udp_mrecv(struct pond_sim_udp *, struct pond_mmsg *dst, size_t len);
+bool pond_sim_udp_msend(struct pond_sim_udp *, struct pond_mmsg *src, size_t len);
+bool pond_sim_udp_msend_sys(struct pond_sim_udp *, struct mmsghdr *src, size_t len);
@@ -0,0 +1,247 @@
+/* timer.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "timer.h"
+#include "net.h"
+#include "bits.h"
+#include "math.h"
+#include "process.h"
+#include "errors.h"
+
+#include <string.h>
+
+
+// -----------------------------------------------------------------------------
+// timer
+// -----------------------------------------------------------------------------
+
+void pond_timer_init(struct pond_timer *timer, pond_timer_fn fn, void *data)
+{
+    *timer = (struct pond_timer) { .fn = fn, .data = data };
+}
+
+
+// -----------------------------------------------------------------------------
+// wheel
+// -----------------------------------------------------------------------------
+
+// Each level covers 64 times the range of the level below it so 6 levels cover
+// 2^36 ticks which is over 19 hours with a 1us tick. Timers beyond that are
+// parked on the last slot of the top level to be re-placed when it cascades.
+enum
+{
+    wheel_bits = 6,
+    wheel_slots = 1 << wheel_bits,
+    wheel_mask = wheel_slots - 1,
+    wheel_levels = 6,
+};
+
+struct pond_wheel
+{
+    uint64_t tick_ns;
+    uint64_t ticks; // last processed tick.
+    uint64_t now;
+    size_t len;
+
+    uint64_t bitmap[wheel_levels];
+    struct pond_timer *slots[wheel_levels][wheel_slots];
+};
+
+
+struct pond_wheel *pond_wheel_alloc(uint64_t tick, uint64_t now)
+{
+    pond_assert(tick > 0, "invalid tick: %lu", tick);
+
+    struct pond_wheel *wheel = calloc(1, sizeof(*wheel));
+    pond_assert_alloc(wheel);
+
+    wheel->tick_ns = tick;
+    wheel->ticks = now / tick;
+    wheel->now = now;
+    return wheel;
+}
+
+void pond_wheel_free(struct pond_wheel *wheel)
+{
+    free(wheel);
+}
+
+size_t pond_wheel_len(struct pond_wheel *wheel)
+{
+    return wheel->len;
+}
+
+uint64_t pond_wheel_now(struct pond_wheel *wheel)
+{
+    return wheel->now;
+}
+
+
+// The level is picked from the highest group of bits that differs from the
+// reference tick which guarantees that the slot is reached by a cascade
+// before the timer expires.
+static void wheel_place(struct pond_wheel *wheel, struct pond_timer *timer, uint64_t ref)
+{
+    uint64_t diff = timer->tick ^ ref;
+    size_t level = diff < wheel_slots ? 0 : (63 - pond_clz(diff)) / wheel_bits;
+
+    size_t slot;
+    if (pond_likely(level < wheel_levels))
+        slot = (timer->tick >> (level * wheel_bits)) & wheel_mask;
+    else {
+        level = wheel_levels - 1;
+        slot = ((ref >> (level * wheel_bits)) + wheel_mask) & wheel_mask;
+    }
+
+    struct pond_timer **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    timer->prev = head;
+    if (timer->next) timer->next->prev = &timer->next;
+    *head = timer;
+
+    timer->level = level;
+    timer->slot = slot;
+    wheel->bitmap[level] |= 1ULL << slot;
+}
+
+static void wheel_unlink(struct pond_wheel *wheel, struct pond_timer *timer)
+{
+    *timer->prev = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+
+    if (!wheel->slots[timer->level][timer->slot])
+        wheel->bitmap[timer->level] &= ~(1ULL << timer->slot);
+
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+void pond_wheel_add(struct pond_wheel *wheel, struct pond_timer *timer, uint64_t deadline)
+{
+    if (pond_timer_armed(timer)) wheel_unlink(wheel, timer);
+    else wheel->len++;
+
+    uint64_t tick = pond_ceil_div(deadline, wheel->tick_ns);
+    timer->tick = pond_max(tick, wheel->ticks + 1);
+    wheel_place(wheel, timer, wheel->ticks);
+}
+
+void pond_wheel_cancel(struct pond_wheel *wheel, struct pond_timer *timer)
+{
+    if (!pond_timer_armed(timer)) return;
+
+    wheel_unlink(wheel, timer);
+    wheel->len--;
+}
+
+
+uint64_t pond_wheel_next(struct pond_wheel *wheel)
+{
+    if (!wheel->len) return UINT64_MAX;
+
+    for (size_t level = 0; level < wheel_levels; ++level) {
+        uint64_t bitmap = wheel->bitmap[level];
+        if (!bitmap) continue;
+
+        size_t shift = level * wheel_bits;
+        uint64_t base = wheel->ticks >> shift;
+        size_t index = base & wheel_mask;
+
+        // Slots at or before the current index belong to the next rotation.
+        uint64_t ahead = index == wheel_mask ? 0 : bitmap & ~((2ULL << index) - 1);
+        uint64_t tick = ahead ?
+            (base & ~(uint64_t) wheel_mask) | pond_ctz(ahead) :
+            (base | wheel_mask) + 1 + pond_ctz(bitmap);
+
+        return (tick << shift) * wheel->tick_ns;
+    }
+
+    pond_unreachable();
+}
+
+
+static void wheel_cascade(struct pond_wheel *wheel, uint64_t tick)
+{
+    for (size_t level = 1; level < wheel_levels; ++level) {
+        size_t shift = level * wheel_bits;
+        if (tick & ((1ULL << shift) - 1)) break;
+
+        size_t slot = (tick >> shift) & wheel_mask;
+        struct pond_timer *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->bitmap[level] &= ~(1ULL << slot);
+
+        while (timer) {
+            struct pond_timer *next = timer->next;
+            wheel_place(wheel, timer, tick);
+            timer = next;
+        }
+    }
+}
+
+static size_t wheel_fire(struct pond_wheel *wheel, size_t slot)
+{
+    size_t fired = 0;
+
+    // Callbacks are free to add or cancel any timer including the ones that
+    // are still in this slot so we always restart from the head.
+    struct pond_timer **head = &wheel->slots[0][slot];
+    while (*head) {
+        struct pond_timer *timer = *head;
+        wheel_unlink(wheel, timer);
+        wheel->len--;
+
+        timer->fn(timer);
+        fired++;
+    }
+
+    return fired;
+}
+
+size_t pond_wheel_advance(struct pond_wheel *wheel, uint64_t now)
+{
+    wheel->now = pond_max(wheel->now, now);
+
+    uint64_t target = wheel->now / wheel->tick_ns;
+    if (!wheel->len) { wheel->ticks = pond_max(wheel->ticks, target); return 0; }
+
+    size_t fired = 0;
+    while (wheel->ticks < target) {
+        uint64_t tick = wheel->ticks + 1;
+        size_t index = tick & wheel_mask;
+
+        // Skip straight to the next occupied level 0 slot or to the next
+        // cascade whichever comes first.
+        if (index) {
+            uint64_t ahead = wheel->bitmap[0] & ~((1ULL << index) - 1);
+            uint64_t next = ahead ?
+                (tick & ~(uint64_t) wheel_mask) | pond_ctz(ahead) :
+                (tick | wheel_mask) + 1;
+
+            if (next > target) { wheel->ticks = target; break; }
+            tick = next;
+        }
+
+        wheel->ticks = tick;
+        wheel_cascade(wheel, tick);
+        fired += wheel_fire(wheel, tick & wheel_mask);
+    }
+
+    return fired;
+}
+
+
+bool pond_wheel_mrecv(
+        struct pond_wheel *wheel, struct pond_udp *udp, struct pond_mmsg *dst, size_t len)
+{
+    uint64_t next = pond_wheel_next(wheel);
+    uint64_t timeout = UINT64_MAX;
+    if (next != UINT64_MAX) timeout = next > wheel->now ? next - wheel->now : 0;
+
+    if (!pond_udp_mrecv_timeout(udp, dst, len, timeout)) return false;
+
+    pond_wheel_advance(wheel, pond_now());
+    return true;
+}
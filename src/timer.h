@@ -0,0 +1,80 @@
+/* timer.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Hierarchical timer wheel with O(1) insert and cancel.
+*/
+
+#pragma once
+
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// fwd decl
+// -----------------------------------------------------------------------------
+
+struct pond_udp;
+struct pond_mmsg;
+
+
+// -----------------------------------------------------------------------------
+// timer
+// -----------------------------------------------------------------------------
+
+struct pond_timer;
+typedef void (*pond_timer_fn) (struct pond_timer *);
+
+// Meant to be embedded in the object that owns the timeout. The fields are
+// managed by the wheel and shouldn't be touched once the timer is armed.
+struct pond_timer
+{
+    struct pond_timer *next;
+    struct pond_timer **prev;
+
+    uint64_t tick;
+    uint8_t level, slot;
+
+    pond_timer_fn fn;
+    void *data;
+};
+
+void pond_timer_init(struct pond_timer *, pond_timer_fn fn, void *data);
+inline bool pond_timer_armed(const struct pond_timer *timer) { return timer->prev; }
+
+
+// -----------------------------------------------------------------------------
+// wheel
+// -----------------------------------------------------------------------------
+
+struct pond_wheel;
+
+// tick is the resolution of the wheel in nanoseconds. Timers never fire before
+// their deadline but can fire up to one tick after it.
+struct pond_wheel *pond_wheel_alloc(uint64_t tick, uint64_t now) pond_malloc;
+void pond_wheel_free(struct pond_wheel *);
+
+size_t pond_wheel_len(struct pond_wheel *);
+
+// Cached clock as of the last advance which is cheaper then reading the clock
+// for every message of a batch.
+uint64_t pond_wheel_now(struct pond_wheel *);
+
+void pond_wheel_add(struct pond_wheel *, struct pond_timer *, uint64_t deadline);
+void pond_wheel_cancel(struct pond_wheel *, struct pond_timer *);
+
+// Lower bound on the next deadline or UINT64_MAX if the wheel is empty.
+uint64_t pond_wheel_next(struct pond_wheel *);
+
+// Fires every timer whose deadline is before now and returns how many fired.
+size_t pond_wheel_advance(struct pond_wheel *, uint64_t now);
+
+// Receives a batch while waiting no longer then the next deadline and then
+// fires the expired timers from a single clock read. Meant to be called in a
+// loop in place of pond_udp_mrecv.
+bool pond_wheel_mrecv(
+        struct pond_wheel *, struct pond_udp *, struct pond_mmsg *dst, size_t len);
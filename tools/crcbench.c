@@ -0,0 +1,160 @@
+/* crcbench.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Cost of pond_crc32c against memcpy of the same payloads.
+
+   usage: crcbench [-b batch] [-d seconds]
+
+   For every payload size, a batch of that many payloads laid out back to back
+   is either checksummed one payload at a time with pond_crc32c or copied one
+   payload at a time with memcpy into a second buffer of the same layout. The
+   buffers of the larger sizes no longer fit in cache which is also the case of
+   a batch fresh out of recvmmsg that's about to be copied out or checked.
+*/
+
+#include "crc.h"
+#include "process.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+struct config
+{
+    size_t batch;
+    uint64_t duration;
+};
+
+static const size_t sizes[] = { 64, 256, 512, 1024, 1472, 4096, 9000, 65507 };
+enum { sizes_len = sizeof(sizes) / sizeof(sizes[0]) };
+
+
+// -----------------------------------------------------------------------------
+// bench
+// -----------------------------------------------------------------------------
+
+struct result
+{
+    uint64_t bytes;
+    uint64_t elapsed;
+};
+
+static void bench_crc(
+        const struct config *config, size_t size, const uint8_t *src,
+        struct result *result)
+{
+    uint64_t end = pond_now() + config->duration * 1000 * 1000 * 1000 / sizes_len / 2;
+    uint32_t crc = 0;
+
+    *result = (struct result) {0};
+    while (pond_now() < end) {
+        uint64_t start = pond_clock();
+
+        for (size_t i = 0; i < config->batch; ++i)
+            crc ^= pond_crc32c(0, src + i * size, size);
+
+        result->elapsed += pond_clock() - start;
+        result->bytes += config->batch * size;
+    }
+
+    pond_no_opt_val(crc);
+}
+
+static void bench_memcpy(
+        const struct config *config, size_t size, const uint8_t *src, uint8_t *dst,
+        struct result *result)
+{
+    uint64_t end = pond_now() + config->duration * 1000 * 1000 * 1000 / sizes_len / 2;
+
+    *result = (struct result) {0};
+    while (pond_now() < end) {
+        uint64_t start = pond_clock();
+
+        for (size_t i = 0; i < config->batch; ++i) {
+            memcpy(dst + i * size, src + i * size, size);
+            pond_no_opt_clobber();
+        }
+
+        result->elapsed += pond_clock() - start;
+        result->bytes += config->batch * size;
+    }
+}
+
+static void report(size_t size, const struct result *crc, const struct result *copy)
+{
+    double crc_gbs = (double) crc->bytes / crc->elapsed;
+    double copy_gbs = (double) copy->bytes / copy->elapsed;
+
+    printf("%6zu  %8.1f  %8.2f  %8.1f  %8.2f  %7.2fx\n",
+            size,
+            (double) crc->elapsed / (crc->bytes / size), crc_gbs,
+            (double) copy->elapsed / (copy->bytes / size), copy_gbs,
+            copy_gbs / crc_gbs);
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-b batch] [-d seconds]\n"
+            "\n"
+            "  -b  payloads per batch (default 64)\n"
+            "  -d  total duration in seconds (default 8)\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {
+        .batch = 64,
+        .duration = 8,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:h")) != -1) {
+        switch (opt) {
+        case 'b': config.batch = strtoull(optarg, NULL, 10); break;
+        case 'd': config.duration = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || !config.batch || !config.duration) usage(argv[0]);
+
+    size_t cap = config.batch * sizes[sizes_len - 1];
+    uint8_t *src = malloc(cap);
+    uint8_t *dst = malloc(cap);
+    pond_assert_alloc(src);
+    pond_assert_alloc(dst);
+
+    for (size_t i = 0; i < cap; ++i) src[i] = i * 0x9E3779B1;
+    memset(dst, 0, cap);
+
+    pond_clock_init();
+
+    printf("batch=%zu\n", config.batch);
+    printf("%6s  %8s  %8s  %8s  %8s  %8s\n",
+            "size", "crc ns", "crc GB/s", "copy ns", "copy GB/s", "crc/copy");
+
+    for (size_t i = 0; i < sizes_len; ++i) {
+        struct result crc, copy;
+        bench_crc(&config, sizes[i], src, &crc);
+        bench_memcpy(&config, sizes[i], src, dst, &copy);
+        report(sizes[i], &crc, &copy);
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,521 @@
+/* loadgen.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Open-loop UDP load generator and echo server built on pond_udp.
+
+   usage: loadgen [-t threads] [-r pps] [-P] [-s min[-max]|imix] [-b batch]
+                  [-d seconds] <host:port>
+          loadgen -E [-t threads] [-b batch] <host:port>
+
+   Every sender thread owns a connected socket pinned to its own cpu and sends
+   batches on a schedule fixed ahead of time, either at a constant rate or with
+   Poisson arrivals. Each datagram carries its scheduled send time which the
+   echoed copy brings back so that the measured latency includes any delay in
+   sending it (no coordinated omission). Round trips are recorded in a log-linear
+   histogram with 32 sub-buckets per power of two (~3% precision).
+*/
+
+#include "net.h"
+#include "math.h"
+#include "process.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+// -----------------------------------------------------------------------------
+// hist
+// -----------------------------------------------------------------------------
+
+enum
+{
+    hist_sub_bits = 5,
+    hist_sub = 1 << hist_sub_bits,
+    hist_len = (64 - hist_sub_bits + 1) * hist_sub,
+};
+
+struct hist
+{
+    atomic_uint_fast64_t count[hist_len];
+    atomic_uint_fast64_t max;
+};
+
+static size_t hist_index(uint64_t value)
+{
+    if (value < hist_sub) return value;
+
+    size_t exp = 63 - __builtin_clzll(value);
+    size_t shift = exp - hist_sub_bits;
+    size_t sub = (value >> shift) & (hist_sub - 1);
+    return (shift + 1) * hist_sub + sub;
+}
+
+static uint64_t hist_value(size_t index)
+{
+    if (index < hist_sub) return index;
+
+    size_t shift = index / hist_sub - 1;
+    size_t sub = index % hist_sub;
+    return ((uint64_t) (hist_sub + sub) << shift) + ((1ULL << shift) - 1);
+}
+
+// Only ever written by its owning thread so relaxed load-add-store is enough.
+static void hist_record(struct hist *hist, uint64_t value)
+{
+    atomic_uint_fast64_t *count = &hist->count[hist_index(value)];
+    atomic_store_explicit(count,
+            atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed))
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+}
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum size_dist { size_fixed, size_uniform, size_imix };
+
+struct config
+{
+    struct pond_host *host;
+    bool echo;
+    size_t threads;
+    uint64_t rate;
+    bool poisson;
+    enum size_dist dist;
+    size_t size_min, size_max;
+    size_t batch;
+    uint64_t duration;
+};
+
+struct payload
+{
+    uint64_t magic;
+    uint64_t seq;
+    uint64_t ts;
+};
+
+static const uint64_t payload_magic = 0x6e6567646164676cULL;
+static const uint64_t drain_ns = 200 * 1000 * 1000;
+
+static atomic_bool done = false;
+
+
+// -----------------------------------------------------------------------------
+// sender
+// -----------------------------------------------------------------------------
+
+struct sender
+{
+    pthread_t thread;
+    size_t id;
+    const struct config *config;
+
+    uint64_t rng;
+    struct hist hist;
+
+    atomic_uint_fast64_t sent;
+    atomic_uint_fast64_t recv;
+    atomic_uint_fast64_t invalid;
+    atomic_uint_fast64_t late; // sends that fell more than a batch behind schedule.
+};
+
+// xorshift64*
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_unit(uint64_t *state)
+{
+    return (rng_next(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static size_t sender_size(struct sender *sender)
+{
+    const struct config *config = sender->config;
+
+    switch (config->dist)
+    {
+    case size_fixed: return config->size_min;
+    case size_uniform:
+        return config->size_min + rng_next(&sender->rng) % (config->size_max - config->size_min + 1);
+    case size_imix: {
+        // 7:4:1 mix of small, medium and full sized datagrams.
+        uint64_t pick = rng_next(&sender->rng) % 12;
+        return pick < 7 ? 64 : pick < 11 ? 576 : 1472;
+    }
+    default: pond_unreachable();
+    }
+}
+
+static uint64_t sender_gap(struct sender *sender, uint64_t rate)
+{
+    double mean = 1e9 / rate;
+    if (!sender->config->poisson) return mean;
+
+    // <math.h> is shadowed by our own math.h on the include path.
+    double u = rng_unit(&sender->rng);
+    return -__builtin_log(1.0 - u) * mean;
+}
+
+static void sender_counter_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter,
+            atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void sender_drain(struct sender *sender, struct pond_udp *udp, struct pond_mmsg *rx, uint64_t wait)
+{
+    if (!pond_udp_mrecv_timeout(udp, rx, pond_mmsg_cap(rx), wait)) {
+        pond_perror(&pond_errno);
+        return;
+    }
+
+    uint64_t now = pond_now();
+    for (size_t i = 0; i < pond_mmsg_len(rx); ++i) {
+        struct pond_iov *iov = &pond_mmsg_iovec(rx, i)->vec[0];
+
+        struct payload payload;
+        if (iov->len < sizeof(payload)) { sender_counter_add(&sender->invalid, 1); continue; }
+        memcpy(&payload, iov->bin, sizeof(payload));
+        if (payload.magic != payload_magic) { sender_counter_add(&sender->invalid, 1); continue; }
+
+        hist_record(&sender->hist, now > payload.ts ? now - payload.ts : 0);
+    }
+
+    sender_counter_add(&sender->recv, pond_mmsg_len(rx));
+}
+
+static void *sender_run(void *data)
+{
+    struct sender *sender = data;
+    const struct config *config = sender->config;
+
+    (void) pond_pin(sender->id % pond_cpus());
+
+    struct pond_udp *udp = pond_udp_client(config->host, &(struct pond_udp_opt) {
+                .rcvbuf = 4 << 20,
+                .sndbuf = 4 << 20,
+            });
+    if (!udp) { pond_perror(&pond_errno); return NULL; }
+
+    size_t max = config->dist == size_imix ? 1472 : config->size_max;
+    size_t sizes[] = { pond_max(max, sizeof(struct payload)) };
+    struct pond_mmsg *tx = pond_mmsg_alloc(config->batch, sizes, 1);
+    struct pond_mmsg *rx = pond_mmsg_alloc(config->batch, sizes, 1);
+
+    uint64_t rate = config->rate / config->threads;
+    uint64_t seq = 0;
+    uint64_t next = pond_now();
+
+    while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+        uint64_t now = pond_now();
+
+        size_t len = 0;
+        while (len < config->batch && (!rate || next <= now)) {
+            struct pond_iovec *iovec = pond_mmsg_iovec(tx, len++);
+            struct pond_iov *iov = &iovec->vec[0];
+
+            struct payload payload = {
+                .magic = payload_magic,
+                .seq = seq++,
+                .ts = rate ? next : now,
+            };
+
+            iovec->len = 1;
+            iov->len = pond_max(sender_size(sender), sizeof(payload));
+            memcpy(iov->bin, &payload, sizeof(payload));
+
+            if (rate) next += sender_gap(sender, rate);
+        }
+
+        if (len) {
+            if (!pond_udp_msend(udp, tx, len)) pond_perror(&pond_errno);
+            sender_counter_add(&sender->sent, len);
+            if (rate && next <= now) sender_counter_add(&sender->late, 1);
+        }
+
+        now = pond_now();
+        uint64_t wait = !rate || next <= now ? 0 : next - now;
+        sender_drain(sender, udp, rx, wait);
+    }
+
+    // Gives the echoes still in flight a chance to make it back before the
+    // final report counts them as lost.
+    uint64_t end = pond_now() + drain_ns;
+    for (uint64_t now = pond_now(); now < end; now = pond_now())
+        sender_drain(sender, udp, rx, end - now);
+
+    pond_mmsg_free(tx);
+    pond_mmsg_free(rx);
+    pond_udp_close(udp);
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// echo
+// -----------------------------------------------------------------------------
+
+struct echo
+{
+    pthread_t thread;
+    size_t id;
+    const struct config *config;
+    atomic_uint_fast64_t recv;
+};
+
+static void *echo_run(void *data)
+{
+    struct echo *echo = data;
+    const struct config *config = echo->config;
+
+    (void) pond_pin(echo->id % pond_cpus());
+
+    struct pond_udp *udp = pond_udp_server(config->host, &(struct pond_udp_opt) {
+                .reuse_port = true,
+                .cpu_affinity = true,
+                .rcvbuf = 4 << 20,
+                .sndbuf = 4 << 20,
+            });
+    if (!udp) { pond_perror(&pond_errno); return NULL; }
+
+    size_t sizes[] = { 2048 };
+    struct pond_mmsg *mmsg = pond_mmsg_alloc(config->batch, sizes, 1);
+
+    while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+        if (!pond_udp_mrecv_adapt(udp, mmsg)) { pond_perror(&pond_errno); break; }
+
+        size_t len = pond_mmsg_len(mmsg);
+        if (!len) continue;
+
+        if (!pond_udp_msend(udp, mmsg, len)) pond_perror(&pond_errno);
+        sender_counter_add(&echo->recv, len);
+    }
+
+    pond_mmsg_free(mmsg);
+    pond_udp_close(udp);
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// report
+// -----------------------------------------------------------------------------
+
+static uint64_t load(atomic_uint_fast64_t *value)
+{
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static uint64_t report_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+    uint64_t target = p * total;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < hist_len; ++i) {
+        sum += hist[i];
+        if (sum > target) return hist_value(i);
+    }
+    return 0;
+}
+
+static void report_ns(char *dst, size_t len, uint64_t ns)
+{
+    if (ns < 1000) snprintf(dst, len, "%luns", ns);
+    else if (ns < 1000 * 1000) snprintf(dst, len, "%.1fus", ns / 1e3);
+    else snprintf(dst, len, "%.1fms", ns / 1e6);
+}
+
+struct report
+{
+    uint64_t sent, recv, late;
+    uint64_t hist[hist_len];
+};
+
+static void report(
+        const struct config *config, struct sender *senders,
+        struct report *prev, uint64_t elapsed, bool final)
+{
+    struct report now = {0};
+    uint64_t max = 0;
+
+    for (size_t i = 0; i < config->threads; ++i) {
+        struct sender *sender = &senders[i];
+        now.sent += load(&sender->sent);
+        now.recv += load(&sender->recv);
+        now.late += load(&sender->late);
+        max = pond_max(max, load(&sender->hist.max));
+        for (size_t j = 0; j < hist_len; ++j) now.hist[j] += load(&sender->hist.count[j]);
+    }
+
+    // The final report covers the whole run while the periodic ones only cover
+    // the last interval.
+    uint64_t hist[hist_len];
+    uint64_t total = 0;
+    for (size_t j = 0; j < hist_len; ++j) {
+        hist[j] = now.hist[j] - (final ? 0 : prev->hist[j]);
+        total += hist[j];
+    }
+
+    // Anything sent before the previous report and still missing is counted
+    // as dropped which leaves a full interval for the echo to make it back.
+    uint64_t lost = prev->sent > now.recv ? prev->sent - now.recv : 0;
+    if (final) lost = now.sent > now.recv ? now.sent - now.recv : 0;
+
+    // Buckets report their upper bound which can overshoot the actual max.
+    char p50[16], p90[16], p99[16], p999[16], pmax[16];
+    report_ns(p50, sizeof(p50), pond_min(report_percentile(hist, total, 0.50), max));
+    report_ns(p90, sizeof(p90), pond_min(report_percentile(hist, total, 0.90), max));
+    report_ns(p99, sizeof(p99), pond_min(report_percentile(hist, total, 0.99), max));
+    report_ns(p999, sizeof(p999), pond_min(report_percentile(hist, total, 0.999), max));
+    report_ns(pmax, sizeof(pmax), max);
+
+    if (final) {
+        printf("total: sent=%lu recv=%lu lost=%lu (%.3f%%) late=%lu "
+                "p50=%s p90=%s p99=%s p99.9=%s max=%s\n",
+                now.sent, now.recv, lost, now.sent ? 100.0 * lost / now.sent : 0.0, now.late,
+                p50, p90, p99, p999, pmax);
+    }
+    else {
+        printf("%3lus: tx=%lupps rx=%lupps lost=%lu late=%lu "
+                "p50=%s p90=%s p99=%s p99.9=%s\n",
+                elapsed, now.sent - prev->sent, now.recv - prev->recv, lost,
+                now.late - prev->late, p50, p90, p99, p999);
+    }
+
+    *prev = now;
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-r pps] [-P] [-s min[-max]|imix] [-b batch] [-d seconds] <host:port>\n"
+            "       %s -E [-t threads] [-b batch] <host:port>\n"
+            "\n"
+            "  -t  threads pinned to their own cpu (default 1)\n"
+            "  -r  total send rate in datagrams per second; 0 is unthrottled (default 10000)\n"
+            "  -P  poisson arrivals instead of a constant rate\n"
+            "  -s  payload size as fixed, uniform range or imix (default 64)\n"
+            "  -b  datagrams per sendmmsg/recvmmsg (default 32)\n"
+            "  -d  duration in seconds (default 10)\n"
+            "  -E  echo every datagram back to its sender\n",
+            name, name);
+    exit(1);
+}
+
+static bool parse_size(struct config *config, const char *arg)
+{
+    if (!strcmp(arg, "imix")) { config->dist = size_imix; return true; }
+
+    char *end = NULL;
+    config->size_min = strtoull(arg, &end, 10);
+    config->size_max = config->size_min;
+    config->dist = size_fixed;
+
+    if (*end == '-') {
+        config->size_max = strtoull(end + 1, &end, 10);
+        config->dist = size_uniform;
+    }
+
+    return !*end && config->size_min && config->size_min <= config->size_max;
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {
+        .threads = 1,
+        .rate = 10 * 1000,
+        .dist = size_fixed,
+        .size_min = 64,
+        .size_max = 64,
+        .batch = 32,
+        .duration = 10,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:Ps:b:d:Eh")) != -1) {
+        switch (opt) {
+        case 't': config.threads = strtoull(optarg, NULL, 10); break;
+        case 'r': config.rate = strtoull(optarg, NULL, 10); break;
+        case 'P': config.poisson = true; break;
+        case 's': if (!parse_size(&config, optarg)) usage(argv[0]); break;
+        case 'b': config.batch = strtoull(optarg, NULL, 10); break;
+        case 'd': config.duration = strtoull(optarg, NULL, 10); break;
+        case 'E': config.echo = true; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || !config.threads || !config.batch) usage(argv[0]);
+    if (config.rate && config.rate < config.threads) config.rate = config.threads;
+
+    config.host = pond_host_from_str(argv[optind]);
+    if (!config.host) { pond_perror(&pond_errno); return 1; }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (config.echo) {
+        struct echo *echos = calloc(config.threads, sizeof(*echos));
+        pond_assert_alloc(echos);
+
+        for (size_t i = 0; i < config.threads; ++i) {
+            echos[i] = (struct echo) { .id = i, .config = &config };
+            pthread_create(&echos[i].thread, NULL, echo_run, &echos[i]);
+        }
+
+        uint64_t prev = 0;
+        for (uint64_t elapsed = 1;; ++elapsed) {
+            sleep(1);
+
+            uint64_t recv = 0;
+            for (size_t i = 0; i < config.threads; ++i) recv += load(&echos[i].recv);
+            printf("%3lus: echo=%lupps\n", elapsed, recv - prev);
+            prev = recv;
+        }
+    }
+
+    struct sender *senders = calloc(config.threads, sizeof(*senders));
+    pond_assert_alloc(senders);
+
+    for (size_t i = 0; i < config.threads; ++i) {
+        struct sender *sender = &senders[i];
+        sender->id = i;
+        sender->config = &config;
+        sender->rng = pond_now() ^ ((i + 1) * 0x9E3779B97F4A7C15ULL);
+        pthread_create(&sender->thread, NULL, sender_run, sender);
+    }
+
+    struct report prev = {0};
+    for (uint64_t elapsed = 1; elapsed <= config.duration; ++elapsed) {
+        sleep(1);
+        report(&config, senders, &prev, elapsed, false);
+    }
+
+    atomic_store(&done, true);
+    for (size_t i = 0; i < config.threads; ++i) pthread_join(senders[i].thread, NULL);
+    report(&config, senders, &prev, config.duration, true);
+
+    free(senders);
+    pond_host_free(config.host);
+    return 0;
+}
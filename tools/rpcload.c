@@ -0,0 +1,272 @@
+/* rpcload.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Closed-loop pond_rpc driver over loopback.
+
+   usage: rpcload [-c concurrency] [-n calls] [-s size] [-b batch]
+                  [-T timeout_ms] [-D deadline_ms] [host]
+
+   A server thread echoes every request back while the main thread keeps a
+   fixed number of calls in flight against it by issuing a new call from the
+   callback of every completed one. The retry timeout must stay above the time
+   it takes to drain a full window of calls or the retries pile onto an already
+   saturated server. Each echoed payload is checked against the call it
+   completes. Exits with an error if any call didn't complete ok.
+*/
+
+#include "rpc.h"
+#include "net.h"
+#include "buf.h"
+#include "math.h"
+#include "process.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+struct config
+{
+    const char *host;
+    size_t concurrency;
+    size_t calls;
+    size_t size;
+    size_t batch;
+    uint64_t timeout;
+    uint64_t deadline;
+};
+
+enum { method_echo = 1 };
+
+struct payload
+{
+    uint64_t magic;
+    uint64_t seq;
+};
+
+static const uint64_t payload_magic = 0x64616f6c637072ULL;
+
+
+// -----------------------------------------------------------------------------
+// server
+// -----------------------------------------------------------------------------
+
+struct server
+{
+    pthread_t thread;
+    const struct config *config;
+    struct pond_udp *udp;
+};
+
+static bool server_echo(
+        void *ctx, uint16_t method, const uint8_t *data, size_t len, struct pond_bin *out)
+{
+    (void) ctx;
+    if (method != method_echo) return false;
+    return pond_bin_write(out, data, len) == len;
+}
+
+// Serves until the process exits.
+static void *server_run(void *data)
+{
+    struct server *server = data;
+
+    struct pond_rpc *rpc = pond_rpc_alloc(server->udp, &(struct pond_rpc_opt) {
+                .batch_cap = server->config->batch,
+                .handler = server_echo,
+            });
+
+    size_t sizes[] = { 2048 };
+    struct pond_mmsg *mmsg = pond_mmsg_alloc(server->config->batch, sizes, 1);
+
+    while (true) {
+        if (!pond_rpc_mrecv(rpc, mmsg)) pond_perror(&pond_errno);
+    }
+
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// client
+// -----------------------------------------------------------------------------
+
+struct client
+{
+    const struct config *config;
+    struct pond_rpc *rpc;
+
+    socklen_t addr_len;
+    const struct sockaddr *addr;
+
+    uint8_t *buf;
+    size_t issued;
+    size_t completed;
+    size_t peak;
+
+    uint64_t failed;   // calls that couldn't be issued.
+    uint64_t mismatch; // echoes that didn't match their call.
+};
+
+static void client_done(
+        void *ctx, uint64_t id, enum pond_rpc_status status, const uint8_t *data, size_t len);
+
+static void client_issue(struct client *client)
+{
+    const struct config *config = client->config;
+    if (client->issued == config->calls) return;
+
+    struct payload payload = { .magic = payload_magic, .seq = client->issued++ };
+    memcpy(client->buf, &payload, sizeof(payload));
+
+    uint64_t id = pond_rpc_call(
+            client->rpc, pond_now(), client->addr, client->addr_len,
+            method_echo, client->buf, config->size, client_done, client);
+
+    if (!id) {
+        pond_perror(&pond_errno);
+        client->failed++;
+        client->completed++;
+        return;
+    }
+
+    client->peak = pond_max(client->peak, pond_rpc_inflight(client->rpc));
+}
+
+static void client_done(
+        void *ctx, uint64_t id, enum pond_rpc_status status, const uint8_t *data, size_t len)
+{
+    (void) id;
+    struct client *client = ctx;
+    client->completed++;
+
+    if (status == pond_rpc_ok) {
+        struct payload payload = {0};
+        if (len == client->config->size) memcpy(&payload, data, sizeof(payload));
+        if (payload.magic != payload_magic || payload.seq >= client->issued)
+            client->mismatch++;
+    }
+
+    client_issue(client);
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-c concurrency] [-n calls] [-s size] [-b batch]\n"
+            "          [-T timeout_ms] [-D deadline_ms] [host]\n"
+            "\n"
+            "  -c  calls kept in flight (default 4096)\n"
+            "  -n  total number of calls (default 1000000)\n"
+            "  -s  payload size in bytes (default 64)\n"
+            "  -b  datagrams per sendmmsg/recvmmsg (default 64)\n"
+            "  -T  milliseconds before a call is retried (default 100)\n"
+            "  -D  milliseconds before a call times out (default 1000)\n"
+            "  host defaults to 127.0.0.1\n",
+            name);
+    exit(1);
+}
+
+static void report_ns(char *dst, size_t len, uint64_t ns)
+{
+    if (ns < 1000) snprintf(dst, len, "%luns", ns);
+    else if (ns < 1000 * 1000) snprintf(dst, len, "%.1fus", ns / 1e3);
+    else snprintf(dst, len, "%.1fms", ns / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {
+        .host = "127.0.0.1",
+        .concurrency = 4096,
+        .calls = 1000 * 1000,
+        .size = 64,
+        .batch = 64,
+        .timeout = 100,
+        .deadline = 1000,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:b:T:D:h")) != -1) {
+        switch (opt) {
+        case 'c': config.concurrency = strtoull(optarg, NULL, 10); break;
+        case 'n': config.calls = strtoull(optarg, NULL, 10); break;
+        case 's': config.size = strtoull(optarg, NULL, 10); break;
+        case 'b': config.batch = strtoull(optarg, NULL, 10); break;
+        case 'T': config.timeout = strtoull(optarg, NULL, 10); break;
+        case 'D': config.deadline = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (optind < argc - 1) usage(argv[0]);
+    if (optind == argc - 1) config.host = argv[optind];
+    if (!config.concurrency || !config.batch || !config.timeout || !config.deadline) usage(argv[0]);
+    if (config.size < sizeof(struct payload) || config.size > 1472 - pond_rpc_header_len) usage(argv[0]);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    struct pond_host *host = pond_host_from_port(config.host, 0);
+    struct pond_udp_opt udp_opt = { .rcvbuf = 4 << 20, .sndbuf = 4 << 20 };
+
+    struct server server = { .config = &config, .udp = pond_udp_server(host, &udp_opt) };
+    struct pond_udp *udp = pond_udp_server(host, &udp_opt);
+    if (!server.udp || !udp) { pond_perror(&pond_errno); return 1; }
+    pthread_create(&server.thread, NULL, server_run, &server);
+
+    struct client client = {
+        .config = &config,
+        .rpc = pond_rpc_alloc(udp, &(struct pond_rpc_opt) {
+                    .inflight_cap = config.concurrency,
+                    .batch_cap = config.batch,
+                    .timeout = config.timeout * 1000 * 1000,
+                    .deadline = config.deadline * 1000 * 1000,
+                }),
+        .buf = calloc(1, config.size),
+    };
+    pond_assert_alloc(client.buf);
+    client.addr = pond_udp_local(server.udp, &client.addr_len);
+
+    size_t sizes[] = { 2048 };
+    struct pond_mmsg *mmsg = pond_mmsg_alloc(config.batch, sizes, 1);
+
+    uint64_t start = pond_now();
+    for (size_t i = 0; i < config.concurrency; ++i) client_issue(&client);
+
+    while (client.completed < config.calls) {
+        if (!pond_rpc_mrecv(client.rpc, mmsg)) { pond_perror(&pond_errno); return 1; }
+    }
+    uint64_t elapsed = pond_now() - start;
+
+    struct pond_rpc_stats stats;
+    pond_rpc_stats(client.rpc, &stats);
+
+    // Histogram buckets are powers of two so these are upper bounds.
+    char p50[16], p99[16], p999[16];
+    report_ns(p50, sizeof(p50), pond_rpc_percentile(&stats, 0.50));
+    report_ns(p99, sizeof(p99), pond_rpc_percentile(&stats, 0.99));
+    report_ns(p999, sizeof(p999), pond_rpc_percentile(&stats, 0.999));
+
+    printf("calls=%lu ok=%lu errors=%lu timeouts=%lu retries=%lu unmatched=%lu "
+            "failed=%lu mismatch=%lu peak=%zu\n",
+            stats.calls, stats.ok, stats.errors, stats.timeouts, stats.retries,
+            stats.unmatched, client.failed, client.mismatch, client.peak);
+    printf("rate=%.0f calls/s p50<%s p99<%s p99.9<%s\n",
+            config.calls / (elapsed / 1e9), p50, p99, p999);
+
+    bool ok = stats.ok == config.calls && !client.mismatch;
+    return ok ? 0 : 1;
+}
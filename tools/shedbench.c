@@ -0,0 +1,186 @@
+/* shedbench.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Per-message cost of pond_shed_filter on synthetic batches.
+
+   usage: shedbench [-s sources] [-b batch] [-w width] [-d seconds] [-6] [-z]
+
+   Every batch is refilled with datagrams from a pool of IPv4 or IPv6 sources,
+   picked either uniformly or with a skew where a handful of sources send most
+   of the traffic, just before it's filtered so that its headers are as warm as
+   those of a batch fresh out of recvmmsg. Only the filter is timed, with
+   pond_clock around each call. The virtual time handed to the filter moves
+   forward a microsecond per batch so the decay sweeps are included at their
+   usual frequency.
+*/
+
+#include "shed.h"
+#include "net.h"
+#include "math.h"
+#include "process.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+struct config
+{
+    size_t sources;
+    size_t batch;
+    size_t width;
+    uint64_t duration;
+    bool ipv6;
+    bool skew;
+};
+
+
+// xorshift64*
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Skewed picks send half the traffic to the first 1% of the sources.
+static size_t pick_source(const struct config *config, uint64_t *rng)
+{
+    uint64_t r = rng_next(rng);
+    if (config->skew && r & 1) return (r >> 1) % pond_max(config->sources / 100, 1UL);
+    return (r >> 1) % config->sources;
+}
+
+static void fill_addr(const struct config *config, size_t source, struct sockaddr_storage *dst, socklen_t *len)
+{
+    memset(dst, 0, sizeof(*dst));
+
+    if (config->ipv6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) dst;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(1024 + source % 50000);
+        in6->sin6_addr.s6_addr[0] = 0x20;
+        in6->sin6_addr.s6_addr[1] = 0x01;
+        memcpy(&in6->sin6_addr.s6_addr[8], &source, sizeof(source));
+        *len = sizeof(*in6);
+    }
+    else {
+        struct sockaddr_in *in = (struct sockaddr_in *) dst;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(1024 + source % 50000);
+        in->sin_addr.s_addr = htonl(0x0A000000 + source);
+        *len = sizeof(*in);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s sources] [-b batch] [-w width] [-d seconds] [-6] [-z]\n"
+            "\n"
+            "  -s  distinct source addresses (default 10000)\n"
+            "  -b  datagrams per batch (default 64)\n"
+            "  -w  sketch width (default 2048)\n"
+            "  -d  duration in seconds (default 3)\n"
+            "  -6  IPv6 sources\n"
+            "  -z  skewed sources where 1%% of them send half the traffic\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {
+        .sources = 10 * 1000,
+        .batch = 64,
+        .width = 2048,
+        .duration = 3,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:w:d:6zh")) != -1) {
+        switch (opt) {
+        case 's': config.sources = strtoull(optarg, NULL, 10); break;
+        case 'b': config.batch = strtoull(optarg, NULL, 10); break;
+        case 'w': config.width = strtoull(optarg, NULL, 10); break;
+        case 'd': config.duration = strtoull(optarg, NULL, 10); break;
+        case '6': config.ipv6 = true; break;
+        case 'z': config.skew = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || !config.sources || !config.batch || !config.duration) usage(argv[0]);
+
+    uint64_t rng = 0x736865646265ULL;
+
+    socklen_t addr_len = 0;
+    struct sockaddr_storage *addrs = calloc(config.sources, sizeof(*addrs));
+    pond_assert_alloc(addrs);
+    for (size_t i = 0; i < config.sources; ++i) fill_addr(&config, i, &addrs[i], &addr_len);
+
+    size_t sizes[] = { 1472 };
+    struct pond_mmsg *mmsg = pond_mmsg_alloc(config.batch, sizes, 1);
+
+    struct pond_shed *shed = pond_shed_alloc(&(struct pond_shed_opt) {
+                .width = config.width,
+                .pkt_rate = 1000,
+                .action = pond_shed_defer,
+            });
+
+    size_t *order = calloc(config.batch, sizeof(*order));
+    pond_assert_alloc(order);
+
+    pond_clock_init();
+
+    uint64_t now = 1;
+    uint64_t msgs = 0, kept = 0, elapsed = 0;
+    uint64_t end = pond_now() + config.duration * 1000 * 1000 * 1000;
+
+    for (size_t iter = 0; (iter % 1024) || pond_now() < end; ++iter, now += 1000) {
+        for (size_t j = 0; j < config.batch; ++j) {
+            size_t source = pick_source(&config, &rng);
+            pond_mmsg_set_addr(mmsg, j, (struct sockaddr *) &addrs[source], addr_len);
+
+            struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, j);
+            iovec->len = 1;
+            iovec->vec[0].len = 64 + rng_next(&rng) % 1408;
+        }
+        pond_mmsg_set_len(mmsg, config.batch);
+
+        uint64_t start = pond_clock();
+        kept += pond_shed_filter(shed, now, mmsg, order);
+        elapsed += pond_clock() - start;
+
+        msgs += config.batch;
+    }
+
+    struct pond_shed_stats stats;
+    pond_shed_stats(shed, &stats);
+
+    printf("msgs=%lu kept=%lu over=%lu decays=%lu sources=%zu batch=%zu width=%zu %s%s\n",
+            msgs, kept, stats.over, stats.decays, config.sources, config.batch,
+            config.width, config.ipv6 ? "ipv6" : "ipv4", config.skew ? " skewed" : "");
+    printf("%.2f ns/msg %.1f Mmsg/s\n", (double) elapsed / msgs, msgs / (elapsed / 1e3));
+
+    pond_shed_free(shed);
+    pond_mmsg_free(mmsg);
+    free(addrs);
+    free(order);
+    return 0;
+}
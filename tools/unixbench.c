@@ -0,0 +1,260 @@
+/* unixbench.c
+   Rémi Attab (remi.attab@gmail.com), 19 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Per-datagram cost of pond_unix against loopback pond_udp.
+
+   usage: unixbench [-b batch] [-s size] [-d seconds]
+
+   Both transports run the same loop on a single thread: a batch is sent with
+   msend from one socket and drained with mrecv on another, so the numbers are
+   the combined cost of both syscalls and of the kernel path in between. The
+   UDP sender is connected to the receiver on 127.0.0.1 while the unix sockets
+   are bound in the abstract namespace and addressed per message.
+
+   A unix sender blocks once the receiver's queue holds more than
+   net.unix.max_dgram_qlen datagrams (10 on a stock kernel) which would
+   deadlock the single thread so the batch of both transports is capped to it.
+*/
+
+#include "net.h"
+#include "process.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+struct config
+{
+    size_t batch;
+    size_t size;
+    uint64_t duration;
+};
+
+struct result
+{
+    uint64_t msgs;
+    uint64_t elapsed;
+};
+
+static size_t unix_qlen(void)
+{
+    FILE *file = fopen("/proc/sys/net/unix/max_dgram_qlen", "r");
+    if (!file) return 0;
+
+    size_t qlen = 0;
+    if (fscanf(file, "%zu", &qlen) != 1) qlen = 0;
+
+    fclose(file);
+    return qlen;
+}
+
+static void fill(const struct config *config, struct pond_mmsg *mmsg)
+{
+    for (size_t i = 0; i < config->batch; ++i) {
+        struct pond_iovec *iovec = pond_mmsg_iovec(mmsg, i);
+        iovec->len = 1;
+        iovec->vec[0].len = config->size;
+        memset(iovec->vec[0].bin, (int) i, config->size);
+    }
+    pond_mmsg_set_len(mmsg, config->batch);
+}
+
+static void report(const char *name, const struct config *config, const struct result *result)
+{
+    printf("%-5s batch=%zu size=%zu msgs=%lu %.1f ns/msg %.2f Mmsg/s\n",
+            name, config->batch, config->size, result->msgs,
+            (double) result->elapsed / result->msgs,
+            result->msgs / (result->elapsed / 1e3));
+}
+
+
+// -----------------------------------------------------------------------------
+// bench
+// -----------------------------------------------------------------------------
+
+// The send and the receive calls are handed to the transport through the
+// callbacks so that both transports run the exact same loop.
+struct transport
+{
+    void *tx, *rx;
+    bool (*send) (void *, struct pond_mmsg *, size_t);
+    bool (*recv) (void *, struct pond_mmsg *, size_t);
+};
+
+static bool run(
+        const struct config *config, const struct transport *transport,
+        struct pond_mmsg *tx, struct pond_mmsg *rx, struct result *result)
+{
+    *result = (struct result) {0};
+
+    uint64_t start = pond_now();
+    uint64_t end = start + config->duration * 1000 * 1000 * 1000;
+
+    for (size_t iter = 0; (iter % 64) || pond_now() < end; ++iter) {
+        if (!transport->send(transport->tx, tx, config->batch)) return false;
+
+        for (size_t left = config->batch; left;) {
+            if (!transport->recv(transport->rx, rx, left)) return false;
+            left -= pond_mmsg_len(rx);
+        }
+
+        result->msgs += config->batch;
+    }
+
+    result->elapsed = pond_now() - start;
+    return true;
+}
+
+static bool udp_send(void *udp, struct pond_mmsg *mmsg, size_t len)
+{
+    return pond_udp_msend(udp, mmsg, len);
+}
+
+static bool udp_recv(void *udp, struct pond_mmsg *mmsg, size_t len)
+{
+    return pond_udp_mrecv(udp, mmsg, len);
+}
+
+static bool unix_send(void *unix_, struct pond_mmsg *mmsg, size_t len)
+{
+    return pond_unix_msend(unix_, mmsg, len);
+}
+
+static bool unix_recv(void *unix_, struct pond_mmsg *mmsg, size_t len)
+{
+    return pond_unix_mrecv(unix_, mmsg, len);
+}
+
+static bool bench_udp(
+        const struct config *config, struct pond_mmsg *tx, struct pond_mmsg *rx,
+        struct result *result)
+{
+    bool ok = false;
+
+    struct pond_host *host = pond_host_from_port("127.0.0.1", 0);
+    struct pond_udp *server = pond_udp_server(host, NULL);
+    pond_host_free(host);
+    if (!server) return false;
+
+    socklen_t len = 0;
+    const struct sockaddr_in *local = (const void *) pond_udp_local(server, &len);
+
+    host = pond_host_from_port("127.0.0.1", ntohs(local->sin_port));
+    struct pond_udp *client = pond_udp_client(host, NULL);
+    pond_host_free(host);
+    if (!client) goto fail_client;
+
+    struct transport transport = {
+        .tx = client, .rx = server, .send = udp_send, .recv = udp_recv,
+    };
+    ok = run(config, &transport, tx, rx, result);
+
+    pond_udp_close(client);
+  fail_client:
+    pond_udp_close(server);
+    return ok;
+}
+
+static bool bench_unix(
+        const struct config *config, struct pond_mmsg *tx, struct pond_mmsg *rx,
+        struct result *result)
+{
+    bool ok = false;
+
+    char rx_path[64], tx_path[64];
+    snprintf(rx_path, sizeof(rx_path), "@pond-unixbench-%d-rx", getpid());
+    snprintf(tx_path, sizeof(tx_path), "@pond-unixbench-%d-tx", getpid());
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len = pond_unix_addr(rx_path, &addr);
+    if (!addr_len) return false;
+
+    struct pond_unix *server = pond_unix_server(rx_path, NULL);
+    if (!server) return false;
+
+    struct pond_unix *client = pond_unix_server(tx_path, NULL);
+    if (!client) goto fail_client;
+
+    for (size_t i = 0; i < config->batch; ++i)
+        pond_mmsg_set_addr(tx, i, (struct sockaddr *) &addr, addr_len);
+
+    struct transport transport = {
+        .tx = client, .rx = server, .send = unix_send, .recv = unix_recv,
+    };
+    ok = run(config, &transport, tx, rx, result);
+
+    pond_unix_close(client);
+  fail_client:
+    pond_unix_close(server);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-b batch] [-s size] [-d seconds]\n"
+            "\n"
+            "  -b  datagrams per batch (default 32)\n"
+            "  -s  datagram payload size in bytes (default 64)\n"
+            "  -d  duration in seconds of each transport (default 3)\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {
+        .batch = 32,
+        .size = 64,
+        .duration = 3,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:d:h")) != -1) {
+        switch (opt) {
+        case 'b': config.batch = strtoull(optarg, NULL, 10); break;
+        case 's': config.size = strtoull(optarg, NULL, 10); break;
+        case 'd': config.duration = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || !config.batch || !config.size || !config.duration) usage(argv[0]);
+
+    size_t qlen = unix_qlen();
+    if (qlen && config.batch > qlen) {
+        fprintf(stderr, "batch capped to net.unix.max_dgram_qlen: %zu\n", qlen);
+        config.batch = qlen;
+    }
+
+    size_t sizes[] = { config.size };
+    struct pond_mmsg *tx = pond_mmsg_alloc(config.batch, sizes, 1);
+    struct pond_mmsg *rx = pond_mmsg_alloc(config.batch, sizes, 1);
+    fill(&config, tx);
+
+    struct result udp = {0}, unix_ = {0};
+    if (!bench_udp(&config, tx, rx, &udp)) { pond_perror(&pond_errno); return 1; }
+    if (!bench_unix(&config, tx, rx, &unix_)) { pond_perror(&pond_errno); return 1; }
+
+    report("udp", &config, &udp);
+    report("unix", &config, &unix_);
+    printf("unix/udp %.2fx\n", (double) udp.elapsed / udp.msgs / ((double) unix_.elapsed / unix_.msgs));
+
+    pond_mmsg_free(tx);
+    pond_mmsg_free(rx);
+    return 0;
+}